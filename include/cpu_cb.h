@@ -41,6 +41,10 @@ void            cpu_pulse_reset(void);
 void            cpu_set_fc(unsigned int fc);
 int             cpu_irq_ack(int level);
 void            cpu_instr_callback(int pc);
+/* Non-zero if cpu_instr_callback() is wanted before each instruction: */
+extern int      cpu_instr_hook;
+/* Count of device (non-RAM/ROM) byte accesses, for the profiler: */
+extern unsigned int cpu_mmio_accesses;
 
 extern unsigned int (*cpu_read_instr)(unsigned int address);
 
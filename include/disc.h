@@ -29,6 +29,8 @@
 
 typedef int (*disc_op_read)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
 typedef int (*disc_op_write)(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+typedef int (*disc_op_flush)(void *ctx);
+typedef void (*disc_op_prefetch)(void *ctx, unsigned int offset, unsigned int len);
 typedef struct {
         uint8_t *base;
         unsigned int size;
@@ -36,17 +38,46 @@ typedef struct {
         void *op_ctx;
         disc_op_read op_read;
         disc_op_write op_write;
+        disc_op_flush op_flush;
+        disc_op_prefetch op_prefetch;
 } disc_descr_t;
 
+typedef struct {
+        uint32_t offset;
+        uint32_t len;
+} disc_extent_t;
+
 #define DISC_NUM_DRIVES         2
 
 /* Passed an array of descriptors of disc data:
  * FIXME: provide callbacks to fops->read/write etc. instead of needing
  * a flat array.
  *
+ * If both base and op_write are given, base is used for reads/writes
+ * and op_write is then called after each write, as a write-through
+ * notification (e.g. to journal it).  op_flush (optional) is called
+ * when the guest ejects the disc or changes the track cache, i.e. at
+ * points where the data should be made durable.  op_prefetch
+ * (optional) is a hint that a range will be read soon, used when
+ * replaying a boot profile (see below).
+ *
  * Contents copied, pointer is not stored.
  */
 void    disc_init(disc_descr_t discs[DISC_NUM_DRIVES]);
 int     disc_pv_hook(uint8_t opcode);
 
+/* Boot profiles: record the order in which a drive's blocks are
+ * first read, as a list of extents.  A previously-recorded profile
+ * can be given back on a later run; reads are then followed along
+ * the profile, and op_prefetch is called for extents a little way
+ * ahead of the guest.  Call after disc_init().
+ *
+ * disc_profile_get() returns the number of extents recorded so far,
+ * and a pointer to them (valid until the next read).  The extents
+ * passed to disc_profile_replay() are copied.
+ */
+int     disc_profile_record(int drive, unsigned int max_extents);
+int     disc_profile_get(int drive, const disc_extent_t **extents);
+int     disc_profile_replay(int drive, const disc_extent_t *extents, unsigned int num);
+
 #endif
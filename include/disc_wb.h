@@ -0,0 +1,71 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DISC_WB_H
+#define DISC_WB_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/* Write-back policies for a persistent (writable) disc image: */
+enum disc_wb_policy {
+        DISC_WB_NONE = 0,       /* Legacy: MAP_SHARED, kernel decides */
+        DISC_WB_EJECT,          /* Commit on guest eject/flush, and exit */
+        DISC_WB_PERIODIC,       /* ...plus every N ms, if dirty */
+        DISC_WB_GROUP,          /* ...plus N ms after the first uncommitted write */
+        DISC_WB_SYNC,           /* Commit after every Prime() write */
+};
+
+typedef struct disc_wb disc_wb_t;
+
+/* Parse "none", "eject", "sync", "periodic:<ms>" or "group:<ms>".
+ * Returns 0 on success.
+ */
+int             disc_wb_parse_policy(const char *str, int *policy, unsigned int *ms);
+
+/* Replay a committed journal left over from a crash into the image
+ * open at fd, before it is mapped.  Returns 0 if the image is
+ * consistent (whether or not anything was replayed).  A journal with
+ * a record beyond the end of the image isn't applied, and is an error.
+ */
+int             disc_wb_recover(const char *image_path, int fd);
+
+/* Wrap the image open (RW) at fd, and MAP_PRIVATE-mapped at map.
+ * Writes are journalled (in image_path + ".jnl") and committed into
+ * the image according to policy.
+ */
+disc_wb_t       *disc_wb_open(const char *image_path, int fd, uint8_t *map,
+                              size_t size, int policy, unsigned int ms);
+
+/* disc_op_write/disc_op_flush-compatible callbacks, ctx = disc_wb_t: */
+int             disc_wb_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+int             disc_wb_flush(void *ctx);
+
+/* Call regularly from the main loop; commits when the policy's timer expires: */
+void            disc_wb_poll(disc_wb_t *wb);
+
+/* Commit outstanding writes and release resources: */
+void            disc_wb_close(disc_wb_t *wb);
+
+#endif
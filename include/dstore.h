@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DSTORE_H
+#define DSTORE_H
+
+#include <inttypes.h>
+
+/* Deduplicating disc image store.
+ *
+ * A pool file holds unique blocks, and each disc image is a map file
+ * of indices into the pool.  Guest writes go copy-on-write into
+ * private blocks in a per-instance overlay file (map + ".cow").
+ */
+
+#define DSTORE_BLK_SIZE         4096
+
+typedef struct dstore dstore_t;
+
+/* Add an image to a pool (creating the pool if needed), writing its
+ * map to map_path.  Returns 0 on success.
+ */
+int             dstore_import(const char *pool_path, const char *image_path,
+                              const char *map_path);
+/* Reconstitute a flat image from a pool and map (ignores any overlay). */
+int             dstore_export(const char *pool_path, const char *map_path,
+                              const char *image_path);
+/* Print pool statistics. */
+int             dstore_stats(const char *pool_path);
+
+/* Open an image for use as a disc.  If persistent, the overlay is
+ * kept in map_path + ".cow"; otherwise it's an anonymous temp file.
+ */
+dstore_t        *dstore_open(const char *pool_path, const char *map_path, int persistent);
+unsigned int    dstore_size(dstore_t *ds);
+void            dstore_close(dstore_t *ds);
+
+/* disc_op_* callbacks, ctx = dstore_t: */
+int             dstore_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+int             dstore_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len);
+int             dstore_flush(void *ctx);
+void            dstore_prefetch(void *ctx, unsigned int offset, unsigned int len);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRAMETIME_H
+#define FRAMETIME_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "histo.h"
+
+/* Frame timing: each frame's host time, split by phase.  The first
+ * three come from the core (see umac_set_host_clock()); the frontend
+ * times the display path, and the rest of the frame is "other" (event
+ * handling, polling, and waiting).
+ */
+#define FT_CPU          0
+#define FT_DISC         1
+#define FT_DEVICES      2
+#define FT_CONVERT      3               /* Mac framebuffer to host pixels */
+#define FT_PRESENT      4               /* Texture upload and present */
+#define FT_OTHER        5
+#define FT_TOTAL        6
+#define FT_NUM          7
+
+/* Start timing frames, for the report file spec; this also gives the
+ * core its clock.  Returns 0 on success.
+ */
+int     frametime_open(const char *spec);
+void    frametime_close(void);
+void    frametime_report(FILE *f);
+/* Non-zero while timing: */
+extern int frametime_active;
+
+/* The host clock, in ns: */
+uint64_t frametime_now_ns(void);
+/* Add host time spent in a frontend phase (FT_CONVERT, FT_PRESENT): */
+void    frametime_add(int phase, uint64_t ns);
+/* A frame's ended; period_ns is what it should have taken. */
+void    frametime_frame(uint64_t period_ns);
+/* Times for a phase over roughly the last FT_WINDOW_FRAMES to twice
+ * that many frames, into h:
+ */
+#define FT_WINDOW_FRAMES        600
+void    frametime_get(int phase, struct histo *h);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HISTO_H
+#define HISTO_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Log-linear histogram of unsigned values (such as times in us).
+ * Values below 8 get a bucket each; above that, each power of two is
+ * split into 8 buckets, so a bucket is within 12.5% of its values.
+ * Values of 2^40 and up share the last bucket.
+ */
+#define HISTO_SUB_BITS  3
+#define HISTO_MAX_BITS  40
+#define HISTO_BUCKETS   ((HISTO_MAX_BITS - HISTO_SUB_BITS + 1) << HISTO_SUB_BITS)
+
+struct histo {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t min;
+        uint64_t max;
+        uint64_t buckets[HISTO_BUCKETS];
+};
+
+void    histo_reset(struct histo *h);
+void    histo_add(struct histo *h, uint64_t v);
+/* Add all of from's values to h: */
+void    histo_merge(struct histo *h, const struct histo *from);
+/* The value below which pc percent of the values fall (approximately): */
+uint64_t histo_percentile(const struct histo *h, double pc);
+/* One line: count, min, mean, median, 90th and 99th percentiles and max,
+ * with values divided by scale (e.g. 1000 for us shown as ms):
+ */
+void    histo_print(FILE *f, const char *name, const struct histo *h,
+                    double scale, const char *unit);
+/* The non-empty buckets, one per line with a bar: */
+void    histo_print_bars(FILE *f, const struct histo *h, double scale, const char *unit);
+
+#endif
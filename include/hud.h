@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HUD_H
+#define HUD_H
+
+#include <inttypes.h>
+
+/* Text overlay for the frontend's 32bpp framebuffer, in a built-in
+ * 3x5 pixel font (upper case; lower case is shown as upper).  Each
+ * character takes a 4x6 cell.
+ */
+#define HUD_CHAR_W      4
+#define HUD_CHAR_H      6
+
+/* Draw text, with '\n' starting a new line, at x,y in fb (width by
+ * height pixels), over an opaque box of bg.  Anything that doesn't fit
+ * is clipped.
+ */
+void    hud_text(uint32_t *fb, unsigned int width, unsigned int height,
+                 unsigned int x, unsigned int y, const char *text,
+                 uint32_t fg, uint32_t bg);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Input-to-photon latency, for each type of input (UMAC_INPUT_*): from
+ * the host event's arrival, through the Mac taking it and the screen
+ * next changing, to the present that shows the change.  The report
+ * goes to the report file spec.  Returns 0 on success.
+ */
+int     latency_open(const char *spec);
+void    latency_close(void);
+void    latency_report(FILE *f);
+/* Non-zero while measuring: */
+extern int latency_active;
+
+/* A host input event has arrived.  measure is zero for events that
+ * are passed on but not timed (e.g. key releases).
+ */
+void    latency_input(int type, int measure);
+/* The Mac has taken the oldest input of this type (the core's
+ * input_consumed callback):
+ */
+void    latency_consumed(int type);
+/* Once per frame, with the Mac's screen about to be shown: */
+void    latency_frame(const uint8_t *fb, unsigned int len);
+/* ...and once it has been: */
+void    latency_presented(void);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Logging, with a runtime level per subsystem.  A message that's
+ * enabled is stored as a binary record (its call site and raw
+ * arguments) in a lock-free ring, and only formatted when the ring's
+ * drained by log_flush().  A disabled message costs a load and a
+ * predictable branch.
+ *
+ * As formatting is deferred, string (%s) arguments must outlive the
+ * record, e.g. be literals or from constant tables.  Up to LOG_MAX_ARGS
+ * arguments are kept, and '*' widths aren't supported.
+ */
+
+enum log_cat {
+        LOG_MAIN,
+        LOG_MEM,                /* Unmapped accesses */
+        LOG_VIA,
+        LOG_SCC,
+        LOG_DISC,
+        LOG_KBD,
+        LOG_NUM_CATS
+};
+
+enum log_level {
+        LOG_OFF,
+        LOG_ERR,
+        LOG_WARN,
+        LOG_INFO,
+        LOG_DEBUG
+};
+
+#define LOG_MAX_ARGS    6
+
+/* One per call site, filled in on first use: */
+struct log_site {
+        const char *fmt;
+        uint8_t nargs;
+        uint8_t types[LOG_MAX_ARGS];
+};
+
+extern uint8_t log_levels[LOG_NUM_CATS];
+
+void    log_write(struct log_site *site, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+#define LOG(cat, lvl, ...) do {                                         \
+                if (__builtin_expect(log_levels[(cat)] >= (lvl), 0)) {  \
+                        static struct log_site _log_site;               \
+                        log_write(&_log_site, __VA_ARGS__);             \
+                }                                                       \
+        } while (0)
+
+/* Set levels from a spec like "via=debug,scc=info" ("all" sets every
+ * category).  Returns 0 on success.
+ */
+int     log_set_levels(const char *spec);
+/* Format and write out the records so far (from one thread at a time): */
+void    log_flush(FILE *f);
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LTALK_H
+#define LTALK_H
+
+#include <inttypes.h>
+
+/* Bridges an SCC channel in SDLC mode to a LocalTalk hub (see
+ * tools/lthub.c), which passes LLAP frames between umac instances.
+ */
+typedef struct ltalk ltalk_t;
+
+/* hub_path is the hub's UNIX datagram socket.  AnB is SCC_CH_A or
+ * SCC_CH_B.
+ */
+ltalk_t         *ltalk_open(int AnB, const char *hub_path);
+void            ltalk_close(ltalk_t *lt);
+/* A frame from the Mac: */
+void            ltalk_tx_frame(ltalk_t *lt, const uint8_t *data, unsigned int len);
+/* Call regularly: passes frames from the hub to the SCC. */
+void            ltalk_poll(ltalk_t *lt);
+
+#endif
@@ -162,7 +162,12 @@
  */
 #ifdef ENABLE_DASM
 #define M68K_INSTRUCTION_HOOK       OPT_SPECIFY_HANDLER
-#define M68K_INSTRUCTION_CALLBACK(pc) cpu_instr_callback(pc)
+/* Only called when wanted (cpu_instr_hook, see cpu_cb.h), so costs a
+ * predictable branch otherwise (plus the instruction count, if
+ * metrics are enabled):
+ */
+#define M68K_INSTRUCTION_CALLBACK(pc) do { METRIC_INC(instructions); \
+                if (cpu_instr_hook) cpu_instr_callback(pc); } while (0)
 #else
 #define M68K_INSTRUCTION_HOOK       OPT_OFF
 #endif
@@ -225,6 +230,7 @@
 #define M68K_USE_64_BIT  OPT_ON
 
 #include "cpu_cb.h"
+#include "metrics.h"
 
 #define m68k_read_memory_8(A) cpu_read_byte(A)
 #define m68k_read_memory_16(A) cpu_read_word(A)
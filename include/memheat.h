@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MEMHEAT_H
+#define MEMHEAT_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Guest memory heatmap: counts reads, writes and instruction fetches
+ * per 4KB page of the 24-bit bus, by address as the CPU issues it (so
+ * the RAM at 0x600000 counts separately from its alias at 0).  A
+ * word or long access counts once.
+ *
+ * The counting sits on the CPU's memory access paths, so it's compiled
+ * in only with ENABLE_MEMHEAT; without it, MEMHEAT() is nothing.
+ */
+
+#define MEMHEAT_PAGE_SHIFT      12
+#define MEMHEAT_PAGES           (0x1000000 >> MEMHEAT_PAGE_SHIFT)
+
+#define MEMHEAT_READ            0
+#define MEMHEAT_WRITE           1
+#define MEMHEAT_FETCH           2
+#define MEMHEAT_KINDS           3
+
+#if ENABLE_MEMHEAT
+extern uint64_t memheat_counts[MEMHEAT_KINDS][MEMHEAT_PAGES];
+
+#define MEMHEAT(kind, addr)     (memheat_counts[kind][((addr) & 0xffffff) >> MEMHEAT_PAGE_SHIFT]++)
+#else
+#define MEMHEAT(kind, addr)     do {} while (0)
+#endif
+
+/* Report to spec (see report.h); returns 0 on success: */
+int     memheat_open(const char *spec);
+void    memheat_close(void);
+void    memheat_report(FILE *f);
+/* Non-zero while counting: */
+extern int memheat_active;
+
+#endif
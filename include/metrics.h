@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <inttypes.h>
+
+/* Runtime counters, kept by the core as it runs (and by the frontend,
+ * for presentation).  Counting is compiled in with ENABLE_METRICS, and
+ * is a plain increment; umac_get_metrics() takes a snapshot.
+ */
+
+/* VIA interrupt sources, by IFR bit: */
+#define METRIC_VIA_CA2          0
+#define METRIC_VIA_CA1          1
+#define METRIC_VIA_SR           2
+#define METRIC_VIA_T2           5
+
+struct umac_metrics {
+        uint64_t instructions;          /* Only with ENABLE_DASM (else 0) */
+        uint64_t cycles;
+        uint64_t via_irqs[8];           /* Raised, by IFR bit */
+        uint64_t scc_dcd_irqs[2];       /* Raised, by channel (SCC_CH_*) */
+        uint64_t via_accesses[16];      /* By register */
+        uint64_t iwm_accesses[16];      /* By register */
+        uint64_t scc_accesses[4];       /* By register: B/A control, B/A data */
+        uint64_t kbd_events;
+        uint64_t mouse_events;
+        uint64_t disc_reads;
+        uint64_t disc_read_bytes;
+        uint64_t disc_writes;
+        uint64_t disc_write_bytes;
+        uint64_t vsyncs;
+        /* Counted by the frontend: */
+        uint64_t frames_presented;
+        uint64_t frames_dropped;
+};
+
+#if ENABLE_METRICS
+extern struct umac_metrics umac_metrics;
+
+#define METRIC_INC(f)           (umac_metrics.f++)
+#define METRIC_ADD(f, n)        (umac_metrics.f += (n))
+#else
+#define METRIC_INC(f)           do {} while (0)
+#define METRIC_ADD(f, n)        do {} while (0)
+#endif
+
+/* Copy the counters so far (all zero without ENABLE_METRICS): */
+void    umac_get_metrics(struct umac_metrics *m);
+
+/* Exporter (metrics.c): serves a snapshot, as text, to each client
+ * that connects to a UNIX stream socket at path.  Call
+ * metrics_serve_poll() regularly, from the emulator's thread.
+ */
+typedef struct metrics_server metrics_server_t;
+
+metrics_server_t *metrics_serve_open(const char *path);
+void    metrics_serve_close(metrics_server_t *ms);
+void    metrics_serve_poll(metrics_server_t *ms);
+/* The text exposition of m, into buf; returns the length it needs: */
+int     metrics_format(char *buf, unsigned int len, const struct umac_metrics *m,
+                       double speed);
+
+#endif
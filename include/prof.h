@@ -0,0 +1,48 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Sampling profiler for guest code.  spec is
+ * "<report file>[,interval=N][,stacks]" (see report.h): sample the PC
+ * every N emulated cycles (default 1000), and report at prof_close().  With stacks, the guest call stack is sampled too,
+ * and the file gets folded stacks for flame graph tools instead.
+ * Returns 0 on success.
+ */
+int     prof_open(const char *spec);
+void    prof_close(void);
+/* Write the report so far: */
+void    prof_report(FILE *f);
+/* Non-zero while the hook needs calling: */
+extern int prof_active;
+/* Instruction hook, before executing the instruction at pc: */
+void    prof_insn(uint32_t pc, uint64_t cycle);
+/* The CPU's taking an interrupt: */
+void    prof_irq(int level);
+
+#endif
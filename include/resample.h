@@ -0,0 +1,50 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <inttypes.h>
+
+/* Mono polyphase windowed-sinc resampler */
+typedef struct resampler resampler_t;
+
+resampler_t     *resampler_new(double in_rate, double out_rate);
+void            resampler_free(resampler_t *rs);
+
+/* Scale the nominal in/out ratio, e.g. 1.001 consumes input 0.1%
+ * faster.  For drift compensation; keep within a percent or so.
+ */
+void            resampler_set_adjust(resampler_t *rs, double adjust);
+
+/* Space for, and queueing of, input samples: */
+unsigned int    resampler_space(resampler_t *rs);
+unsigned int    resampler_push(resampler_t *rs, const int16_t *in, unsigned int num);
+
+/* Generate up to num output samples; returns the number generated,
+ * which is less if more input is needed.
+ */
+unsigned int    resampler_pull(resampler_t *rs, int16_t *out, unsigned int num);
+
+#endif
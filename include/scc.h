@@ -25,9 +25,17 @@
 #ifndef SCC_H
 #define SCC_H
 
+/* Channels are numbered as the AnB address line: */
+#define SCC_CH_A        1
+#define SCC_CH_B        0
+
 /* Callbacks for various SCC events: */
 struct scc_cb {
         void (*irq_set)(int status);
+        /* A byte's finished transmitting: */
+        void (*tx)(int AnB, uint8_t data);
+        /* SDLC mode: a frame's finished transmitting (excluding CRC): */
+        void (*tx_frame)(int AnB, const uint8_t *data, unsigned int len);
 };
 
 void    scc_init(struct scc_cb *cb);
@@ -37,6 +45,27 @@ uint8_t scc_read(unsigned int address);
 void    scc_set_dcd(int a, int b);
 /* check if scc master interrupt is enabled */
 int scc_get_mie();
+/* Advance serial timing, and limit a slice so as not to overshoot: */
+void    scc_tick(int cycles);
+int     scc_limit_cycles(int cycles);
+/* Serial input: queue a received byte (-1 if the queue's full), and
+ * how many more can be queued:
+ */
+int     scc_rx_char(int AnB, uint8_t data);
+unsigned int    scc_rx_space(int AnB);
+/* Set the CTS (HSKi) input, e.g. for flow control: */
+void    scc_set_cts(int AnB, int asserted);
+/* Ignore the baud rate, and move characters as fast as the Mac can: */
+void    scc_set_fast(int AnB, int fast);
+
+/* SDLC frame input: up to scc_rx_frame_space() slots of SCC_FRAME_MAX
+ * bytes can be filled in place (slot 0 is the next to be committed),
+ * then committed in order with their lengths.
+ */
+#define SCC_FRAME_MAX   640
+unsigned int    scc_rx_frame_space(int AnB);
+uint8_t         *scc_rx_frame_slot(int AnB, unsigned int i);
+void            scc_rx_frame_commit(int AnB, unsigned int len);
 
 #endif
 
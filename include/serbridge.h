@@ -0,0 +1,46 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SERBRIDGE_H
+#define SERBRIDGE_H
+
+#include <inttypes.h>
+
+/* Bridges an SCC channel to a host PTY or UNIX stream socket. */
+typedef struct serbridge serbridge_t;
+
+/* spec is "pty" (a new PTY, whose name is printed), or the path of a
+ * UNIX socket: connected to if something's listening there, otherwise
+ * created and listened on.  Append ",fast" to ignore the Mac's baud
+ * rate.  AnB is SCC_CH_A or SCC_CH_B.
+ */
+serbridge_t     *serbridge_open(int AnB, const char *spec);
+void            serbridge_close(serbridge_t *sb);
+/* A byte from the Mac: */
+void            serbridge_tx(serbridge_t *sb, uint8_t data);
+/* Call regularly: passes host input to the SCC, and flushes output. */
+void            serbridge_poll(serbridge_t *sb);
+
+#endif
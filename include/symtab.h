@@ -0,0 +1,48 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <inttypes.h>
+
+/* Guest code symbolisation, for profiles and traces.  Names come from:
+ *  - A name map file: lines of "<hex address> <name>", where an address
+ *    below the ROM size is an offset into the ROM (as used in the
+ *    annotated ROM listings).
+ *  - The trap dispatch tables: a trap's entry point is named after it.
+ *  - MacsBug symbols, following the RTS/JMP (A0)/RTD ending a routine
+ *    in RAM.
+ * Names returned are interned, so can be compared by pointer.
+ */
+
+int             symtab_load(const char *path);
+/* Re-read the trap dispatch tables (which the Mac patches at boot): */
+void            symtab_scan_traps(void);
+/* Name of the routine containing addr, or NULL if unknown: */
+const char      *symtab_lookup(uint32_t addr);
+/* Name of an A-line trap, e.g. "NewHandle", or NULL if unknown: */
+const char      *symtab_trap_name(uint16_t trap);
+
+#endif
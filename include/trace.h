@@ -0,0 +1,98 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+
+/* Binary instruction trace.  The file is a struct trace_hdr followed
+ * by struct trace_recs, in host byte order; tools/tracedump.c turns it
+ * back into a disassembly.
+ */
+
+#define TRACE_MAGIC     "umactrc1"
+
+struct trace_hdr {
+        char magic[8];
+        uint32_t rec_size;
+        uint32_t flags;                 /* TRACE_F_* */
+};
+#define TRACE_F_REGS    1
+#define TRACE_F_FILTERED 2              /* Not every instruction */
+#define TRACE_F_WRITES  4
+
+#define TRACE_REC_INSN  0               /* At pc, words[] */
+#define TRACE_REC_REG   1               /* regs[reg] changed to value */
+#define TRACE_REC_WRITE 2               /* Write of value, reg bytes wide, to
+                                         * address words[0] << 16 | words[1] */
+#define TRACE_NUM_REGS  17              /* D0-7, A0-7, SR */
+#define TRACE_INSN_WORDS 5              /* Longest 68000 instruction */
+
+struct trace_rec {
+        uint64_t cycle;
+        uint32_t pc;                    /* Or value */
+        uint8_t type;
+        uint8_t reg;
+        uint16_t words[TRACE_INSN_WORDS];
+};
+
+/* spec is "<file>[,pc=<lo>-<hi>]...[,trap=<lo>[-<hi>]][,cycles=<from>-<to>][,regs][,writes]":
+ * record instructions within any of the PC ranges (default all), only
+ * A-line traps in the given range, only within the cycle window,
+ * register changes, and the memory writes made by the recorded
+ * instructions.  Addresses and traps are hex, cycles decimal.
+ * Returns 0 on success.
+ */
+int     trace_open(const char *spec);
+void    trace_close(void);
+/* Non-zero while the hook needs calling: */
+extern int trace_active;
+/* Instruction hook, before executing the instruction at pc: */
+void    trace_insn(uint32_t pc, uint64_t cycle);
+
+/* Lockstep check: compare execution, instruction by instruction,
+ * against an unfiltered trace recorded by a reference build (with
+ * regs, for register state too, and with writes, for each write).  The
+ * run must be repeatable, e.g. with the frontend's emulated-time mode
+ * and no input.
+ * Returns 0 on success.
+ */
+int     trace_check_open(const char *path);
+void    trace_check_close(void);
+/* Non-zero while the hook needs calling: */
+extern int trace_check_active;
+/* Instruction hook, before executing the instruction at pc; returns
+ * non-zero (having described it) at the first divergence:
+ */
+int     trace_check_insn(uint32_t pc, uint64_t cycle);
+
+/* Non-zero while trace_write() needs calling: */
+extern int trace_write_hook;
+/* Memory write hook, for a trace or check with writes; returns non-zero
+ * (having described it) if the write diverges from the reference:
+ */
+int     trace_write(uint32_t addr, int size, uint32_t value);
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRAPPROF_H
+#define TRAPPROF_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* A-line trap profiler: counts calls to each OS and Toolbox trap, and
+ * the emulated cycles from each call to its return (inclusive of any
+ * traps it calls), for the report file spec.  Returns 0 on success.
+ */
+int     trapprof_open(const char *spec);
+void    trapprof_close(void);
+/* Write the report so far: */
+void    trapprof_report(FILE *f);
+/* Non-zero while the hook needs calling: */
+extern int trapprof_active;
+/* Instruction hook, before executing the instruction at pc: */
+void    trapprof_insn(uint32_t pc, uint64_t cycle);
+
+#endif
@@ -33,35 +33,89 @@ int     umac_init(void *_ram_base, void *_rom_base, disc_descr_t discs[DISC_NUM_
 int     umac_loop(void);
 void    umac_reset(void);
 void    umac_opt_disassemble(int enable);
+/* CPU cycles executed so far (at 8 per emulated microsecond): */
+uint64_t umac_get_cycles(void);
+/* Host time accounting: once given a clock (monotonic, in ns),
+ * umac_loop() totals the host time spent executing, in disc requests
+ * (made from within execution, but not counted there) and in device
+ * ticks, by UMAC_TIME_*.
+ */
+#define UMAC_TIME_CPU           0
+#define UMAC_TIME_DISC          1
+#define UMAC_TIME_DEVICES       2
+#define UMAC_TIME_NUM           3
+void    umac_set_host_clock(uint64_t (*now_ns)(void));
+void    umac_get_host_times(uint64_t times[UMAC_TIME_NUM]);
 void    umac_mouse(int deltax, int deltay, int button);
 void    umac_absmouse(int x, int y, int button);
 void    umac_kbd_event(uint8_t scancode, int down);
+/* Input latency: consumed is called as the Mac takes an input that the
+ * frontend passed in: a key, in an Inquiry reply; a mouse button state,
+ * read from the VIA; or a movement, picked up by the cursor VBL task.
+ */
+#define UMAC_INPUT_KEY          0
+#define UMAC_INPUT_MOUSE_MOVE   1
+#define UMAC_INPUT_MOUSE_BUTTON 2
+#define UMAC_INPUT_NUM          3
+void    umac_set_input_consumed(void (*consumed)(int type));
+/* Key events waiting for the Mac, events lost to a full queue, and
+ * replies retried because the Mac wasn't yet ready for them:
+ */
+void    umac_kbd_get_stats(unsigned int *queued, unsigned int *drops, unsigned int *retries);
+/* Type a string, as a sequence of key events or (if direct) posted
+ * straight into the Mac's event queue.  See kbdtext.c.
+ */
+int     umac_type_text(const char *text, int direct);
+/* Serial ports: tx is called as each byte the Mac sends leaves the
+ * SCC, with channel SCC_CH_A (modem) or SCC_CH_B (printer).  Input
+ * goes in via scc_rx_char() etc. (see scc.h).
+ */
+void    umac_serial_set_tx(void (*tx)(int AnB, uint8_t data));
+/* Likewise, for whole frames sent in SDLC mode (i.e. LocalTalk); frames
+ * are received with scc_rx_frame_slot()/scc_rx_frame_commit().
+ */
+void    umac_serial_set_tx_frame(void (*tx_frame)(int AnB, const uint8_t *data, unsigned int len));
 
-static inline void      umac_vsync_event(void)
-{
-        via_caX_event(2);
-}
+/* Call at the start of vertical blanking, 60.15 times a second: */
+void    umac_vsync_event(void);
+/* fb_change is called (from umac_vsync_event()) when the Mac flips to
+ * the other screen buffer, with that buffer's offset into RAM:
+ */
+void    umac_set_fb_change(void (*fb_change)(unsigned int offset));
 
 static inline void      umac_1hz_event(void)
 {
         via_caX_event(1);
 }
 
+/* The main and alternate screen buffers, selected by VIA RA6: */
+#define UMAC_FB_MAIN_OFFSET     (RAM_SIZE - ((DISP_WIDTH * DISP_HEIGHT / 8) + 0x380))
+#define UMAC_FB_ALT_OFFSET      (UMAC_FB_MAIN_OFFSET - 0x8000)
+extern unsigned int umac_fb_offset;
+
 /* Return the offset into RAM of the current display buffer */
 static inline unsigned int      umac_get_fb_offset(void)
 {
-        /* FIXME: Implement VIA RA6/vid.pg2 */
-        return RAM_SIZE - ((DISP_WIDTH * DISP_HEIGHT / 8) + 0x380);
+        return umac_fb_offset;
 }
 
 #if ENABLE_AUDIO
-#define umac_get_audio_offset() (RAM_SIZE - 768)
-#define umac_get_audio_offset_end() (RAM_SIZE - 768 + 2 * 370)
+/* The main and alternate sound buffers, selected by VIA RA3: */
+#define UMAC_SND_MAIN_OFFSET    (RAM_SIZE - 0x300)
+#define UMAC_SND_ALT_OFFSET     (RAM_SIZE - 0x5f00)
+extern unsigned int umac_snd_offset;
+
+#define umac_get_audio_offset() (umac_snd_offset)
+#define umac_get_audio_offset_end() (umac_snd_offset + 2 * 370)
 extern unsigned first_audio_sample;
 #define umac_get_first_audio_sample() (first_audio_sample)
 #define umac_reset_first_audio_sample() (first_audio_sample = 0, (void)0)
 
-void umac_audio_trap();
+/* Provided by the frontend: called by umac_vsync_event() once per
+ * frame, when the 370 samples at umac_get_audio_offset() (the high
+ * byte of each word) are those played during the frame just ended.
+ */
+void umac_audio_frame(void);
 void umac_audio_cfg(int volume, int sndres);
 #endif
 
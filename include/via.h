@@ -44,6 +44,7 @@ void    via_tick(int cycles);
 int     via_limit_cycles(int cycles);
 /* Trigger an event on CA1 or CA2: */
 void    via_caX_event(int ca);
-void    via_sr_rx(uint8_t val);
+/* Keyboard response; returns -1 if the Mac isn't ready for it */
+int     via_sr_rx(uint8_t val);
 
 #endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef WAVCAP_H
+#define WAVCAP_H
+
+#include <inttypes.h>
+
+/* Capture of the Mac's sound buffer to a WAV file (8-bit unsigned
+ * mono, the Mac's native format), independent of any audio device.
+ */
+typedef struct wavcap wavcap_t;
+
+wavcap_t        *wavcap_open(const char *path, unsigned int rate);
+/* Append one sound buffer's worth (num words, sample in the high byte
+ * of each big-endian word), scaled by volume 0-7; silent if sndres.
+ */
+void            wavcap_frame(wavcap_t *wc, const uint8_t *buf, unsigned int num,
+                             int volume, int sndres);
+/* Finalise the header and close; NULL is OK. */
+void            wavcap_close(wavcap_t *wc);
+
+#endif
@@ -15,12 +15,10 @@
 #include "disc.h"
 #include "m68k.h"
 #include "machw.h"
+#include "metrics.h"
+#include "log.h"
 
-#ifdef DEBUG
-#define DDBG(...)       printf(__VA_ARGS__)
-#else
-#define DDBG(...)       do {} while(0)
-#endif
+#define DDBG(...)       LOG(LOG_DISC, LOG_DEBUG, __VA_ARGS__)
 
 #define DERR(...)       fprintf(stderr, __VA_ARGS__)
 
@@ -34,9 +32,151 @@ static int16_t SonyStatus(uint32_t pb, uint32_t dce);
 
 static void    SonyInit(disc_descr_t discs[DISC_NUM_DRIVES]);
 
+////////////////////////////////////////////////////////////////////////////////
+// Boot profiles
+
+#define DISC_PROF_BLK_SHIFT     9
+/* How far along the profile to look for the current read, and how
+ * far (in bytes) ahead of it to keep prefetches issued:
+ */
+#define DISC_PROF_SEARCH        64
+#define DISC_PROF_AHEAD         (1024*1024)
+
+typedef struct {
+        void *op_ctx;
+        disc_op_prefetch op_prefetch;
+        unsigned int size;
+        /* Recording: */
+        disc_extent_t *rec;
+        unsigned int rec_num;
+        unsigned int rec_max;
+        uint8_t *seen;                  /* Bitmap of blocks read so far */
+        /* Replay: */
+        disc_extent_t *play;
+        unsigned int play_num;
+        unsigned int play_cursor;       /* Next extent expected */
+        unsigned int play_issued;       /* Next extent to prefetch */
+} disc_prof_t;
+
+static disc_prof_t disc_prof[DISC_NUM_DRIVES];
+
+int     disc_profile_record(int drive, unsigned int max_extents)
+{
+        disc_prof_t *p = &disc_prof[drive];
+        unsigned int nblocks = (p->size >> DISC_PROF_BLK_SHIFT) + 1;
+
+        free(p->rec);
+        free(p->seen);
+        p->rec = calloc(max_extents, sizeof(disc_extent_t));
+        p->seen = calloc((nblocks + 7) / 8, 1);
+        p->rec_num = 0;
+        p->rec_max = max_extents;
+        if (!p->rec || !p->seen) {
+                free(p->rec);
+                free(p->seen);
+                p->rec = NULL;
+                p->seen = NULL;
+                return -1;
+        }
+        return 0;
+}
+
+int     disc_profile_get(int drive, const disc_extent_t **extents)
+{
+        *extents = disc_prof[drive].rec;
+        return disc_prof[drive].rec_num;
+}
+
+/* Issue prefetches from play_issued, until DISC_PROF_AHEAD bytes past
+ * the cursor are covered.
+ */
+static void     disc_profile_prefetch(disc_prof_t *p)
+{
+        unsigned int ahead = 0;
+
+        for (unsigned int i = p->play_cursor; i < p->play_issued && i < p->play_num; i++)
+                ahead += p->play[i].len;
+        while (p->play_issued < p->play_num && ahead < DISC_PROF_AHEAD) {
+                disc_extent_t *e = &p->play[p->play_issued++];
+                p->op_prefetch(p->op_ctx, e->offset, e->len);
+                ahead += e->len;
+        }
+}
+
+int     disc_profile_replay(int drive, const disc_extent_t *extents, unsigned int num)
+{
+        disc_prof_t *p = &disc_prof[drive];
+
+        free(p->play);
+        p->play = NULL;
+        p->play_num = p->play_cursor = p->play_issued = 0;
+        if (!p->op_prefetch || !num)
+                return 0;
+        p->play = malloc(num * sizeof(disc_extent_t));
+        if (!p->play)
+                return -1;
+        for (unsigned int i = 0; i < num; i++) {
+                /* Drop anything off the end (profile for another image?) */
+                if (extents[i].offset >= p->size)
+                        continue;
+                p->play[p->play_num] = extents[i];
+                if (p->play[p->play_num].len > p->size - extents[i].offset)
+                        p->play[p->play_num].len = p->size - extents[i].offset;
+                p->play_num++;
+        }
+        disc_profile_prefetch(p);
+        return 0;
+}
+
+/* Called for each read: record it, and move the replay along. */
+static void     disc_profile_read(int drive, unsigned int offset, unsigned int len)
+{
+        disc_prof_t *p = &disc_prof[drive];
+
+        if (p->rec && len) {
+                for (unsigned int b = offset >> DISC_PROF_BLK_SHIFT;
+                     b <= (offset + len - 1) >> DISC_PROF_BLK_SHIFT; b++) {
+                        if (p->seen[b >> 3] & (1 << (b & 7)))
+                                continue;
+                        p->seen[b >> 3] |= 1 << (b & 7);
+
+                        disc_extent_t *last = p->rec_num ? &p->rec[p->rec_num - 1] : NULL;
+                        uint32_t o = b << DISC_PROF_BLK_SHIFT;
+                        if (last && (last->offset + last->len) == o) {
+                                last->len += 1 << DISC_PROF_BLK_SHIFT;
+                        } else if (p->rec_num < p->rec_max) {
+                                p->rec[p->rec_num].offset = o;
+                                p->rec[p->rec_num].len = 1 << DISC_PROF_BLK_SHIFT;
+                                p->rec_num++;
+                        }
+                }
+        }
+
+        if (p->play_cursor < p->play_num) {
+                unsigned int end = p->play_cursor + DISC_PROF_SEARCH;
+                for (unsigned int i = p->play_cursor; i < end && i < p->play_num; i++) {
+                        disc_extent_t *e = &p->play[i];
+                        if (offset < e->offset + e->len && e->offset < offset + len) {
+                                p->play_cursor = i + 1;
+                                if (p->play_issued < p->play_cursor)
+                                        p->play_issued = p->play_cursor;
+                                disc_profile_prefetch(p);
+                                break;
+                        }
+                }
+        }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void    disc_init(disc_descr_t discs[DISC_NUM_DRIVES])
 {
         SonyInit(discs);
+        for (int i = 0; i < DISC_NUM_DRIVES; i++) {
+                disc_prof[i].op_ctx = discs[i].op_ctx;
+                disc_prof[i].op_prefetch = discs[i].op_prefetch;
+                disc_prof[i].size = discs[i].size;
+        }
 }
 
 /* This is the entrypoint redirected from the PV .Sony replacement driver.
@@ -137,7 +277,8 @@ typedef struct sony_drive_info {
 	uint32_t status;	// Mac address of drive status record
 	void *op_ctx;
 	disc_op_read op_read;   // Callback for read (when data == 0)
-	disc_op_write op_write; //  ''    ''    write  ''
+	disc_op_write op_write; //  ''    ''    write  '' (or write-through notify)
+	disc_op_flush op_flush; // Callback to make writes durable
 } sony_drinfo_t;
 
 // List of drives handled by this driver
@@ -170,6 +311,7 @@ void SonyInit(disc_descr_t discs[DISC_NUM_DRIVES])
         drives[0].op_ctx = discs[0].op_ctx;
         drives[0].op_read = discs[0].op_read;
         drives[0].op_write = discs[0].op_write;
+        drives[0].op_flush = discs[0].op_flush;
         // FIXME: Disc 2
 }
 
@@ -301,6 +443,9 @@ int16_t SonyPrime(uint32_t pb, uint32_t dce)
 	size_t actual = 0;
 	if ((ReadMacInt16(pb + ioTrap) & 0xff) == aRdCmd) {
                 DDBG("DISC: READ %ld from +0x%x\n", length, position);
+                METRIC_INC(disc_reads);
+                METRIC_ADD(disc_read_bytes, length);
+                disc_profile_read(info - drives, position, length);
                 if (info->data) {
                         DDBG(" (Read buffer: %p)\n", (void *)&info->data[position]);
                         memcpy(buffer, &info->data[position], length);
@@ -328,9 +473,16 @@ int16_t SonyPrime(uint32_t pb, uint32_t dce)
 			return set_dsk_err(wPrErr);
 
                 DDBG("DISC: WRITE %ld to +0x%x\n", length, position);
+                METRIC_INC(disc_writes);
+                METRIC_ADD(disc_write_bytes, length);
                 if (info->data) {
                         DDBG(" (Write buffer: %p)\n", (void *)&info->data[position]);
                         memcpy(&info->data[position], buffer, length);
+                        if (info->op_write) {
+                                int r = info->op_write(info->op_ctx, buffer, position, length);
+                                if (r < 0)
+                                        return set_dsk_err(writErr);
+                        }
                 } else {
                         if (info->op_write) {
                                 DDBG(" (write op into buffer)\n");
@@ -351,6 +503,20 @@ int16_t SonyPrime(uint32_t pb, uint32_t dce)
 }
 
 
+/*
+ *  Flush outstanding writes (if the disc has a flush strategy)
+ */
+
+static int16_t sony_flush(sony_drinfo_t *info)
+{
+        if (info->op_flush && info->op_flush(info->op_ctx) < 0) {
+                DERR("DISC: Flush failed!\n");
+                return writErr;
+        }
+        return noErr;
+}
+
+
 /*
  *  Driver Control() routine
  */
@@ -365,8 +531,14 @@ int16_t SonyControl(uint32_t pb, uint32_t dce)
 		case 1:		// KillIO (not supported)
 			return set_dsk_err(-1);
 
-		case 9:		// Track cache control (ignore, assume that host OS does the caching)
-			return set_dsk_err(noErr);
+		case 9: {	// Track cache control (host OS does the caching, but flush writes)
+			int16_t err = noErr;
+			for (int i = 0; i < DISC_NUM_DRIVES; i++) {
+				if (drives[i].op_flush && sony_flush(&drives[i]) != noErr)
+					err = writErr;
+			}
+			return set_dsk_err(err);
+		}
 
                 case 65: {	// Periodic action (accRun, "insert" disks on startup)
                         static int complained_yet = 0;
@@ -408,6 +580,7 @@ int16_t SonyControl(uint32_t pb, uint32_t dce)
 		case 7:			// Eject
 			if (ReadMacInt8(info->status + dsDiskInPlace) > 0) {
                                 DERR("DISC: EJECT\n");
+				err = sony_flush(info);
 //				SysEject(info->fh);
 				WriteMacInt8(info->status + dsDiskInPlace, 0);
 
@@ -0,0 +1,504 @@
+/* umac disc write-back/journalling
+ *
+ * Makes a writable disc image crash-consistent: the image is mapped
+ * MAP_PRIVATE, and each guest write (a Prime() call) marks its 512-byte
+ * blocks dirty.  At commit time, the dirty blocks are first written to
+ * a sidecar journal (ending with a checksummed commit record) which is
+ * fsync'd; only then are they written into the image, which is fsync'd
+ * in turn, and the journal is emptied.  A crash at any point leaves
+ * either the old image plus an incomplete (ignored) journal, or a
+ * complete journal which is replayed at next startup.  Either way the
+ * image is at a Prime() boundary.
+ *
+ * When commits happen is up to the policy (see disc_wb.h), so fsync
+ * cost is paid in batches.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "disc_wb.h"
+
+#ifdef DEBUG
+#define WDBG(...)       printf(__VA_ARGS__)
+#else
+#define WDBG(...)       do {} while(0)
+#endif
+
+#define WERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#define WB_BLK_SHIFT    9
+#define WB_BLK_SIZE     (1 << WB_BLK_SHIFT)
+
+/* Journal layout (host-endian; the journal's never moved between hosts):
+ *
+ *   jnl_hdr, then nrec * { jnl_rec, data[len] }, then jnl_commit
+ *
+ * The commit record's CRC covers everything before it.  A journal
+ * without a valid commit record (matching the header's seq) is
+ * incomplete, and ignored.
+ */
+#define JNL_MAGIC_HDR           0x4a4d5531      /* 'UMJ1' */
+#define JNL_MAGIC_COMMIT        0x434d5531      /* 'UMC1' */
+
+struct jnl_hdr {
+        uint32_t magic;
+        uint32_t seq;
+        uint32_t nrec;
+        uint32_t pad;
+};
+
+struct jnl_rec {
+        uint32_t offset;
+        uint32_t len;
+};
+
+struct jnl_commit {
+        uint32_t magic;
+        uint32_t seq;
+        uint32_t crc;
+        uint32_t pad;
+};
+
+struct disc_wb {
+        int fd;                 /* Image */
+        int jfd;                /* Journal */
+        uint8_t *map;
+        size_t size;
+        int policy;
+        uint64_t period_us;
+        uint32_t seq;
+        uint8_t *dirty;         /* Bitmap, one bit per block */
+        unsigned int nblocks;
+        unsigned int ndirty;
+        uint64_t dirty_since_us;
+        uint64_t last_commit_us;
+        unsigned int commits;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t crc_table[256];
+
+static void     crc_init(void)
+{
+        if (crc_table[1])
+                return;
+        for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                        c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+                crc_table[i] = c;
+        }
+}
+
+static uint32_t crc_update(uint32_t crc, const void *data, size_t len)
+{
+        const uint8_t *p = data;
+        crc = ~crc;
+        while (len--)
+                crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        return ~crc;
+}
+
+static uint64_t wb_now_us(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int      write_all(int fd, const void *buf, size_t len)
+{
+        const uint8_t *p = buf;
+        while (len) {
+                ssize_t r = write(fd, p, len);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                p += r;
+                len -= r;
+        }
+        return 0;
+}
+
+static int      pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+        const uint8_t *p = buf;
+        while (len) {
+                ssize_t r = pwrite(fd, p, len, offset);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                p += r;
+                len -= r;
+                offset += r;
+        }
+        return 0;
+}
+
+static char     *jnl_path(const char *image_path)
+{
+        size_t l = strlen(image_path);
+        char *p = malloc(l + 5);
+        if (p) {
+                memcpy(p, image_path, l);
+                memcpy(p + l, ".jnl", 5);
+        }
+        return p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int     disc_wb_parse_policy(const char *str, int *policy, unsigned int *ms)
+{
+        const char *arg = strchr(str, ':');
+        size_t l = arg ? (size_t)(arg - str) : strlen(str);
+
+        *ms = 0;
+        if (!strncmp(str, "none", l) && l == 4) {
+                *policy = DISC_WB_NONE;
+        } else if (!strncmp(str, "eject", l) && l == 5) {
+                *policy = DISC_WB_EJECT;
+        } else if (!strncmp(str, "sync", l) && l == 4) {
+                *policy = DISC_WB_SYNC;
+        } else if ((!strncmp(str, "periodic", l) && l == 8) ||
+                   (!strncmp(str, "group", l) && l == 5)) {
+                char *end;
+                if (!arg || !arg[1])
+                        return -1;
+                unsigned long v = strtoul(arg + 1, &end, 0);
+                if (*end || v == 0)
+                        return -1;
+                *policy = (str[0] == 'p') ? DISC_WB_PERIODIC : DISC_WB_GROUP;
+                *ms = v;
+        } else {
+                return -1;
+        }
+        /* Only periodic/group take an argument */
+        if (arg && *ms == 0)
+                return -1;
+        return 0;
+}
+
+/* Validate the journal in buf, and apply it to the image if complete.
+ * A complete journal with a record outside the image was written for a
+ * different image (or this one has been truncated): it's rejected as a
+ * whole and left alone, rather than extending/corrupting the image.
+ */
+static int      jnl_replay(int fd, const uint8_t *buf, size_t len)
+{
+        struct jnl_hdr h;
+        struct jnl_commit c;
+        struct stat sb;
+        size_t pos = sizeof(h);
+
+        if (len < sizeof(h) + sizeof(c))
+                return 0;
+        memcpy(&h, buf, sizeof(h));
+        if (h.magic != JNL_MAGIC_HDR)
+                return 0;
+
+        /* First pass: find the end, and check it */
+        for (uint32_t i = 0; i < h.nrec; i++) {
+                struct jnl_rec r;
+                if (pos + sizeof(r) > len)
+                        return 0;
+                memcpy(&r, buf + pos, sizeof(r));
+                pos += sizeof(r);
+                if (r.len > len - pos)
+                        return 0;
+                pos += r.len;
+        }
+        if (pos + sizeof(c) > len)
+                return 0;
+        memcpy(&c, buf + pos, sizeof(c));
+        if (c.magic != JNL_MAGIC_COMMIT || c.seq != h.seq ||
+            c.crc != crc_update(0, buf, pos)) {
+                WDBG("[DISCWB: Incomplete journal (seq %d) discarded]\n", h.seq);
+                return 0;
+        }
+
+        /* Complete: check it fits the image */
+        if (fstat(fd, &sb))
+                return -1;
+        pos = sizeof(h);
+        for (uint32_t i = 0; i < h.nrec; i++) {
+                struct jnl_rec r;
+                memcpy(&r, buf + pos, sizeof(r));
+                pos += sizeof(r);
+                if ((uint64_t)r.offset + r.len > (uint64_t)sb.st_size) {
+                        WERR("Disc journal: record %d (offset %u, len %u) is "
+                             "outside the %lld byte image; journal rejected\n",
+                             i, r.offset, r.len, (long long)sb.st_size);
+                        return -1;
+                }
+                pos += r.len;
+        }
+
+        /* Apply it */
+        pos = sizeof(h);
+        for (uint32_t i = 0; i < h.nrec; i++) {
+                struct jnl_rec r;
+                memcpy(&r, buf + pos, sizeof(r));
+                pos += sizeof(r);
+                if (pwrite_all(fd, buf + pos, r.len, r.offset))
+                        return -1;
+                pos += r.len;
+        }
+        if (fdatasync(fd))
+                return -1;
+        printf("Disc journal: replayed %d records (seq %d)\n", h.nrec, h.seq);
+        return 0;
+}
+
+int     disc_wb_recover(const char *image_path, int fd)
+{
+        char *jp = jnl_path(image_path);
+        int r = 0;
+
+        crc_init();
+        if (!jp)
+                return -1;
+        int jfd = open(jp, O_RDWR);
+        if (jfd < 0) {
+                free(jp);
+                return (errno == ENOENT) ? 0 : -1;
+        }
+
+        struct stat sb;
+        if (fstat(jfd, &sb) == 0 && sb.st_size > 0) {
+                uint8_t *buf = malloc(sb.st_size);
+                if (!buf || pread(jfd, buf, sb.st_size, 0) != sb.st_size) {
+                        r = -1;
+                } else {
+                        r = jnl_replay(fd, buf, sb.st_size);
+                }
+                free(buf);
+                /* Replayed or invalid, the journal's now redundant: */
+                if (r == 0 && (ftruncate(jfd, 0) || fdatasync(jfd)))
+                        r = -1;
+        }
+        close(jfd);
+        free(jp);
+        if (r)
+                WERR("Disc journal: recovery of '%s' failed!\n", image_path);
+        return r;
+}
+
+disc_wb_t       *disc_wb_open(const char *image_path, int fd, uint8_t *map,
+                              size_t size, int policy, unsigned int ms)
+{
+        disc_wb_t *wb = calloc(1, sizeof(*wb));
+        char *jp = jnl_path(image_path);
+
+        crc_init();
+        if (!wb || !jp)
+                goto fail;
+        wb->fd = fd;
+        wb->map = map;
+        wb->size = size;
+        wb->policy = policy;
+        wb->period_us = (uint64_t)ms * 1000;
+        wb->nblocks = (size + WB_BLK_SIZE - 1) >> WB_BLK_SHIFT;
+        wb->dirty = calloc((wb->nblocks + 7) / 8, 1);
+        wb->last_commit_us = wb_now_us();
+        if (!wb->dirty)
+                goto fail;
+        wb->jfd = open(jp, O_CREAT | O_RDWR, 0644);
+        if (wb->jfd < 0) {
+                perror("Disc journal");
+                goto fail;
+        }
+        free(jp);
+        return wb;
+
+fail:
+        if (wb)
+                free(wb->dirty);
+        free(wb);
+        free(jp);
+        return NULL;
+}
+
+static int      wb_is_dirty(disc_wb_t *wb, unsigned int blk)
+{
+        return wb->dirty[blk >> 3] & (1 << (blk & 7));
+}
+
+/* Find the next run of dirty blocks at or after *blk; returns its length */
+static unsigned int wb_next_run(disc_wb_t *wb, unsigned int *blk)
+{
+        unsigned int b = *blk;
+        while (b < wb->nblocks && !wb_is_dirty(wb, b)) {
+                /* Skip clean bytes quickly */
+                if (!(b & 7) && !wb->dirty[b >> 3])
+                        b += 8;
+                else
+                        b++;
+        }
+        *blk = b;
+        unsigned int e = b;
+        while (e < wb->nblocks && wb_is_dirty(wb, e))
+                e++;
+        return e - b;
+}
+
+static void     wb_run_extent(disc_wb_t *wb, unsigned int blk, unsigned int n,
+                              uint32_t *offset, uint32_t *len)
+{
+        *offset = blk << WB_BLK_SHIFT;
+        *len = n << WB_BLK_SHIFT;
+        if (*offset + *len > wb->size)
+                *len = wb->size - *offset;
+}
+
+static int      wb_commit(disc_wb_t *wb)
+{
+        struct jnl_hdr h = { .magic = JNL_MAGIC_HDR, .seq = ++wb->seq };
+        struct jnl_commit c = { .magic = JNL_MAGIC_COMMIT, .seq = h.seq };
+        unsigned int blk, n;
+        uint32_t crc;
+
+        if (!wb->ndirty)
+                return 0;
+
+        for (blk = 0; (n = wb_next_run(wb, &blk)) != 0; blk += n)
+                h.nrec++;
+
+        /* 1: Write the transaction to the journal, and make it durable */
+        if (lseek(wb->jfd, 0, SEEK_SET) < 0 ||
+            write_all(wb->jfd, &h, sizeof(h)))
+                goto fail;
+        crc = crc_update(0, &h, sizeof(h));
+        for (blk = 0; (n = wb_next_run(wb, &blk)) != 0; blk += n) {
+                struct jnl_rec r;
+                wb_run_extent(wb, blk, n, &r.offset, &r.len);
+                if (write_all(wb->jfd, &r, sizeof(r)) ||
+                    write_all(wb->jfd, wb->map + r.offset, r.len))
+                        goto fail;
+                crc = crc_update(crc, &r, sizeof(r));
+                crc = crc_update(crc, wb->map + r.offset, r.len);
+        }
+        c.crc = crc;
+        if (write_all(wb->jfd, &c, sizeof(c)) || fdatasync(wb->jfd))
+                goto fail;
+
+        /* 2: Now it's safe to update the image in-place */
+        for (blk = 0; (n = wb_next_run(wb, &blk)) != 0; blk += n) {
+                uint32_t offset, len;
+                wb_run_extent(wb, blk, n, &offset, &len);
+                if (pwrite_all(wb->fd, wb->map + offset, len, offset))
+                        goto fail;
+        }
+        if (fdatasync(wb->fd))
+                goto fail;
+
+        /* 3: Retire the journal.  If this doesn't hit the disc before
+         * a crash, the replay is idempotent.
+         */
+        if (ftruncate(wb->jfd, 0))
+                goto fail;
+
+        WDBG("[DISCWB: Committed %d blocks in %d extents (seq %d)]\n",
+             wb->ndirty, h.nrec, h.seq);
+        memset(wb->dirty, 0, (wb->nblocks + 7) / 8);
+        wb->ndirty = 0;
+        wb->commits++;
+        wb->last_commit_us = wb_now_us();
+        return 0;
+
+fail:
+        /* Blocks stay dirty, so the next commit retries. */
+        WERR("Disc journal: commit failed: %s\n", strerror(errno));
+        return -1;
+}
+
+int     disc_wb_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+        disc_wb_t *wb = ctx;
+        (void)data;     /* Already copied into the map by the disc code */
+
+        if (!len)
+                return 0;
+        if (!wb->ndirty)
+                wb->dirty_since_us = (wb->policy == DISC_WB_GROUP) ? wb_now_us() : 0;
+        for (unsigned int b = offset >> WB_BLK_SHIFT;
+             b <= (offset + len - 1) >> WB_BLK_SHIFT; b++) {
+                if (!wb_is_dirty(wb, b)) {
+                        wb->dirty[b >> 3] |= 1 << (b & 7);
+                        wb->ndirty++;
+                }
+        }
+        if (wb->policy == DISC_WB_SYNC)
+                return wb_commit(wb);
+        return 0;
+}
+
+int     disc_wb_flush(void *ctx)
+{
+        return wb_commit(ctx);
+}
+
+void    disc_wb_poll(disc_wb_t *wb)
+{
+        if (!wb || !wb->ndirty)
+                return;
+
+        uint64_t now = wb_now_us();
+        switch (wb->policy) {
+        case DISC_WB_PERIODIC:
+                if ((now - wb->last_commit_us) >= wb->period_us)
+                        wb_commit(wb);
+                break;
+        case DISC_WB_GROUP:
+                if ((now - wb->dirty_since_us) >= wb->period_us)
+                        wb_commit(wb);
+                break;
+        default:
+                break;
+        }
+}
+
+void    disc_wb_close(disc_wb_t *wb)
+{
+        if (!wb)
+                return;
+        wb_commit(wb);
+        WDBG("[DISCWB: %d commits]\n", wb->commits);
+        close(wb->jfd);
+        free(wb->dirty);
+        free(wb);
+}
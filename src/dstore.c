@@ -0,0 +1,646 @@
+/* umac deduplicating disc image store
+ *
+ * Many near-identical disc images can share one pool of unique,
+ * content-addressed blocks:
+ *
+ * - The pool file is a header followed by DSTORE_BLK_SIZE blocks.  It's
+ *   append-only, so a block's index never changes once written, and
+ *   running instances can share it (and its page cache) via a
+ *   read-only MAP_SHARED mapping.
+ * - A map file describes one image as a list of pool block indices.
+ * - Guest writes are copy-on-write: the block is copied into a private
+ *   overlay file, which has its own table of which blocks are private.
+ *
+ * Blocks are found by a hash, but always compared in full before being
+ * shared, so a hash collision can't corrupt an image.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dstore.h"
+
+#ifdef DEBUG
+#define DSDBG(...)      printf(__VA_ARGS__)
+#else
+#define DSDBG(...)      do {} while(0)
+#endif
+
+#define DSERR(...)      fprintf(stderr, __VA_ARGS__)
+
+#define BS              DSTORE_BLK_SIZE
+
+#define POOL_MAGIC      0x504d4455      /* 'UDMP' */
+#define MAP_MAGIC       0x4d4d4455      /* 'UDMM' */
+#define COW_MAGIC       0x434d4455      /* 'UDMC' */
+#define DS_VERSION      1
+
+/* Header occupies the first block, so pool blocks are page-aligned: */
+struct pool_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t blk_size;
+        uint32_t nblocks;
+        uint64_t pool_id;
+};
+
+struct map_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t blk_size;
+        uint32_t image_size;
+        uint64_t pool_id;
+        uint32_t nblocks;
+        uint32_t pad;
+        /* Then uint32_t index[nblocks] */
+};
+
+/* Overlay: header, table of (private index + 1) or 0 for shared, then
+ * private blocks from the first block boundary after the table.
+ */
+struct cow_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t nblocks;
+        uint32_t nprivate;
+};
+
+struct dstore {
+        int pool_fd;
+        int cow_fd;
+        const uint8_t *pool;    /* Mapping of pool, from block 0 (the header) */
+        size_t pool_map_size;
+        uint32_t pool_nblocks;
+        uint32_t image_size;
+        uint32_t nblocks;
+        uint32_t *index;        /* Pool block for each image block */
+        uint32_t *priv;         /* Private block + 1, or 0 */
+        uint32_t nprivate;
+        int durable;            /* Overlay is persistent */
+        off_t cow_data;         /* Offset of first private block */
+        uint8_t *bounce;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static uint64_t ds_hash(const uint8_t *blk)
+{
+        /* FNV-1a-like, but a 64-bit word at a time */
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < BS; i += 8) {
+                uint64_t w;
+                memcpy(&w, blk + i, 8);
+                h = (h ^ w) * 0x100000001b3ULL;
+                h ^= h >> 29;
+        }
+        return h;
+}
+
+static int      ds_pread(int fd, void *buf, size_t len, off_t offset)
+{
+        uint8_t *p = buf;
+        while (len) {
+                ssize_t r = pread(fd, p, len, offset);
+                if (r < 0 && errno == EINTR)
+                        continue;
+                if (r <= 0)
+                        return -1;
+                p += r;
+                len -= r;
+                offset += r;
+        }
+        return 0;
+}
+
+static int      ds_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+        const uint8_t *p = buf;
+        while (len) {
+                ssize_t r = pwrite(fd, p, len, offset);
+                if (r < 0 && errno == EINTR)
+                        continue;
+                if (r <= 0)
+                        return -1;
+                p += r;
+                len -= r;
+                offset += r;
+        }
+        return 0;
+}
+
+static off_t    pool_blk_offset(uint32_t idx)
+{
+        return (off_t)(idx + 1) * BS;
+}
+
+static int      pool_read_hdr(int fd, struct pool_hdr *h)
+{
+        if (ds_pread(fd, h, sizeof(*h), 0))
+                return -1;
+        if (h->magic != POOL_MAGIC || h->version != DS_VERSION || h->blk_size != BS) {
+                DSERR("dstore: Not a pool, or wrong version/block size\n");
+                return -1;
+        }
+        return 0;
+}
+
+static int      map_read(const char *map_path, struct map_hdr *h, uint32_t **index)
+{
+        int fd = open(map_path, O_RDONLY);
+        if (fd < 0) {
+                perror("dstore: map");
+                return -1;
+        }
+        if (ds_pread(fd, h, sizeof(*h), 0) ||
+            h->magic != MAP_MAGIC || h->version != DS_VERSION || h->blk_size != BS) {
+                DSERR("dstore: '%s' isn't a map file\n", map_path);
+                close(fd);
+                return -1;
+        }
+        *index = malloc((size_t)h->nblocks * sizeof(uint32_t));
+        if (!*index || ds_pread(fd, *index, (size_t)h->nblocks * sizeof(uint32_t), sizeof(*h))) {
+                DSERR("dstore: Short map file '%s'\n", map_path);
+                free(*index);
+                close(fd);
+                return -1;
+        }
+        close(fd);
+        return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Import/export (offline)
+
+/* Open-addressed table of hash -> pool index, for finding duplicates */
+typedef struct {
+        uint64_t *hash;
+        uint32_t *idx;          /* Pool index + 1, 0 = empty */
+        uint32_t mask;
+} ds_htab_t;
+
+static int      htab_init(ds_htab_t *t, uint32_t entries)
+{
+        uint32_t sz = 1024;
+        while (sz < entries * 2)
+                sz <<= 1;
+        t->hash = calloc(sz, sizeof(uint64_t));
+        t->idx = calloc(sz, sizeof(uint32_t));
+        t->mask = sz - 1;
+        return (t->hash && t->idx) ? 0 : -1;
+}
+
+static void     htab_free(ds_htab_t *t)
+{
+        free(t->hash);
+        free(t->idx);
+}
+
+static void     htab_insert(ds_htab_t *t, uint64_t h, uint32_t idx)
+{
+        uint32_t s = h & t->mask;
+        while (t->idx[s])
+                s = (s + 1) & t->mask;
+        t->hash[s] = h;
+        t->idx[s] = idx + 1;
+}
+
+int     dstore_import(const char *pool_path, const char *image_path, const char *map_path)
+{
+        struct pool_hdr ph;
+        struct stat sb;
+        uint8_t *img = NULL, *cand = NULL;
+        uint32_t *index = NULL;
+        ds_htab_t t = {0};
+        int ifd = -1, mfd = -1, r = -1;
+        uint32_t reused = 0, added = 0;
+
+        int pfd = open(pool_path, O_RDWR | O_CREAT, 0644);
+        if (pfd < 0 || flock(pfd, LOCK_EX)) {
+                perror("dstore: pool");
+                goto out;
+        }
+        if (fstat(pfd, &sb))
+                goto out;
+        if (sb.st_size == 0) {
+                uint8_t hblk[BS] = {0};
+                memset(&ph, 0, sizeof(ph));
+                ph.magic = POOL_MAGIC;
+                ph.version = DS_VERSION;
+                ph.blk_size = BS;
+                ph.pool_id = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ (uintptr_t)&ph;
+                memcpy(hblk, &ph, sizeof(ph));
+                if (ds_pwrite(pfd, hblk, BS, 0))
+                        goto out;
+        } else if (pool_read_hdr(pfd, &ph)) {
+                goto out;
+        }
+
+        ifd = open(image_path, O_RDONLY);
+        if (ifd < 0 || fstat(ifd, &sb)) {
+                perror("dstore: image");
+                goto out;
+        }
+        uint32_t image_size = sb.st_size;
+        uint32_t nblocks = (image_size + BS - 1) / BS;
+        img = calloc(1, BS);
+        cand = malloc(BS);
+        index = malloc((size_t)nblocks * sizeof(uint32_t));
+        if (!img || !cand || !index || htab_init(&t, ph.nblocks + nblocks))
+                goto out;
+
+        /* Index what's in the pool already */
+        for (uint32_t i = 0; i < ph.nblocks; i++) {
+                if (ds_pread(pfd, cand, BS, pool_blk_offset(i)))
+                        goto out;
+                htab_insert(&t, ds_hash(cand), i);
+        }
+
+        for (uint32_t b = 0; b < nblocks; b++) {
+                size_t l = (b == nblocks - 1 && (image_size % BS)) ? image_size % BS : BS;
+                memset(img, 0, BS);
+                if (ds_pread(ifd, img, l, (off_t)b * BS))
+                        goto out;
+
+                uint64_t h = ds_hash(img);
+                uint32_t s = h & t.mask;
+                int found = 0;
+                for (; t.idx[s]; s = (s + 1) & t.mask) {
+                        if (t.hash[s] != h)
+                                continue;
+                        if (ds_pread(pfd, cand, BS, pool_blk_offset(t.idx[s] - 1)))
+                                goto out;
+                        if (!memcmp(cand, img, BS)) {
+                                index[b] = t.idx[s] - 1;
+                                found = 1;
+                                break;
+                        }
+                }
+                if (found) {
+                        reused++;
+                        continue;
+                }
+                if (ds_pwrite(pfd, img, BS, pool_blk_offset(ph.nblocks)))
+                        goto out;
+                htab_insert(&t, h, ph.nblocks);
+                index[b] = ph.nblocks++;
+                added++;
+        }
+
+        /* Blocks must be durable before the header (or a map) refers to them */
+        if (fdatasync(pfd) || ds_pwrite(pfd, &ph, sizeof(ph), 0) || fdatasync(pfd))
+                goto out;
+
+        struct map_hdr mh = { .magic = MAP_MAGIC, .version = DS_VERSION, .blk_size = BS,
+                              .image_size = image_size, .pool_id = ph.pool_id,
+                              .nblocks = nblocks };
+        mfd = open(map_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mfd < 0 || ds_pwrite(mfd, &mh, sizeof(mh), 0) ||
+            ds_pwrite(mfd, index, (size_t)nblocks * sizeof(uint32_t), sizeof(mh)) ||
+            fsync(mfd)) {
+                perror("dstore: map");
+                goto out;
+        }
+        printf("dstore: %s: %d blocks, %d shared, %d added (pool now %d blocks)\n",
+               image_path, nblocks, reused, added, ph.nblocks);
+        r = 0;
+
+out:
+        htab_free(&t);
+        free(img);
+        free(cand);
+        free(index);
+        if (mfd >= 0)
+                close(mfd);
+        if (ifd >= 0)
+                close(ifd);
+        if (pfd >= 0)
+                close(pfd);
+        return r;
+}
+
+int     dstore_export(const char *pool_path, const char *map_path, const char *image_path)
+{
+        dstore_t *ds = dstore_open(pool_path, map_path, 0);
+        uint8_t *buf = malloc(BS);
+        int r = -1;
+
+        int fd = open(image_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (!ds || !buf || fd < 0)
+                goto out;
+        for (uint32_t o = 0; o < ds->image_size; o += BS) {
+                uint32_t l = (ds->image_size - o < BS) ? ds->image_size - o : BS;
+                if (dstore_read(ds, buf, o, l) || ds_pwrite(fd, buf, l, o))
+                        goto out;
+        }
+        r = 0;
+out:
+        if (fd >= 0)
+                close(fd);
+        free(buf);
+        dstore_close(ds);
+        return r;
+}
+
+int     dstore_stats(const char *pool_path)
+{
+        struct pool_hdr ph;
+        int fd = open(pool_path, O_RDONLY);
+        if (fd < 0 || pool_read_hdr(fd, &ph)) {
+                if (fd >= 0)
+                        close(fd);
+                return -1;
+        }
+        printf("dstore: pool %s: id %016" PRIx64 ", %d blocks of %d bytes (%" PRIu64 "KB)\n",
+               pool_path, ph.pool_id, ph.nblocks, ph.blk_size,
+               ((uint64_t)ph.nblocks * ph.blk_size) / 1024);
+        close(fd);
+        return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runtime
+
+static off_t    cow_blk_offset(dstore_t *ds, uint32_t priv)
+{
+        return ds->cow_data + (off_t)priv * BS;
+}
+
+/* Non-zero unless each entry is 0, or a distinct private block + 1 */
+static int      cow_check_table(const uint32_t *priv, uint32_t nblocks, uint32_t nprivate)
+{
+        uint8_t *used = calloc(nprivate ? nprivate : 1, 1);
+        int r = 0;
+
+        if (!used)
+                return -1;
+        for (uint32_t b = 0; b < nblocks && !r; b++) {
+                if (!priv[b])
+                        continue;
+                if (priv[b] > nprivate || used[priv[b] - 1])
+                        r = -1;
+                else
+                        used[priv[b] - 1] = 1;
+        }
+        free(used);
+        return r;
+}
+
+static int      cow_open(dstore_t *ds, const char *map_path, int persistent)
+{
+        struct cow_hdr ch;
+        struct stat sb;
+        size_t tbl = (size_t)ds->nblocks * sizeof(uint32_t);
+
+        ds->cow_data = ((sizeof(ch) + tbl + BS - 1) / BS) * BS;
+        ds->durable = persistent;
+        ds->priv = calloc(ds->nblocks, sizeof(uint32_t));
+        if (!ds->priv)
+                return -1;
+
+        if (!persistent) {
+                FILE *tf = tmpfile();
+                if (!tf)
+                        return -1;
+                ds->cow_fd = dup(fileno(tf));
+                fclose(tf);
+                return (ds->cow_fd < 0) ? -1 : 0;
+        }
+
+        size_t l = strlen(map_path);
+        char *cp = malloc(l + 5);
+        if (!cp)
+                return -1;
+        memcpy(cp, map_path, l);
+        memcpy(cp + l, ".cow", 5);
+        ds->cow_fd = open(cp, O_RDWR | O_CREAT, 0644);
+        free(cp);
+        if (ds->cow_fd < 0) {
+                perror("dstore: overlay");
+                return -1;
+        }
+
+        if (ds_pread(ds->cow_fd, &ch, sizeof(ch), 0) == 0) {
+                if (ch.magic != COW_MAGIC || ch.version != DS_VERSION ||
+                    ch.nblocks != ds->nblocks ||
+                    ds_pread(ds->cow_fd, ds->priv, tbl, sizeof(ch))) {
+                        DSERR("dstore: Overlay doesn't match map\n");
+                        return -1;
+                }
+                /* Every counted private block must be in the file, and
+                 * be used by at most one image block, or a new one
+                 * could alias an existing one:
+                 */
+                if (fstat(ds->cow_fd, &sb) ||
+                    cow_blk_offset(ds, ch.nprivate) > sb.st_size ||
+                    cow_check_table(ds->priv, ds->nblocks, ch.nprivate)) {
+                        DSERR("dstore: Overlay table is corrupt\n");
+                        return -1;
+                }
+                ds->nprivate = ch.nprivate;
+        } else {
+                ch = (struct cow_hdr){ .magic = COW_MAGIC, .version = DS_VERSION,
+                                       .nblocks = ds->nblocks };
+                if (ds_pwrite(ds->cow_fd, &ch, sizeof(ch), 0) ||
+                    ds_pwrite(ds->cow_fd, ds->priv, tbl, sizeof(ch)))
+                        return -1;
+        }
+        return 0;
+}
+
+dstore_t        *dstore_open(const char *pool_path, const char *map_path, int persistent)
+{
+        struct pool_hdr ph;
+        struct map_hdr mh;
+        dstore_t *ds = calloc(1, sizeof(*ds));
+
+        if (!ds)
+                return NULL;
+        ds->pool_fd = ds->cow_fd = -1;
+        ds->pool = MAP_FAILED;
+
+        ds->pool_fd = open(pool_path, O_RDONLY);
+        if (ds->pool_fd < 0) {
+                perror("dstore: pool");
+                goto fail;
+        }
+        if (pool_read_hdr(ds->pool_fd, &ph) || map_read(map_path, &mh, &ds->index))
+                goto fail;
+        if (mh.pool_id != ph.pool_id) {
+                DSERR("dstore: Map '%s' belongs to a different pool\n", map_path);
+                goto fail;
+        }
+        if ((uint64_t)mh.image_size > (uint64_t)mh.nblocks * BS) {
+                DSERR("dstore: Map '%s' is too short for its image\n", map_path);
+                goto fail;
+        }
+        for (uint32_t i = 0; i < mh.nblocks; i++) {
+                if (ds->index[i] >= ph.nblocks) {
+                        DSERR("dstore: Map refers past end of pool\n");
+                        goto fail;
+                }
+        }
+        ds->image_size = mh.image_size;
+        ds->nblocks = mh.nblocks;
+        ds->pool_nblocks = ph.nblocks;
+        ds->pool_map_size = pool_blk_offset(ph.nblocks);
+        ds->pool = mmap(0, ds->pool_map_size, PROT_READ, MAP_SHARED, ds->pool_fd, 0);
+        if (ds->pool == MAP_FAILED) {
+                perror("dstore: pool mmap");
+                goto fail;
+        }
+        ds->bounce = malloc(BS);
+        if (!ds->bounce || cow_open(ds, map_path, persistent))
+                goto fail;
+
+        DSDBG("[dstore: %d blocks, %d private]\n", ds->nblocks, ds->nprivate);
+        return ds;
+
+fail:
+        dstore_close(ds);
+        return NULL;
+}
+
+unsigned int    dstore_size(dstore_t *ds)
+{
+        return ds->image_size;
+}
+
+void    dstore_close(dstore_t *ds)
+{
+        if (!ds)
+                return;
+        if (ds->pool != MAP_FAILED)
+                munmap((void *)ds->pool, ds->pool_map_size);
+        if (ds->pool_fd >= 0)
+                close(ds->pool_fd);
+        if (ds->cow_fd >= 0) {
+                fdatasync(ds->cow_fd);
+                close(ds->cow_fd);
+        }
+        free(ds->bounce);
+        free(ds->index);
+        free(ds->priv);
+        free(ds);
+}
+
+int     dstore_read(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+        dstore_t *ds = ctx;
+
+        if ((uint64_t)offset + len > ds->image_size)
+                return -1;
+        while (len) {
+                uint32_t b = offset / BS;
+                uint32_t bo = offset % BS;
+                uint32_t l = (BS - bo < len) ? BS - bo : len;
+
+                if (ds->priv[b]) {
+                        if (ds_pread(ds->cow_fd, data, l, cow_blk_offset(ds, ds->priv[b] - 1) + bo))
+                                return -1;
+                } else {
+                        memcpy(data, ds->pool + pool_blk_offset(ds->index[b]) + bo, l);
+                }
+                data += l;
+                offset += l;
+                len -= l;
+        }
+        return 0;
+}
+
+int     dstore_write(void *ctx, uint8_t *data, unsigned int offset, unsigned int len)
+{
+        dstore_t *ds = ctx;
+
+        if ((uint64_t)offset + len > ds->image_size)
+                return -1;
+        while (len) {
+                uint32_t b = offset / BS;
+                uint32_t bo = offset % BS;
+                uint32_t l = (BS - bo < len) ? BS - bo : len;
+
+                if (!ds->priv[b]) {
+                        /* First write to a shared block: copy it to a new private one */
+                        uint32_t p = ds->nprivate;
+                        memcpy(ds->bounce, ds->pool + pool_blk_offset(ds->index[b]), BS);
+                        memcpy(ds->bounce + bo, data, l);
+                        if (ds_pwrite(ds->cow_fd, ds->bounce, BS, cow_blk_offset(ds, p)))
+                                return -1;
+                        /* Then make it visible: the data and count must
+                         * be durable before the table refers to the block,
+                         * so a torn update at worst leaks a block.
+                         */
+                        ds->nprivate++;
+                        ds->priv[b] = p + 1;
+                        if (ds_pwrite(ds->cow_fd, &ds->nprivate, sizeof(uint32_t),
+                                      offsetof(struct cow_hdr, nprivate)) ||
+                            (ds->durable && fdatasync(ds->cow_fd)) ||
+                            ds_pwrite(ds->cow_fd, &ds->priv[b], sizeof(uint32_t),
+                                      sizeof(struct cow_hdr) + b * sizeof(uint32_t)))
+                                return -1;
+                        DSDBG("[dstore: block %d now private (%d)]\n", b, p);
+                } else if (ds_pwrite(ds->cow_fd, data, l, cow_blk_offset(ds, ds->priv[b] - 1) + bo)) {
+                        return -1;
+                }
+                data += l;
+                offset += l;
+                len -= l;
+        }
+        return 0;
+}
+
+int     dstore_flush(void *ctx)
+{
+        dstore_t *ds = ctx;
+        return fdatasync(ds->cow_fd);
+}
+
+void    dstore_prefetch(void *ctx, unsigned int offset, unsigned int len)
+{
+        dstore_t *ds = ctx;
+        uintptr_t pg = sysconf(_SC_PAGESIZE);
+
+        if (!len || offset >= ds->image_size)
+                return;
+        if (len > ds->image_size - offset)
+                len = ds->image_size - offset;
+        for (uint32_t b = offset / BS; b <= (offset + len - 1) / BS; b++) {
+                if (ds->priv[b])
+                        continue;       /* Overlay's not worth it */
+                uintptr_t a = (uintptr_t)(ds->pool + pool_blk_offset(ds->index[b]));
+                uintptr_t e = (a + BS + pg - 1) & ~(pg - 1);
+                a &= ~(pg - 1);
+                madvise((void *)a, e - a, MADV_WILLNEED);
+        }
+}
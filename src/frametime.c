@@ -0,0 +1,188 @@
+/* umac frame timing
+ *
+ * Splits each frame's host time between the interpreter, disc
+ * requests, device ticks, the display path and everything else, into
+ * histograms: one set since the start, and a rolling pair of windows
+ * (the older is dropped as the newer fills) for a recent view.  A
+ * frame that overruns its period by half is counted as slow, against
+ * whichever phase took the most time, so that a run of dropped frames
+ * can be put down to the CPU, the disc or the display.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "umac.h"
+#include "report.h"
+#include "frametime.h"
+
+#ifdef DEBUG
+#define FTDBG(...)      printf(__VA_ARGS__)
+#else
+#define FTDBG(...)      do {} while(0)
+#endif
+
+int frametime_active = 0;
+
+static FILE *ft_file;
+
+static const char *ft_names[FT_NUM] = {
+        "CPU", "Disc", "Devices", "Convert", "Present", "Other", "Total",
+};
+
+static struct histo ft_all[FT_NUM];
+static struct histo ft_win[2][FT_NUM];
+static unsigned int ft_cur, ft_win_frames;
+
+static uint64_t ft_acc[FT_NUM];                 /* Frontend phases, this frame */
+static uint64_t ft_last_core[UMAC_TIME_NUM];
+static uint64_t ft_last_ns;
+static uint64_t ft_frames, ft_slow[FT_NUM];
+
+uint64_t        frametime_now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void    frametime_add(int phase, uint64_t ns)
+{
+        ft_acc[phase] += ns;
+}
+
+void    frametime_frame(uint64_t period_ns)
+{
+        uint64_t core[UMAC_TIME_NUM];
+        uint64_t t[FT_NUM];
+        uint64_t now;
+
+        if (!frametime_active)
+                return;
+        now = frametime_now_ns();
+        umac_get_host_times(core);
+        if (ft_last_ns) {
+                t[FT_CPU] = core[UMAC_TIME_CPU] - ft_last_core[UMAC_TIME_CPU];
+                t[FT_DISC] = core[UMAC_TIME_DISC] - ft_last_core[UMAC_TIME_DISC];
+                t[FT_DEVICES] = core[UMAC_TIME_DEVICES] - ft_last_core[UMAC_TIME_DEVICES];
+                t[FT_CONVERT] = ft_acc[FT_CONVERT];
+                t[FT_PRESENT] = ft_acc[FT_PRESENT];
+                t[FT_TOTAL] = now - ft_last_ns;
+
+                uint64_t known = 0;
+                int worst = 0;
+                for (int p = 0; p < FT_OTHER; p++) {
+                        known += t[p];
+                        if (t[p] > t[worst])
+                                worst = p;
+                }
+                /* (The core's slices don't quite line up with frames) */
+                t[FT_OTHER] = (t[FT_TOTAL] > known) ? t[FT_TOTAL] - known : 0;
+                if (t[FT_OTHER] > t[worst])
+                        worst = FT_OTHER;
+
+                for (int p = 0; p < FT_NUM; p++) {
+                        histo_add(&ft_all[p], t[p]);
+                        histo_add(&ft_win[ft_cur][p], t[p]);
+                }
+                ft_frames++;
+                if (t[FT_TOTAL] > period_ns + period_ns / 2) {
+                        ft_slow[worst]++;
+                        ft_slow[FT_TOTAL]++;
+                        FTDBG("Frame: slow, %.1fms (%s %.1fms)\n", t[FT_TOTAL] / 1e6,
+                              ft_names[worst], t[worst] / 1e6);
+                }
+                if (++ft_win_frames == FT_WINDOW_FRAMES) {
+                        ft_cur ^= 1;
+                        for (int p = 0; p < FT_NUM; p++)
+                                histo_reset(&ft_win[ft_cur][p]);
+                        ft_win_frames = 0;
+                }
+        }
+        memcpy(ft_last_core, core, sizeof(core));
+        memset(ft_acc, 0, sizeof(ft_acc));
+        ft_last_ns = now;
+}
+
+void    frametime_get(int phase, struct histo *h)
+{
+        histo_reset(h);
+        histo_merge(h, &ft_win[0][phase]);
+        histo_merge(h, &ft_win[1][phase]);
+}
+
+void    frametime_report(FILE *f)
+{
+        uint64_t total = ft_all[FT_TOTAL].sum;
+
+        fprintf(f, "Frame timing: %lld frames, %lld slow (over 1.5x the period)\n\n",
+                (long long)ft_frames, (long long)ft_slow[FT_TOTAL]);
+        for (int p = 0; p < FT_NUM; p++) {
+                char name[32];
+                snprintf(name, sizeof(name), "%s %.1f%%", ft_names[p],
+                         total ? 100.0 * ft_all[p].sum / total : 0.0);
+                histo_print(f, name, &ft_all[p], 1e6, "ms");
+        }
+        fprintf(f, "\nSlow frames by largest phase:");
+        for (int p = 0; p < FT_TOTAL; p++)
+                fprintf(f, " %s %lld", ft_names[p], (long long)ft_slow[p]);
+        fprintf(f, "\n\nFrame times:\n");
+        histo_print_bars(f, &ft_all[FT_TOTAL], 1e6, "ms");
+        fflush(f);
+}
+
+int     frametime_open(const char *spec)
+{
+        frametime_close();
+        ft_file = report_open(spec, "Frame timing");
+        if (!ft_file)
+                return -1;
+        for (int p = 0; p < FT_NUM; p++) {
+                histo_reset(&ft_all[p]);
+                histo_reset(&ft_win[0][p]);
+                histo_reset(&ft_win[1][p]);
+        }
+        ft_cur = 0;
+        ft_win_frames = 0;
+        ft_frames = 0;
+        ft_last_ns = 0;
+        memset(ft_slow, 0, sizeof(ft_slow));
+        memset(ft_acc, 0, sizeof(ft_acc));
+        umac_set_host_clock(frametime_now_ns);
+        frametime_active = 1;
+        return 0;
+}
+
+void    frametime_close(void)
+{
+        if (!ft_file)
+                return;
+        frametime_active = 0;
+        umac_set_host_clock(NULL);
+        frametime_report(ft_file);
+        report_close(ft_file);
+        ft_file = NULL;
+}
@@ -0,0 +1,145 @@
+/* umac histograms
+ *
+ * Shared by the latency and frame timing instrumentation.  The bucket
+ * layout (see histo.h) is like HDR histograms, with fewer buckets:
+ * it's cheap to index (a count of leading zeros), and keeps a constant
+ * relative error whatever the range of values.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "histo.h"
+
+#define HISTO_SUB       (1 << HISTO_SUB_BITS)
+#define HISTO_BAR_WIDTH 50
+
+static unsigned int     histo_index(uint64_t v)
+{
+        if (v < HISTO_SUB)
+                return v;
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= HISTO_MAX_BITS)
+                return HISTO_BUCKETS - 1;
+        return ((msb - HISTO_SUB_BITS + 1) << HISTO_SUB_BITS) +
+                ((v >> (msb - HISTO_SUB_BITS)) & (HISTO_SUB - 1));
+}
+
+/* The lowest value in bucket i, and the bucket's width: */
+static uint64_t histo_bucket_lo(unsigned int i, uint64_t *width)
+{
+        if (i < HISTO_SUB) {
+                *width = 1;
+                return i;
+        }
+        int shift = (i >> HISTO_SUB_BITS) - 1;
+        *width = 1ULL << shift;
+        return (uint64_t)(HISTO_SUB + (i & (HISTO_SUB - 1))) << shift;
+}
+
+void    histo_reset(struct histo *h)
+{
+        memset(h, 0, sizeof(*h));
+        h->min = UINT64_MAX;
+}
+
+void    histo_add(struct histo *h, uint64_t v)
+{
+        h->buckets[histo_index(v)]++;
+        h->count++;
+        h->sum += v;
+        if (v < h->min)
+                h->min = v;
+        if (v > h->max)
+                h->max = v;
+}
+
+void    histo_merge(struct histo *h, const struct histo *from)
+{
+        for (unsigned int i = 0; i < HISTO_BUCKETS; i++)
+                h->buckets[i] += from->buckets[i];
+        h->count += from->count;
+        h->sum += from->sum;
+        if (from->min < h->min)
+                h->min = from->min;
+        if (from->max > h->max)
+                h->max = from->max;
+}
+
+uint64_t        histo_percentile(const struct histo *h, double pc)
+{
+        uint64_t want = (uint64_t)(h->count * pc / 100.0);
+        uint64_t n = 0;
+
+        if (!h->count)
+                return 0;
+        for (unsigned int i = 0; i < HISTO_BUCKETS; i++) {
+                n += h->buckets[i];
+                if (n > want) {
+                        /* The bucket's midpoint, within the values seen: */
+                        uint64_t w, v = histo_bucket_lo(i, &w) + w / 2;
+                        if (v < h->min)
+                                v = h->min;
+                        if (v > h->max)
+                                v = h->max;
+                        return v;
+                }
+        }
+        return h->max;
+}
+
+void    histo_print(FILE *f, const char *name, const struct histo *h,
+                    double scale, const char *unit)
+{
+        if (!h->count) {
+                fprintf(f, "%-16s %8d\n", name, 0);
+                return;
+        }
+        fprintf(f, "%-16s %8lld  min %.2f  avg %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f %s\n",
+                name, (long long)h->count, h->min / scale, (double)h->sum / h->count / scale,
+                histo_percentile(h, 50) / scale, histo_percentile(h, 90) / scale,
+                histo_percentile(h, 99) / scale, h->max / scale, unit);
+}
+
+void    histo_print_bars(FILE *f, const struct histo *h, double scale, const char *unit)
+{
+        uint64_t most = 0;
+
+        for (unsigned int i = 0; i < HISTO_BUCKETS; i++)
+                if (h->buckets[i] > most)
+                        most = h->buckets[i];
+        for (unsigned int i = 0; i < HISTO_BUCKETS; i++) {
+                uint64_t w, lo;
+
+                if (!h->buckets[i])
+                        continue;
+                lo = histo_bucket_lo(i, &w);
+                fprintf(f, "  %10.2f-%-10.2f %-3s %8lld |", lo / scale, (lo + w) / scale, unit,
+                        (long long)h->buckets[i]);
+                for (unsigned int b = 0; b < h->buckets[i] * HISTO_BAR_WIDTH / most; b++)
+                        fputc('#', f);
+                fputc('\n', f);
+        }
+}
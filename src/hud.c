@@ -0,0 +1,106 @@
+/* umac frontend HUD text
+ *
+ * A minimal bitmap font renderer, for drawing performance figures over
+ * the emulated screen.  Glyphs are 3x5 pixels, one bit per pixel, rows
+ * top to bottom with the MSB leftmost.  Drawing a few lines costs a
+ * few thousand pixel writes, which is nothing next to copy_fb().
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "hud.h"
+
+#define G(a, b, c, d, e)        (((a) << 12) | ((b) << 9) | ((c) << 6) | ((d) << 3) | (e))
+
+/* ' ' to 'Z': */
+static const uint16_t hud_font[] = {
+        G(0,0,0,0,0), G(2,2,2,0,2), G(5,5,0,0,0), G(5,7,5,7,5),        /*  !"# */
+        G(3,6,2,3,6), G(5,1,2,4,5), G(2,5,2,5,3), G(2,2,0,0,0),        /* $%&' */
+        G(1,2,2,2,1), G(4,2,2,2,4), G(0,5,2,5,0), G(0,2,7,2,0),        /* ()*+ */
+        G(0,0,0,2,4), G(0,0,7,0,0), G(0,0,0,0,2), G(1,1,2,4,4),        /* ,-./ */
+        G(7,5,5,5,7), G(2,6,2,2,7), G(7,1,7,4,7), G(7,1,3,1,7),        /* 0123 */
+        G(5,5,7,1,1), G(7,4,7,1,7), G(7,4,7,5,7), G(7,1,1,2,2),        /* 4567 */
+        G(7,5,7,5,7), G(7,5,7,1,7), G(0,2,0,2,0), G(0,2,0,2,4),        /* 89:; */
+        G(1,2,4,2,1), G(0,7,0,7,0), G(4,2,1,2,4), G(7,1,3,0,2),        /* <=>? */
+        G(7,5,7,4,7), G(2,5,7,5,5), G(6,5,6,5,6), G(3,4,4,4,3),        /* @ABC */
+        G(6,5,5,5,6), G(7,4,6,4,7), G(7,4,6,4,4), G(3,4,5,5,3),        /* DEFG */
+        G(5,5,7,5,5), G(7,2,2,2,7), G(1,1,1,5,2), G(5,5,6,5,5),        /* HIJK */
+        G(4,4,4,4,7), G(5,7,7,5,5), G(6,5,5,5,5), G(2,5,5,5,2),        /* LMNO */
+        G(6,5,6,4,4), G(2,5,5,6,3), G(6,5,6,5,5), G(3,4,2,1,6),        /* PQRS */
+        G(7,2,2,2,2), G(5,5,5,5,7), G(5,5,5,5,2), G(5,5,7,7,5),        /* TUVW */
+        G(5,5,2,5,5), G(5,5,2,2,2), G(7,1,2,4,7),                      /* XYZ */
+};
+
+static uint16_t hud_glyph(char c)
+{
+        if (c >= 'a' && c <= 'z')
+                c -= 'a' - 'A';
+        if (c < ' ' || c > 'Z')
+                return G(7,5,5,5,7);    /* A box, for unknowns */
+        return hud_font[c - ' '];
+}
+
+void    hud_text(uint32_t *fb, unsigned int width, unsigned int height,
+                 unsigned int x, unsigned int y, const char *text,
+                 uint32_t fg, uint32_t bg)
+{
+        unsigned int cols = 0, rows = 1, n = 0;
+
+        for (const char *s = text; *s; s++) {
+                if (*s == '\n') {
+                        rows++;
+                        n = 0;
+                } else if (++n > cols) {
+                        cols = n;
+                }
+        }
+        /* The box, with a pixel's margin: */
+        unsigned int bw = cols * HUD_CHAR_W + 1, bh = rows * HUD_CHAR_H + 1;
+        if (x >= width || y >= height)
+                return;
+        if (bw > width - x)
+                bw = width - x;
+        if (bh > height - y)
+                bh = height - y;
+        for (unsigned int j = 0; j < bh; j++)
+                for (unsigned int i = 0; i < bw; i++)
+                        fb[(y + j) * width + x + i] = bg;
+
+        unsigned int cx = x + 1, cy = y + 1;
+        for (const char *s = text; *s; s++) {
+                if (*s == '\n') {
+                        cx = x + 1;
+                        cy += HUD_CHAR_H;
+                        continue;
+                }
+                uint16_t g = hud_glyph(*s);
+                for (int r = 0; r < 5; r++) {
+                        for (int b = 0; b < 3; b++) {
+                                unsigned int px = cx + b, py = cy + r;
+                                if ((g & (0x4000 >> (r * 3 + b))) && px < x + bw && py < y + bh)
+                                        fb[py * width + px] = fg;
+                        }
+                }
+                cx += HUD_CHAR_W;
+        }
+}
@@ -0,0 +1,345 @@
+/* umac text injection
+ *
+ * umac_type_text() converts a string into Mac key transitions (US
+ * layout), which are delivered at the keyboard protocol's maximum
+ * rate.  Alternatively, keyDown events are posted straight into the
+ * OS event queue in low memory, many per frame; this is quicker still
+ * but makes assumptions about the queue's layout, so is only used
+ * when the queue passes some sanity checks (otherwise, falling back
+ * to the keyboard).
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "umac.h"
+#include "machw.h"
+#include "m68k.h"
+#include "keymap.h"
+#include "kbdtext.h"
+
+#ifdef DEBUG
+#define KDBG(...)       printf(__VA_ARGS__)
+#else
+#define KDBG(...)       do {} while(0)
+#endif
+
+#define KERR(...)       fprintf(stderr, __VA_ARGS__)
+
+/* Keep the keyboard queue topped up to this many events: */
+#define KT_KBD_LOW      8
+
+/* Low-memory globals used by the event queue path: */
+#define SysEvtMask      0x144
+#define SysEvtBuf       0x146
+#define EventQueue      0x14a   /* QHdr: flags.w, head.l, tail.l */
+#define EvtBufCnt       0x154
+#define Ticks           0x16a
+#define MBState         0x172
+#define Mouse           0x830
+
+/* Event queue element (EvQEl), after qLink: */
+#define EVQ_TYPE        4
+#define EVQ_WHAT        6
+#define EVQ_MESSAGE     8
+#define EVQ_WHEN        12
+#define EVQ_WHERE       16
+#define EVQ_MODIFIERS   20
+#define EVQ_EL_SIZE     22
+
+#define evType          4
+#define keyDown         3
+#define shiftKey        0x0200
+#define btnState        0x0080
+
+/* ASCII to key, for a US layout.  Bit 7 means Shift. */
+#define S               0x80
+static const uint8_t kt_ascii_map[128] = {
+        ['\b'] = MKC_BackSpace, ['\t'] = MKC_Tab,
+        ['\n'] = MKC_Return, ['\r'] = MKC_Return,
+        [' '] = MKC_Space,
+        ['a'] = MKC_A, ['b'] = MKC_B, ['c'] = MKC_C, ['d'] = MKC_D,
+        ['e'] = MKC_E, ['f'] = MKC_F, ['g'] = MKC_G, ['h'] = MKC_H,
+        ['i'] = MKC_I, ['j'] = MKC_J, ['k'] = MKC_K, ['l'] = MKC_L,
+        ['m'] = MKC_M, ['n'] = MKC_N, ['o'] = MKC_O, ['p'] = MKC_P,
+        ['q'] = MKC_Q, ['r'] = MKC_R, ['s'] = MKC_S, ['t'] = MKC_T,
+        ['u'] = MKC_U, ['v'] = MKC_V, ['w'] = MKC_W, ['x'] = MKC_X,
+        ['y'] = MKC_Y, ['z'] = MKC_Z,
+        ['A'] = S|MKC_A, ['B'] = S|MKC_B, ['C'] = S|MKC_C, ['D'] = S|MKC_D,
+        ['E'] = S|MKC_E, ['F'] = S|MKC_F, ['G'] = S|MKC_G, ['H'] = S|MKC_H,
+        ['I'] = S|MKC_I, ['J'] = S|MKC_J, ['K'] = S|MKC_K, ['L'] = S|MKC_L,
+        ['M'] = S|MKC_M, ['N'] = S|MKC_N, ['O'] = S|MKC_O, ['P'] = S|MKC_P,
+        ['Q'] = S|MKC_Q, ['R'] = S|MKC_R, ['S'] = S|MKC_S, ['T'] = S|MKC_T,
+        ['U'] = S|MKC_U, ['V'] = S|MKC_V, ['W'] = S|MKC_W, ['X'] = S|MKC_X,
+        ['Y'] = S|MKC_Y, ['Z'] = S|MKC_Z,
+        ['0'] = MKC_0, ['1'] = MKC_1, ['2'] = MKC_2, ['3'] = MKC_3,
+        ['4'] = MKC_4, ['5'] = MKC_5, ['6'] = MKC_6, ['7'] = MKC_7,
+        ['8'] = MKC_8, ['9'] = MKC_9,
+        [')'] = S|MKC_0, ['!'] = S|MKC_1, ['@'] = S|MKC_2, ['#'] = S|MKC_3,
+        ['$'] = S|MKC_4, ['%'] = S|MKC_5, ['^'] = S|MKC_6, ['&'] = S|MKC_7,
+        ['*'] = S|MKC_8, ['('] = S|MKC_9,
+        ['-'] = MKC_Minus, ['_'] = S|MKC_Minus,
+        ['='] = MKC_Equal, ['+'] = S|MKC_Equal,
+        ['['] = MKC_LeftBracket, ['{'] = S|MKC_LeftBracket,
+        [']'] = MKC_RightBracket, ['}'] = S|MKC_RightBracket,
+        ['\\'] = MKC_BackSlash, ['|'] = S|MKC_BackSlash,
+        [';'] = MKC_SemiColon, [':'] = S|MKC_SemiColon,
+        ['\''] = MKC_SingleQuote, ['"'] = S|MKC_SingleQuote,
+        [','] = MKC_Comma, ['<'] = S|MKC_Comma,
+        ['.'] = MKC_Period, ['>'] = S|MKC_Period,
+        ['/'] = MKC_Slash, ['?'] = S|MKC_Slash,
+        ['`'] = MKC_Grave, ['~'] = S|MKC_Grave,
+};
+#undef S
+
+/* MKC_A is 0, so a zero entry means unmapped except for 'a': */
+#define KT_MAPPED(c)    ((c) < 128 && (kt_ascii_map[(c)] || (c) == 'a'))
+
+static char *kt_text = NULL;            /* Pending ASCII */
+static size_t kt_len = 0;
+static size_t kt_pos = 0;
+static int kt_direct = 0;
+static int kt_shift = 0;                /* Shift held (keyboard path) */
+
+/**********************************************************************/
+/* Keyboard path */
+
+static void     kt_key(uint8_t mkc, int down)
+{
+        umac_kbd_event((mkc << 1) | 1, down);
+}
+
+static void     kt_poll_kbd(void)
+{
+        unsigned int queued, drops, retries;
+
+        umac_kbd_get_stats(&queued, &drops, &retries);
+        /* A character's at most 4 transitions: */
+        while (kt_pos < kt_len && queued + 4 <= KT_KBD_LOW) {
+                uint8_t k = kt_ascii_map[(uint8_t)kt_text[kt_pos++]];
+                int shift = !!(k & 0x80);
+
+                if (shift != kt_shift) {
+                        kt_key(MKC_Shift, shift);
+                        kt_shift = shift;
+                        queued++;
+                }
+                kt_key(k & 0x7f, 1);
+                kt_key(k & 0x7f, 0);
+                queued += 2;
+        }
+        if (kt_pos == kt_len && kt_shift) {
+                kt_key(MKC_Shift, 0);
+                kt_shift = 0;
+        }
+}
+
+/**********************************************************************/
+/* Event queue path */
+
+static int      kt_addr_ok(uint32_t a)
+{
+        return !(a & 1) && a >= 0x100 && a < RAM_SIZE;
+}
+
+/* Check the queue's consistent with what we think it looks like, and
+ * find where its elements live.  The system allocates SysEvtBuf as a
+ * nonrelocatable block holding EvtBufCnt+1 elements, so the block
+ * size gives the stride; any bytes before each EvQEl are taken to
+ * start with an in-use flag word.  Returns 0 if OK.
+ */
+static int      kt_evq_layout(uint32_t *buf, unsigned int *num, unsigned int *stride)
+{
+        uint32_t b = RAM_RD32(SysEvtBuf) & 0xffffff;
+        unsigned int n = RAM_RD16(EvtBufCnt) + 1;
+
+        if (!kt_addr_ok(b) || b < 8 || n < 2 || n > 256)
+                return -1;
+        /* 64K ROM heap block header: tag/sizeCorrection, 24-bit size */
+        uint32_t hdr = RAM_RD32(b - 8);
+        unsigned int tag = hdr >> 24;
+        uint32_t size = (hdr & 0xffffff) - 8 - (tag & 0xf);
+        if ((tag >> 6) != 1 || size > 0x10000 || size % n)
+                return -1;
+        unsigned int s = size / n;
+        if (s < EVQ_EL_SIZE || s > 32)
+                return -1;
+        if (b + size > RAM_SIZE)
+                return -1;
+
+        *buf = b;
+        *num = n;
+        *stride = s;
+        return 0;
+}
+
+/* Is a (EvQEl pointer) one of the buffer's elements? */
+static int      kt_evq_slot(uint32_t a, uint32_t buf, unsigned int num, unsigned int stride)
+{
+        uint32_t off = stride - EVQ_EL_SIZE;
+        if (a < buf + off || a >= buf + num * stride)
+                return -1;
+        if ((a - buf - off) % stride)
+                return -1;
+        return (a - buf - off) / stride;
+}
+
+static int      kt_post_key(uint8_t c, uint8_t k)
+{
+        uint32_t buf;
+        unsigned int num, stride;
+        uint8_t used[256];
+
+        if (kt_evq_layout(&buf, &num, &stride))
+                return -1;
+
+        /* Walk the queue, checking it and noting occupied slots: */
+        uint32_t head = RAM_RD32(EventQueue + 2) & 0xffffff;
+        uint32_t tail = RAM_RD32(EventQueue + 6) & 0xffffff;
+        uint32_t last = 0;
+        memset(used, 0, num);
+        if (!head != !tail)
+                return -1;
+        for (uint32_t e = head; e; e = RAM_RD32(e) & 0xffffff) {
+                int i = kt_evq_slot(e, buf, num, stride);
+                if (i < 0 || used[i])
+                        return -1;
+                used[i] = 1;
+                last = e;
+        }
+        if (last != tail)
+                return -1;
+
+        /* A free slot has no in-use flag, as well as not being queued: */
+        uint32_t off = stride - EVQ_EL_SIZE;
+        int slot = -1;
+        for (unsigned int i = 0; i < num && slot < 0; i++)
+                if (!used[i] && (off < 2 || RAM_RD16(buf + i * stride) == 0))
+                        slot = i;
+        if (slot < 0)
+                return 1;       /* Full; try later */
+
+        uint32_t e = buf + slot * stride + off;
+        uint16_t mods = ((k & 0x80) ? shiftKey : 0) |
+                ((RAM_RD8(MBState) & 0x80) ? btnState : 0);
+
+        if (off >= 2)
+                RAM_WR16(buf + slot * stride, 0xffff);
+        RAM_WR32(e, 0);
+        RAM_WR16(e + EVQ_TYPE, evType);
+        RAM_WR16(e + EVQ_WHAT, keyDown);
+        RAM_WR32(e + EVQ_MESSAGE, ((k & 0x7f) << 8) | c);
+        RAM_WR32(e + EVQ_WHEN, RAM_RD32(Ticks));
+        RAM_WR32(e + EVQ_WHERE, RAM_RD32(Mouse));
+        RAM_WR16(e + EVQ_MODIFIERS, mods);
+        if (tail)
+                RAM_WR32(tail, e);
+        else
+                RAM_WR32(EventQueue + 2, e);
+        RAM_WR32(EventQueue + 6, e);
+        return 0;
+}
+
+static void     kt_poll_direct(void)
+{
+        /* Only touch the queue when no code could be part-way through
+         * changing it: the OS masks interrupts while doing so.
+         */
+        if ((m68k_get_reg(NULL, M68K_REG_SR) >> 8) & 7)
+                return;
+        if (!(RAM_RD16(SysEvtMask) & (1 << keyDown)))
+                return;
+
+        while (kt_pos < kt_len) {
+                uint8_t c = kt_text[kt_pos];
+                uint8_t k = kt_ascii_map[c];
+                char mc = (c == '\n') ? '\r' : c;
+                int r = kt_post_key(mc, k);
+
+                if (r > 0)
+                        return;
+                if (r < 0) {
+                        KERR("Event queue doesn't look right; typing instead\n");
+                        kt_direct = 0;
+                        return;
+                }
+                kt_pos++;
+        }
+}
+
+/**********************************************************************/
+
+void    kbdtext_poll(void)
+{
+        if (kt_pos == kt_len && !kt_shift)
+                return;
+        if (kt_direct)
+                kt_poll_direct();
+        else
+                kt_poll_kbd();
+        if (kt_pos == kt_len && !kt_shift) {
+                free(kt_text);
+                kt_text = NULL;
+                kt_len = kt_pos = 0;
+        }
+}
+
+/* Queue UTF-8 text to be typed.  Characters without a key on a US
+ * keyboard are skipped.  If direct, events go straight into the event
+ * queue (keyDowns only, as apps see from the keyboard by default).
+ * Returns the number of characters queued, or -1 on error.
+ */
+int     umac_type_text(const char *text, int direct)
+{
+        size_t n = strlen(text);
+        char *t;
+        int queued = 0;
+
+        if (!n)
+                return 0;
+        t = realloc(kt_text, kt_len + n);
+        if (!t)
+                return -1;
+        kt_text = t;
+        for (const uint8_t *p = (const uint8_t *)text; *p; p++) {
+                if (*p >= 0x80) {
+                        /* Skip the rest of a multibyte sequence */
+                        while ((p[1] & 0xc0) == 0x80)
+                                p++;
+                        continue;
+                }
+                if (KT_MAPPED(*p)) {
+                        kt_text[kt_len++] = *p;
+                        queued++;
+                }
+        }
+        /* If earlier text is still going, this follows it the same way */
+        if (kt_pos == kt_len - queued)
+                kt_direct = direct;
+        KDBG("KBD: Typing %d chars (%s)\n", queued, kt_direct ? "direct" : "keyboard");
+        kbdtext_poll();
+        return queued;
+}
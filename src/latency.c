@@ -0,0 +1,226 @@
+/* umac input-to-photon latency
+ *
+ * Each timed input goes through four points:
+ *  - arrival, as the frontend gets the host event;
+ *  - consumed, as the Mac takes it (see umac_set_input_consumed());
+ *  - changed, at the first frame after that whose contents differ
+ *    from the last;
+ *  - presented, once that frame's on the host display.
+ * Keys and mouse buttons are queued (by the core and frontend) and
+ * taken in order, so their arrival times are kept in a FIFO; mouse
+ * movement is coalesced, so only its earliest arrival is kept.  A type
+ * has one input in flight after it's consumed; if another's consumed,
+ * or a second passes, before the screen changes, the first is counted
+ * as having no visible effect.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "umac.h"
+#include "histo.h"
+#include "report.h"
+#include "latency.h"
+
+#ifdef DEBUG
+#define LATDBG(...)     printf(__VA_ARGS__)
+#else
+#define LATDBG(...)     do {} while(0)
+#endif
+
+#define LAT_QUEUE       64              /* Power of 2 */
+#define LAT_TIMEOUT_US  1000000
+
+int latency_active = 0;
+
+static FILE *lat_file;
+
+static struct lat_type {
+        uint64_t queue[LAT_QUEUE];      /* Arrival times, 0 if not timed */
+        unsigned int rd, wr;
+        /* The input in flight: */
+        uint64_t in_us, consumed_us, changed_us;
+        struct histo total, queued, react, present;
+        uint64_t invisible, lost;
+} lat_types[UMAC_INPUT_NUM];
+
+static const char *lat_names[UMAC_INPUT_NUM] = {
+        "Key", "Mouse move", "Mouse button",
+};
+
+static uint8_t *lat_last_fb;
+static unsigned int lat_last_fb_len;
+
+static uint64_t lat_now_us(void)
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void    latency_input(int type, int measure)
+{
+        struct lat_type *t = &lat_types[type];
+
+        if (!latency_active)
+                return;
+        /* Movement's coalesced until the Mac takes it: */
+        if (type == UMAC_INPUT_MOUSE_MOVE && t->rd != t->wr)
+                return;
+        if (t->wr - t->rd == LAT_QUEUE) {
+                t->lost++;
+                t->rd++;
+        }
+        t->queue[t->wr++ % LAT_QUEUE] = measure ? lat_now_us() : 0;
+}
+
+void    latency_consumed(int type)
+{
+        struct lat_type *t = &lat_types[type];
+        uint64_t in_us;
+
+        if (!latency_active || t->rd == t->wr)
+                return;
+        in_us = t->queue[t->rd++ % LAT_QUEUE];
+        if (!in_us)
+                return;
+        if (t->in_us && !t->changed_us)
+                t->invisible++;
+        t->in_us = in_us;
+        t->consumed_us = lat_now_us();
+        t->changed_us = 0;
+}
+
+void    latency_frame(const uint8_t *fb, unsigned int len)
+{
+        uint64_t now;
+        int changed;
+
+        if (!latency_active)
+                return;
+        if (len != lat_last_fb_len) {
+                free(lat_last_fb);
+                lat_last_fb = calloc(1, len);
+                lat_last_fb_len = lat_last_fb ? len : 0;
+        }
+        changed = lat_last_fb && memcmp(lat_last_fb, fb, len);
+        if (changed)
+                memcpy(lat_last_fb, fb, len);
+
+        now = lat_now_us();
+        for (int i = 0; i < UMAC_INPUT_NUM; i++) {
+                struct lat_type *t = &lat_types[i];
+
+                if (t->in_us && !t->changed_us) {
+                        if (changed) {
+                                t->changed_us = now;
+                        } else if (now - t->consumed_us > LAT_TIMEOUT_US) {
+                                t->invisible++;
+                                t->in_us = 0;
+                        }
+                }
+                /* Mouse inputs aren't taken whilst the Mac isn't
+                 * listening (e.g. early in boot), so don't wait forever:
+                 */
+                if (i != UMAC_INPUT_KEY && t->rd != t->wr &&
+                    t->queue[t->rd % LAT_QUEUE] &&
+                    now - t->queue[t->rd % LAT_QUEUE] > LAT_TIMEOUT_US) {
+                        t->lost++;
+                        t->rd++;
+                }
+        }
+}
+
+void    latency_presented(void)
+{
+        uint64_t now;
+
+        if (!latency_active)
+                return;
+        now = lat_now_us();
+        for (int i = 0; i < UMAC_INPUT_NUM; i++) {
+                struct lat_type *t = &lat_types[i];
+
+                if (!t->changed_us)
+                        continue;
+                histo_add(&t->total, now - t->in_us);
+                histo_add(&t->queued, t->consumed_us - t->in_us);
+                histo_add(&t->react, t->changed_us - t->consumed_us);
+                histo_add(&t->present, now - t->changed_us);
+                LATDBG("Latency: %s %dus\n", lat_names[i], (int)(now - t->in_us));
+                t->in_us = 0;
+                t->changed_us = 0;
+        }
+}
+
+void    latency_report(FILE *f)
+{
+        fprintf(f, "Input latency, host event to present:\n");
+        for (int i = 0; i < UMAC_INPUT_NUM; i++) {
+                struct lat_type *t = &lat_types[i];
+
+                fprintf(f, "\n");
+                histo_print(f, lat_names[i], &t->total, 1000.0, "ms");
+                histo_print(f, "  Taken by Mac", &t->queued, 1000.0, "ms");
+                histo_print(f, "  Screen change", &t->react, 1000.0, "ms");
+                histo_print(f, "  Presented", &t->present, 1000.0, "ms");
+                fprintf(f, "  No visible change %lld, lost %lld\n",
+                        (long long)t->invisible, (long long)t->lost);
+                histo_print_bars(f, &t->total, 1000.0, "ms");
+        }
+        fflush(f);
+}
+
+int     latency_open(const char *spec)
+{
+        latency_close();
+        lat_file = report_open(spec, "Latency");
+        if (!lat_file)
+                return -1;
+        memset(lat_types, 0, sizeof(lat_types));
+        for (int i = 0; i < UMAC_INPUT_NUM; i++) {
+                histo_reset(&lat_types[i].total);
+                histo_reset(&lat_types[i].queued);
+                histo_reset(&lat_types[i].react);
+                histo_reset(&lat_types[i].present);
+        }
+        latency_active = 1;
+        return 0;
+}
+
+void    latency_close(void)
+{
+        if (!lat_file)
+                return;
+        latency_active = 0;
+        latency_report(lat_file);
+        report_close(lat_file);
+        lat_file = NULL;
+        free(lat_last_fb);
+        lat_last_fb = NULL;
+        lat_last_fb_len = 0;
+}
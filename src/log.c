@@ -0,0 +1,273 @@
+/* umac logging
+ *
+ * Records are claimed from the ring with a compare-and-swap on its
+ * head, so any thread may log; each is published by writing its ticket
+ * to the record's seq, which the reader waits for.  A full ring drops
+ * new records (and counts them) rather than blocking the emulator.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "log.h"
+
+#ifdef PICO
+#define LOG_RING_RECS   64              /* Power of 2 */
+#else
+#define LOG_RING_RECS   4096
+#endif
+
+/* Argument types, from the conversion specs: */
+enum {
+        LA_INT,
+        LA_LONG,
+        LA_LLONG,
+        LA_SIZE,
+        LA_DOUBLE,
+        LA_PTR,
+};
+
+union log_arg {
+        long long i;
+        double d;
+        const void *p;
+};
+
+struct log_rec {
+        atomic_uint seq;                /* Ticket + 1, once written */
+        const struct log_site *site;
+        union log_arg args[LOG_MAX_ARGS];
+};
+
+uint8_t log_levels[LOG_NUM_CATS] = {
+        [LOG_MAIN] = LOG_WARN,
+        [LOG_MEM] = LOG_WARN,
+        [LOG_VIA] = LOG_WARN,
+        [LOG_SCC] = LOG_WARN,
+        [LOG_DISC] = LOG_WARN,
+        [LOG_KBD] = LOG_WARN,
+};
+
+static const char *cat_names[LOG_NUM_CATS] = {
+        "main", "mem", "via", "scc", "disc", "kbd",
+};
+
+static const char *level_names[] = {
+        "off", "error", "warn", "info", "debug",
+};
+
+static struct log_rec log_ring[LOG_RING_RECS];
+static atomic_uint log_head;
+static atomic_uint log_tail;
+static atomic_uint log_drops;
+
+/* Skip the conversion spec at *fmt (just past its '%'), returning the
+ * type of argument it takes, or -1 for none (i.e. "%%"):
+ */
+static int      log_parse_spec(const char **fmt)
+{
+        const char *p = *fmt;
+        int len = 0, type = -1;
+
+        while (*p && strchr("-+ #0123456789.", *p))
+                p++;
+        while (*p && strchr("hlzjtL", *p)) {
+                if (*p == 'l')
+                        len++;
+                else if (*p == 'z' || *p == 'j' || *p == 't')
+                        len = 3;
+                p++;
+        }
+        switch (*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+                type = (len == 3) ? LA_SIZE : (len == 2) ? LA_LLONG : len ? LA_LONG : LA_INT;
+                break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                type = LA_DOUBLE;
+                break;
+        case 's': case 'p':
+                type = LA_PTR;
+                break;
+        }
+        if (*p)
+                p++;
+        *fmt = p;
+        return type;
+}
+
+static void     log_parse(struct log_site *site, const char *fmt)
+{
+        unsigned int n = 0;
+
+        for (const char *p = fmt; *p; ) {
+                if (*p++ != '%')
+                        continue;
+                int t = log_parse_spec(&p);
+                if (t >= 0 && n < LOG_MAX_ARGS)
+                        site->types[n++] = t;
+        }
+        site->nargs = n;
+        site->fmt = fmt;
+}
+
+void    log_write(struct log_site *site, const char *fmt, ...)
+{
+        unsigned int head, tail;
+        struct log_rec *r;
+        va_list ap;
+
+        if (!site->fmt)
+                log_parse(site, fmt);
+
+        head = atomic_load_explicit(&log_head, memory_order_relaxed);
+        do {
+                tail = atomic_load_explicit(&log_tail, memory_order_acquire);
+                if (head - tail >= LOG_RING_RECS) {
+                        atomic_fetch_add_explicit(&log_drops, 1, memory_order_relaxed);
+                        return;
+                }
+        } while (!atomic_compare_exchange_weak_explicit(&log_head, &head, head + 1,
+                                                        memory_order_relaxed,
+                                                        memory_order_relaxed));
+
+        r = &log_ring[head % LOG_RING_RECS];
+        r->site = site;
+        va_start(ap, fmt);
+        for (unsigned int i = 0; i < site->nargs; i++) {
+                switch (site->types[i]) {
+                case LA_INT:    r->args[i].i = va_arg(ap, int); break;
+                case LA_LONG:   r->args[i].i = va_arg(ap, long); break;
+                case LA_LLONG:  r->args[i].i = va_arg(ap, long long); break;
+                case LA_SIZE:   r->args[i].i = va_arg(ap, size_t); break;
+                case LA_DOUBLE: r->args[i].d = va_arg(ap, double); break;
+                case LA_PTR:    r->args[i].p = va_arg(ap, const void *); break;
+                }
+        }
+        va_end(ap);
+        atomic_store_explicit(&r->seq, head + 1, memory_order_release);
+}
+
+/* printf() one record, a conversion spec at a time: */
+static void     log_format(FILE *f, const struct log_rec *r)
+{
+        const struct log_site *site = r->site;
+        const char *p = site->fmt;
+        unsigned int a = 0;
+        char spec[32];
+
+        while (*p) {
+                const char *pct = strchr(p, '%');
+                if (!pct) {
+                        fputs(p, f);
+                        return;
+                }
+                fwrite(p, 1, pct - p, f);
+                p = pct + 1;
+                int t = log_parse_spec(&p);
+                size_t len = p - pct;
+                if (t < 0) {
+                        fputc('%', f);
+                        continue;
+                }
+                if (len >= sizeof(spec) || a >= site->nargs)
+                        return;
+                memcpy(spec, pct, len);
+                spec[len] = '\0';
+
+                const union log_arg *v = &r->args[a++];
+                switch (t) {
+                case LA_INT:    fprintf(f, spec, (int)v->i); break;
+                case LA_LONG:   fprintf(f, spec, (long)v->i); break;
+                case LA_LLONG:  fprintf(f, spec, v->i); break;
+                case LA_SIZE:   fprintf(f, spec, (size_t)v->i); break;
+                case LA_DOUBLE: fprintf(f, spec, v->d); break;
+                case LA_PTR:    fprintf(f, spec, v->p); break;
+                }
+        }
+}
+
+void    log_flush(FILE *f)
+{
+        unsigned int tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        unsigned int drops;
+
+        for (;;) {
+                struct log_rec *r = &log_ring[tail % LOG_RING_RECS];
+                if (atomic_load_explicit(&r->seq, memory_order_acquire) != tail + 1)
+                        break;
+                log_format(f, r);
+                tail++;
+                atomic_store_explicit(&log_tail, tail, memory_order_release);
+        }
+        drops = atomic_exchange_explicit(&log_drops, 0, memory_order_relaxed);
+        if (drops)
+                fprintf(f, "[Log: %d records dropped]\n", drops);
+}
+
+int     log_set_levels(const char *spec)
+{
+        char *s = strdup(spec);
+        char *opt, *next;
+        int r = 0;
+
+        if (!s)
+                return -1;
+        for (opt = s; opt && *opt; opt = next) {
+                char *eq;
+                int cat, lvl;
+
+                next = strchr(opt, ',');
+                if (next)
+                        *next++ = '\0';
+                eq = strchr(opt, '=');
+                if (!eq) {
+                        r = -1;
+                        break;
+                }
+                *eq++ = '\0';
+                for (lvl = 0; lvl <= LOG_DEBUG; lvl++)
+                        if (!strcmp(eq, level_names[lvl]))
+                                break;
+                for (cat = 0; cat < LOG_NUM_CATS; cat++)
+                        if (!strcmp(opt, cat_names[cat]))
+                                break;
+                if (lvl > LOG_DEBUG || (cat == LOG_NUM_CATS && strcmp(opt, "all"))) {
+                        r = -1;
+                        break;
+                }
+                if (cat == LOG_NUM_CATS)
+                        memset(log_levels, lvl, sizeof(log_levels));
+                else
+                        log_levels[cat] = lvl;
+        }
+        if (r)
+                fprintf(stderr, "Log: bad level spec '%s'\n", spec);
+        free(s);
+        return r;
+}
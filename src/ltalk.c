@@ -0,0 +1,231 @@
+/* umac LocalTalk bridge
+ *
+ * Passes LLAP frames between an SCC channel in SDLC mode and a hub
+ * (tools/lthub.c) over a UNIX datagram socket, one frame per
+ * datagram.  The hub hands each frame on to every other instance.
+ *
+ * LLAP's handshakes expect a reply within the 200us inter-dialog gap,
+ * which a trip through the host can't manage, so some are answered
+ * here instead:
+ *  - A directed lapRTS gets a local lapCTS (and isn't forwarded), if
+ *    the destination's been heard from on the hub.
+ *  - A lapENQ for an address heard from on the hub gets a local
+ *    lapACK, so address acquisition avoids nodes that already exist.
+ * Received frames are read (in batches, where recvmmsg() is
+ * available) straight into the SCC's frame buffers.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ltalk.h"
+#include "scc.h"
+
+#ifdef DEBUG
+#define LDBG(...)       printf(__VA_ARGS__)
+#else
+#define LDBG(...)       do {} while(0)
+#endif
+
+#define LERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#ifdef __linux__
+#define LT_BATCH        8
+#endif
+
+/* LLAP header and control frame types: */
+#define LLAP_DST        0
+#define LLAP_SRC        1
+#define LLAP_TYPE       2
+#define LLAP_HDR_LEN    3
+#define LLAP_BROADCAST  0xff
+#define LLAP_ENQ        0x81
+#define LLAP_ACK        0x82
+#define LLAP_RTS        0x84
+#define LLAP_CTS        0x85
+
+struct ltalk {
+        int AnB;
+        int fd;
+        struct sockaddr_un local;
+        uint8_t nodes[256 / 8];         /* Heard from on the hub */
+        unsigned int tx_frames, rx_frames, drops;
+};
+
+static int      lt_node_known(ltalk_t *lt, uint8_t node)
+{
+        return lt->nodes[node / 8] & (1 << (node & 7));
+}
+
+/* Queue a control frame to the Mac, as though from the wire: */
+static void     lt_reply(ltalk_t *lt, uint8_t dst, uint8_t src, uint8_t type)
+{
+        if (!scc_rx_frame_space(lt->AnB)) {
+                lt->drops++;
+                return;
+        }
+        uint8_t *f = scc_rx_frame_slot(lt->AnB, 0);
+        f[LLAP_DST] = dst;
+        f[LLAP_SRC] = src;
+        f[LLAP_TYPE] = type;
+        scc_rx_frame_commit(lt->AnB, LLAP_HDR_LEN);
+}
+
+ltalk_t         *ltalk_open(int AnB, const char *hub_path)
+{
+        ltalk_t *lt = calloc(1, sizeof(*lt));
+        struct sockaddr_un hub;
+
+        if (!lt)
+                return NULL;
+        lt->AnB = AnB;
+        lt->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (lt->fd < 0) {
+                perror("LocalTalk socket");
+                free(lt);
+                return NULL;
+        }
+        /* Bind, so the hub can send to us: */
+        lt->local.sun_family = AF_UNIX;
+        snprintf(lt->local.sun_path, sizeof(lt->local.sun_path),
+                 "/tmp/umac-lt-%d-%c.sock", (int)getpid(), 'b' - AnB);
+        unlink(lt->local.sun_path);
+        if (bind(lt->fd, (struct sockaddr *)&lt->local, sizeof(lt->local))) {
+                perror("LocalTalk bind");
+                goto fail;
+        }
+        memset(&hub, 0, sizeof(hub));
+        hub.sun_family = AF_UNIX;
+        strncpy(hub.sun_path, hub_path, sizeof(hub.sun_path) - 1);
+        if (connect(lt->fd, (struct sockaddr *)&hub, sizeof(hub))) {
+                LERR("LocalTalk: can't reach hub at %s: %s\n", hub_path, strerror(errno));
+                goto fail;
+        }
+        /* An empty datagram says hello: */
+        if (send(lt->fd, "", 0, 0) < 0) {
+                perror("LocalTalk hello");
+                goto fail;
+        }
+        printf("LocalTalk: connected to hub %s\n", hub_path);
+        return lt;
+
+fail:
+        ltalk_close(lt);
+        return NULL;
+}
+
+void    ltalk_close(ltalk_t *lt)
+{
+        if (!lt)
+                return;
+        LDBG("LocalTalk: %d frames out, %d in, %d dropped\n",
+             lt->tx_frames, lt->rx_frames, lt->drops);
+        close(lt->fd);
+        unlink(lt->local.sun_path);
+        free(lt);
+}
+
+void    ltalk_tx_frame(ltalk_t *lt, const uint8_t *data, unsigned int len)
+{
+        if (len < LLAP_HDR_LEN)
+                return;
+
+        switch (data[LLAP_TYPE]) {
+        case LLAP_RTS:
+                if (data[LLAP_DST] == LLAP_BROADCAST)
+                        break;
+                if (lt_node_known(lt, data[LLAP_DST]))
+                        lt_reply(lt, data[LLAP_SRC], data[LLAP_DST], LLAP_CTS);
+                return;
+        case LLAP_ENQ:
+                if (lt_node_known(lt, data[LLAP_DST]))
+                        lt_reply(lt, data[LLAP_DST], data[LLAP_DST], LLAP_ACK);
+                break;
+        }
+
+        if (send(lt->fd, data, len, MSG_DONTWAIT) < 0) {
+                LDBG("LocalTalk: send: %s\n", strerror(errno));
+                lt->drops++;
+                return;
+        }
+        lt->tx_frames++;
+}
+
+/* A frame of len bytes has arrived in buf; it's committed from the
+ * SCC's next slot, which is buf unless an earlier runt was skipped.
+ */
+static void     lt_rx(ltalk_t *lt, const uint8_t *buf, unsigned int len)
+{
+        uint8_t *f = scc_rx_frame_slot(lt->AnB, 0);
+
+        if (len < LLAP_HDR_LEN || len > SCC_FRAME_MAX)
+                return;
+        if (f != buf)
+                memmove(f, buf, len);
+        /* An ENQ's source is only a candidate address: */
+        if (f[LLAP_TYPE] != LLAP_ENQ && f[LLAP_SRC] != LLAP_BROADCAST)
+                lt->nodes[f[LLAP_SRC] / 8] |= 1 << (f[LLAP_SRC] & 7);
+        lt->rx_frames++;
+        scc_rx_frame_commit(lt->AnB, len);
+}
+
+void    ltalk_poll(ltalk_t *lt)
+{
+        unsigned int space = scc_rx_frame_space(lt->AnB);
+
+        if (!space)
+                return;
+#ifdef LT_BATCH
+        struct mmsghdr msgs[LT_BATCH];
+        struct iovec iov[LT_BATCH];
+
+        if (space > LT_BATCH)
+                space = LT_BATCH;
+        memset(msgs, 0, sizeof(msgs));
+        for (unsigned int i = 0; i < space; i++) {
+                iov[i].iov_base = scc_rx_frame_slot(lt->AnB, i);
+                iov[i].iov_len = SCC_FRAME_MAX;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(lt->fd, msgs, space, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; i++)
+                lt_rx(lt, iov[i].iov_base, msgs[i].msg_len);
+#else
+        while (space--) {
+                uint8_t *f = scc_rx_frame_slot(lt->AnB, 0);
+                ssize_t r = recv(lt->fd, f, SCC_FRAME_MAX, MSG_DONTWAIT);
+                if (r < 0)
+                        break;
+                lt_rx(lt, f, r);
+        }
+#endif
+}
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <errno.h>
 #include <setjmp.h>
 
@@ -47,6 +48,30 @@
 #include "scc.h"
 #include "rom.h"
 #include "disc.h"
+#include "kbdtext.h"
+#include "metrics.h"
+#include "memheat.h"
+#include "log.h"
+
+/* The trace/profiling hooks are only built in where the CPU can call
+ * the instruction hook, so other builds (e.g. PICO) don't link them:
+ */
+#ifdef ENABLE_DASM
+#include "trace.h"
+#include "prof.h"
+#include "trapprof.h"
+#define CPU_INSTR_HOOK_WANTED() (disassemble || trace_active ||        \
+                                 trace_check_active || prof_active ||   \
+                                 trapprof_active)
+#define CPU_WRITE_HOOK(a, s, v) do {                                    \
+                if (__builtin_expect(trace_write_hook, 0) &&            \
+                    trace_write((a), (s), (v)))                         \
+                        exit_error("Lockstep check failed");            \
+        } while (0)
+#else
+#define CPU_INSTR_HOOK_WANTED() 0
+#define CPU_WRITE_HOOK(a, s, v) do {} while (0)
+#endif
 
 #ifdef PICO
 #include "pico.h"
@@ -56,11 +81,7 @@
 #endif
 
 
-#ifdef DEBUG
-#define MDBG(...)       printf(__VA_ARGS__)
-#else
-#define MDBG(...)       do {} while(0)
-#endif
+#define MDBG(...)       LOG(LOG_MAIN, LOG_DEBUG, __VA_ARGS__)
 
 #define MERR(...)       fprintf(stderr, __VA_ARGS__)
 
@@ -80,9 +101,17 @@ static int sim_done = 0;
 static jmp_buf main_loop_jb;
 
 static int disassemble = 0;
+int cpu_instr_hook = 0;
+unsigned int cpu_mmio_accesses = 0;
+#if ENABLE_METRICS
+struct umac_metrics umac_metrics;
+#endif
 
 #define UMAC_EXECLOOP_QUANTUM   5000
 
+static uint64_t (*umac_host_clock)(void) = NULL;
+static uint64_t umac_host_times[UMAC_TIME_NUM];
+
 static void    update_overlay_layout(void);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -127,6 +156,9 @@ void exit_error(char* fmt, ...)
 	else
 		guard_val = 1;
 
+        /* What led up to it: */
+        log_flush(stdout);
+
 	va_start(args, fmt);
 	vfprintf(stderr, fmt, args);
 	va_end(args);
@@ -144,6 +176,20 @@ void exit_error(char* fmt, ...)
 
 ////////////////////////////////////////////////////////////////////////////////
 // VIA-related controls
+
+/* The screen and sound buffer selects take effect at the next vsync,
+ * i.e. at the start of the next frame scanned out, so a frame's never
+ * torn.  (The sound buffer is read out during the frame, one word per
+ * line, so a whole frame's samples come from one buffer.)
+ */
+static int      vid_page2 = 1;          // As last written, 1 = main buffer
+unsigned int    umac_fb_offset = UMAC_FB_MAIN_OFFSET;
+static void     (*umac_fb_change)(unsigned int offset) = NULL;
+#if ENABLE_AUDIO
+static int      snd_page2 = 1;
+unsigned int    umac_snd_offset = UMAC_SND_MAIN_OFFSET;
+#endif
+
 static void     via_ra_changed(uint8_t val)
 {
         static uint8_t oldval = 0x10;
@@ -158,14 +204,42 @@ static void     via_ra_changed(uint8_t val)
                 MDBG("OVERLAY CHANGING\n");
                 update_overlay_layout();
         }
+        vid_page2 = !!(val & 0x40);
 #if ENABLE_AUDIO
+        snd_page2 = !!(val & 0x08);
         uint8_t vol = val & 7;
         if (vol != umac_volume) {
             umac_volume = val & 7;
             umac_audio_cfg(umac_volume, umac_sndres);
         }
+#endif
         oldval = val;
+}
+
+void    umac_set_fb_change(void (*fb_change)(unsigned int offset))
+{
+        umac_fb_change = fb_change;
+}
+
+void    umac_vsync_event(void)
+{
+        unsigned int fb = vid_page2 ? UMAC_FB_MAIN_OFFSET : UMAC_FB_ALT_OFFSET;
+
+        if (fb != umac_fb_offset) {
+                MDBG("[Screen buffer %s]\n", vid_page2 ? "main" : "alternate");
+                umac_fb_offset = fb;
+                if (umac_fb_change)
+                        umac_fb_change(fb);
+        }
+#if ENABLE_AUDIO
+        /* The frame that's ended played from the buffer latched at its
+         * start, which the Mac filled in its VBL task back then:
+         */
+        umac_audio_frame();
+        umac_snd_offset = snd_page2 ? UMAC_SND_MAIN_OFFSET : UMAC_SND_ALT_OFFSET;
 #endif
+        METRIC_INC(vsyncs);
+        via_caX_event(2);
 }
 
 static void     via_rb_changed(uint8_t val)
@@ -194,9 +268,24 @@ static uint8_t  via_ra_in(void)
 static uint8_t via_quadbits = 0;
 static uint8_t via_mouse_pressed = 0;
 
+/* Inputs given to the Mac but not yet seen by it, for latency: */
+static void     (*umac_input_consumed)(int type) = NULL;
+static int      input_button_pending = 0;
+static int      input_move_pending = 0;
+
+void    umac_set_input_consumed(void (*consumed)(int type))
+{
+        umac_input_consumed = consumed;
+}
+
 static uint8_t  via_rb_in(void)
 {
         uint8_t v = via_quadbits;
+        if (input_button_pending) {
+                input_button_pending = 0;
+                if (umac_input_consumed)
+                        umac_input_consumed(UMAC_INPUT_MOUSE_BUTTON);
+        }
         // Mouse not pressed!
         if (!via_mouse_pressed)
                 v |= (1 << 3);
@@ -228,9 +317,29 @@ static uint8_t  via_rb_in(void)
 #define KBD_MODEL               5
 #define KBD_RSP_NULL            0x7b
 
+/* Key transitions from the host are queued, and handed over one per
+ * Inquiry.  A real keyboard holds an Inquiry for up to 1/4s waiting
+ * for a transition, replying Null if none comes: do the same, so a
+ * key's delivered as soon as it arrives (rather than on the next
+ * poll) and an idle Mac isn't continuously polling.
+ *
+ * A reply goes no sooner than UMAC_KBD_REPLY_US after the command, and
+ * is only accepted once the ISR has switched the SR over to receive;
+ * if it's refused, it's retried (rather than lost) a little later.
+ */
+#define KBD_FIFO_SIZE           32      /* Power of 2 */
+#define KBD_INQUIRY_HOLD_US     250000
+#define UMAC_KBD_REPLY_US       500
+
 static int kbd_last_cmd = 0;
 static uint64_t kbd_last_cmd_time = 0;
 
+static uint8_t kbd_fifo[KBD_FIFO_SIZE];
+static unsigned int kbd_fifo_rd = 0;
+static unsigned int kbd_fifo_wr = 0;
+static unsigned int kbd_drops = 0;
+static unsigned int kbd_retries = 0;
+
 static void     via_sr_tx(uint8_t data)
 {
         if (kbd_last_cmd) {
@@ -241,31 +350,41 @@ static void     via_sr_tx(uint8_t data)
         kbd_last_cmd_time = global_time_us;
 }
 
-static int kbd_pending_evt = -1;
 /* Emulate the keyboard: receive commands (such as an inquiry, polling
- * for keypresses) and respond using via_sr_rx().
+ * for keypresses) and respond using via_sr_rx().  Returns non-zero if
+ * the response wasn't taken, and should be retried.
  */
-static void     kbd_rx(uint8_t data)
+static int      kbd_rx(uint8_t data)
 {
         /* Respond to requests with potted keyboard banter */
         switch (data) {
         case KBD_CMD_GET_MODEL:
-                via_sr_rx(0x01 | (KBD_MODEL << 1));
-                break;
+                return via_sr_rx(0x01 | (KBD_MODEL << 1));
+
         case KBD_CMD_INQUIRY:
-                if (kbd_pending_evt == -1) {
-                        via_sr_rx(KBD_RSP_NULL);
-                } else {
-                        via_sr_rx(kbd_pending_evt);
-                        kbd_pending_evt = -1;
-                }
-        break;
+                if (kbd_fifo_rd == kbd_fifo_wr)
+                        return via_sr_rx(KBD_RSP_NULL);
+                if (via_sr_rx(kbd_fifo[kbd_fifo_rd % KBD_FIFO_SIZE]))
+                        return -1;
+                kbd_fifo_rd++;
+                if (umac_input_consumed)
+                        umac_input_consumed(UMAC_INPUT_KEY);
+                return 0;
 
         default:
                 MERR("KBD: Unhandled TX %02x\n", data);
+                return 0;
         }
 }
 
+/* When the pending command should be answered: */
+static uint64_t kbd_reply_due(void)
+{
+        if (kbd_last_cmd == KBD_CMD_INQUIRY && kbd_fifo_rd == kbd_fifo_wr)
+                return kbd_last_cmd_time + KBD_INQUIRY_HOLD_US;
+        return kbd_last_cmd_time + UMAC_KBD_REPLY_US;
+}
+
 static void     kbd_check_work(void)
 {
         /* Process a keyboard command a little later than the transmit
@@ -273,22 +392,45 @@ static void     kbd_check_work(void)
          * and causes it to ignore the response to punish our
          * hastiness).
          */
-        if (kbd_last_cmd &&
-            ((global_time_us - kbd_last_cmd_time) > UMAC_EXECLOOP_QUANTUM)) {
+        if (kbd_last_cmd && global_time_us >= kbd_reply_due()) {
                 MDBG("KBD: got cmd 0x%x\n", kbd_last_cmd);
-                kbd_rx(kbd_last_cmd);
-                kbd_last_cmd = 0;
+                if (kbd_rx(kbd_last_cmd) == 0)
+                        kbd_last_cmd = 0;
+                else
+                        kbd_retries++;
+        }
+}
+
+/* Shorten an execution slice so a due keyboard reply isn't left
+ * waiting for the end of a whole quantum:
+ */
+static int      kbd_limit_cycles(int cycles)
+{
+        if (kbd_last_cmd) {
+                uint64_t due = kbd_reply_due();
+                uint64_t us = (due > global_time_us) ? due - global_time_us : UMAC_KBD_REPLY_US;
+                if (us * 8 < (uint64_t)cycles)
+                        cycles = us * 8;
         }
+        return cycles;
 }
 
 void    umac_kbd_event(uint8_t scancode, int down)
 {
-        if (kbd_pending_evt >= 0) {
-                MDBG("KBD: Received event %02x with event %02x pending!\n",
-                     scancode, kbd_pending_evt);
-                /* FIXME: Add a queue */
+        if ((kbd_fifo_wr - kbd_fifo_rd) >= KBD_FIFO_SIZE) {
+                MDBG("KBD: Queue full, dropping event %02x\n", scancode);
+                kbd_drops++;
+                return;
         }
-        kbd_pending_evt = scancode | (down ? 0 : 0x80);
+        METRIC_INC(kbd_events);
+        kbd_fifo[kbd_fifo_wr++ % KBD_FIFO_SIZE] = scancode | (down ? 0 : 0x80);
+}
+
+void    umac_kbd_get_stats(unsigned int *queued, unsigned int *drops, unsigned int *retries)
+{
+        *queued = kbd_fifo_wr - kbd_fifo_rd;
+        *drops = kbd_drops;
+        *retries = kbd_retries;
 }
 
 // VIA IRQ output hook:
@@ -317,6 +459,32 @@ static void     scc_irq_set(int status)
         scc_irq_state = status;
 }
 
+static void     (*umac_serial_tx)(int AnB, uint8_t data) = NULL;
+
+static void     scc_tx(int AnB, uint8_t data)
+{
+        if (umac_serial_tx)
+                umac_serial_tx(AnB, data);
+}
+
+void    umac_serial_set_tx(void (*tx)(int AnB, uint8_t data))
+{
+        umac_serial_tx = tx;
+}
+
+static void     (*umac_serial_tx_frame)(int AnB, const uint8_t *data, unsigned int len) = NULL;
+
+static void     scc_tx_frame(int AnB, const uint8_t *data, unsigned int len)
+{
+        if (umac_serial_tx_frame)
+                umac_serial_tx_frame(AnB, data, len);
+}
+
+void    umac_serial_set_tx_frame(void (*tx_frame)(int AnB, const uint8_t *data, unsigned int len))
+{
+        umac_serial_tx_frame = tx_frame;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // IWM
 
@@ -355,6 +523,7 @@ uint8_t iwm_read(unsigned int address)
 
 static unsigned int  FAST_FUNC(cpu_read_instr_normal)(unsigned int address)
 {
+        MEMHEAT(MEMHEAT_FETCH, address);
         /* Can check for 0x400000 (ROM) and otherwise RAM */
         if ((address & 0xf00000) != ROM_ADDR)
                 return RAM_RD_ALIGNED_BE16(CLAMP_RAM_ADDR(address));
@@ -364,6 +533,7 @@ static unsigned int  FAST_FUNC(cpu_read_instr_normal)(unsigned int address)
 
 static unsigned int  FAST_FUNC(cpu_read_instr_overlay)(unsigned int address)
 {
+        MEMHEAT(MEMHEAT_FETCH, address);
         /* Need to check for both 0=ROM, 0x400000=ROM, and RAM at 0x600000...
          */
         if (IS_ROM(address))
@@ -377,6 +547,7 @@ unsigned int (*cpu_read_instr)(unsigned int address) = cpu_read_instr_overlay;
 /* Read data from RAM, ROM, or a device */
 unsigned int    FAST_FUNC(cpu_read_byte)(unsigned int address)
 {
+        MEMHEAT(MEMHEAT_READ, address);
         /* Most likely a RAM access, followed by a ROM access, then I/O */
         if (IS_RAM(address))
                 return RAM_RD8(CLAMP_RAM_ADDR(address));
@@ -384,21 +555,29 @@ unsigned int    FAST_FUNC(cpu_read_byte)(unsigned int address)
                 return ROM_RD8(address & (ROM_SIZE - 1));
 
         // decode IO etc
-        if (IS_VIA(address))
+        cpu_mmio_accesses++;
+        if (IS_VIA(address)) {
+                METRIC_INC(via_accesses[(address >> 9) & 0xf]);
                 return via_read(address);
-        if (IS_IWM(address))
+        }
+        if (IS_IWM(address)) {
+                METRIC_INC(iwm_accesses[(address >> 9) & 0xf]);
                 return iwm_read(address);
-        if (IS_SCC_RD(address))
+        }
+        if (IS_SCC_RD(address)) {
+                METRIC_INC(scc_accesses[(address >> 1) & 0x3]);
                 return scc_read(address);
+        }
         if (IS_DUMMY(address))
                 return 0;
 
-        printf("Attempted to read byte from address %08x\n", address);
+        LOG(LOG_MEM, LOG_INFO, "Attempted to read byte from address %08x\n", address);
         return 0;
 }
 
 unsigned int    FAST_FUNC(cpu_read_word)(unsigned int address)
 {
+        MEMHEAT(MEMHEAT_READ, address);
         if (IS_RAM(address))
                 return RAM_RD16(CLAMP_RAM_ADDR(address));
         if (IS_ROM(address))
@@ -413,6 +592,7 @@ unsigned int    FAST_FUNC(cpu_read_word)(unsigned int address)
 
 unsigned int    FAST_FUNC(cpu_read_long)(unsigned int address)
 {
+        MEMHEAT(MEMHEAT_READ, address);
         if (IS_RAM(address))
                 return RAM_RD32(CLAMP_RAM_ADDR(address));
         if (IS_ROM(address))
@@ -452,57 +632,65 @@ unsigned int    cpu_read_long_dasm(unsigned int address)
 /* Write data to RAM or a device */
 void    FAST_FUNC(cpu_write_byte)(unsigned int address, unsigned int value)
 {
+        MEMHEAT(MEMHEAT_WRITE, address);
+        CPU_WRITE_HOOK(address, 1, value);
         if (IS_RAM(address)) {
                 address = CLAMP_RAM_ADDR(address);
                 RAM_WR8(address, value);
-#if ENABLE_AUDIO
-                if(IS_RAM_AUDIO_TRAP(address)) {
-                    umac_audio_trap();
-                }
-#endif
                 return;
         }
 
         // decode IO
+        cpu_mmio_accesses++;
         if (IS_VIA(address)) {
+                METRIC_INC(via_accesses[(address >> 9) & 0xf]);
                 via_write(address, value);
                 return;
         }
         if (IS_IWM(address)) {
+                METRIC_INC(iwm_accesses[(address >> 9) & 0xf]);
                 iwm_write(address, value);
                 return;
         }
         if (IS_SCC_WR(address)) {
+                METRIC_INC(scc_accesses[(address >> 1) & 0x3]);
                 scc_write(address, value);
                 return;
         }
         if (IS_DUMMY(address))
                 return;
         if (address == PV_SONY_ADDR) {
+                uint64_t t = umac_host_clock ? umac_host_clock() : 0;
                 int r = disc_pv_hook(value);
+                if (umac_host_clock)
+                        umac_host_times[UMAC_TIME_DISC] += umac_host_clock() - t;
                 if (r)
                         exit_error("Disc PV hook failed (%02x)", value);
                 return;
         }
-        printf("Ignoring write %02x to address %08x\n", value&0xff, address);
+        LOG(LOG_MEM, LOG_INFO, "Ignoring write %02x to address %08x\n", value&0xff, address);
 }
 
 void    FAST_FUNC(cpu_write_word)(unsigned int address, unsigned int value)
 {
+        MEMHEAT(MEMHEAT_WRITE, address);
+        CPU_WRITE_HOOK(address, 2, value);
         if (IS_RAM(address)) {
                 RAM_WR16(CLAMP_RAM_ADDR(address), value);
                 return;
         }
-        printf("Ignoring write %04x to address %08x\n", value&0xffff, address);
+        LOG(LOG_MEM, LOG_INFO, "Ignoring write %04x to address %08x\n", value&0xffff, address);
 }
 
 void    FAST_FUNC(cpu_write_long)(unsigned int address, unsigned int value)
 {
+        MEMHEAT(MEMHEAT_WRITE, address);
+        CPU_WRITE_HOOK(address, 4, value);
         if (IS_RAM(address)) {
                 RAM_WR32(CLAMP_RAM_ADDR(address), value);
                 return;
         }
-        printf("Ignoring write %08x to address %08x\n", value, address);
+        LOG(LOG_MEM, LOG_INFO, "Ignoring write %08x to address %08x\n", value, address);
 }
 
 /* Update function pointers for memory accessors based on overlay state/memory map layout */
@@ -525,6 +713,10 @@ void    cpu_pulse_reset(void)
 int     cpu_irq_ack(int level)
 {
         (void)level;
+#ifdef ENABLE_DASM
+        if (prof_active)
+                prof_irq(level);
+#endif
         /* Level really means line, so do an ack per device */
 	return M68K_INT_ACK_AUTOVECTOR;
 }
@@ -575,12 +767,22 @@ void    cpu_instr_callback(int pc)
 	static char buff2[100];
 	static unsigned int instr_size;
 
+#ifdef ENABLE_DASM
+        if (trace_active)
+                trace_insn(pc, global_cycles + m68k_cycles_run());
+        if (trace_check_active && trace_check_insn(pc, global_cycles + m68k_cycles_run()))
+                exit_error("Lockstep check failed");
+        if (prof_active)
+                prof_insn(pc, global_cycles + m68k_cycles_run());
+        if (trapprof_active)
+                trapprof_insn(pc, global_cycles + m68k_cycles_run());
+#endif
         if (!disassemble)
                 return;
 
 	instr_size = m68k_disassemble(buff, pc, M68K_CPU_TYPE_68000);
 	make_hex(buff2, pc, instr_size);
-	MDBG("E %03x: %-20s: %s\n", pc, buff2, buff);
+	printf("E %03x: %-20s: %s\n", pc, buff2, buff);
 	fflush(stdout);
 }
 
@@ -602,6 +804,8 @@ int     umac_init(void *ram_base, void *rom_base, disc_descr_t discs[DISC_NUM_DR
         };
         via_init(&vcb);
         struct scc_cb scb = { .irq_set = scc_irq_set,
+                              .tx = scc_tx,
+                              .tx_frame = scc_tx_frame,
         };
         scc_init(&scb);
         disc_init(discs);
@@ -612,6 +816,7 @@ int     umac_init(void *ram_base, void *rom_base, disc_descr_t discs[DISC_NUM_DR
 void    umac_opt_disassemble(int enable)
 {
         disassemble = enable;
+        cpu_instr_hook = CPU_INSTR_HOOK_WANTED();
 }
 
 /* Provide mouse input (movement, button) data.
@@ -639,8 +844,13 @@ void    umac_absmouse(int x, int y, int button)
 
         if(x != oldx || y != oldy) {
             RAM_WR8(CrsrNew, RAM_RD8(CrsrCouple));
+            input_move_pending = 1;
         }
 
+        if (x != oldx || y != oldy || button != via_mouse_pressed)
+                METRIC_INC(mouse_events);
+        if (button != via_mouse_pressed)
+                input_button_pending = 1;
         via_mouse_pressed = button;
 }
 
@@ -663,11 +873,41 @@ void    umac_mouse(int deltax, int deltay, int button)
 
         if(deltax || deltay) {
             RAM_WR8(CrsrNew, RAM_RD8(CrsrCouple));
+            input_move_pending = 1;
         }
 
+        if (deltax || deltay || button != via_mouse_pressed)
+                METRIC_INC(mouse_events);
+        if (button != via_mouse_pressed)
+                input_button_pending = 1;
         via_mouse_pressed = button;
 }
 
+uint64_t        umac_get_cycles(void)
+{
+        return global_cycles;
+}
+
+void    umac_set_host_clock(uint64_t (*now_ns)(void))
+{
+        umac_host_clock = now_ns;
+}
+
+void    umac_get_host_times(uint64_t times[UMAC_TIME_NUM])
+{
+        memcpy(times, umac_host_times, sizeof(umac_host_times));
+}
+
+void    umac_get_metrics(struct umac_metrics *m)
+{
+#if ENABLE_METRICS
+        *m = umac_metrics;
+        m->cycles = global_cycles;
+#else
+        memset(m, 0, sizeof(*m));
+#endif
+}
+
 void    umac_reset(void)
 {
         overlay = 1;
@@ -691,16 +931,39 @@ int     umac_loop(void)
 {
         setjmp(main_loop_jb);
 
+        cpu_instr_hook = CPU_INSTR_HOOK_WANTED();
         int cycles = UMAC_EXECLOOP_QUANTUM * 8;
         cycles = via_limit_cycles(cycles);
+        cycles = kbd_limit_cycles(cycles);
+        cycles = scc_limit_cycles(cycles);
+        uint64_t t0 = 0, disc0 = umac_host_times[UMAC_TIME_DISC];
+        if (umac_host_clock)
+                t0 = umac_host_clock();
         int used_cycles = m68k_execute(cycles);
         MDBG("Asked to execute %d cycles, actual %d cycles\n", cycles, used_cycles);
         global_cycles += used_cycles;
         global_time_us = global_cycles / 8;
+        if (umac_host_clock) {
+                uint64_t t1 = umac_host_clock();
+                umac_host_times[UMAC_TIME_CPU] += (t1 - t0) -
+                        (umac_host_times[UMAC_TIME_DISC] - disc0);
+                t0 = t1;
+        }
 
         // Device polling
         via_tick(used_cycles);
+        scc_tick(used_cycles);
+        kbdtext_poll();
         kbd_check_work();
+        if (umac_host_clock)
+                umac_host_times[UMAC_TIME_DEVICES] += umac_host_clock() - t0;
+
+        /* The cursor task clears CrsrNew once it's moved the cursor: */
+        if (input_move_pending && !RAM_RD8(CrsrNew)) {
+                input_move_pending = 0;
+                if (umac_input_consumed)
+                        umac_input_consumed(UMAC_INPUT_MOUSE_MOVE);
+        }
 
 	return sim_done;
 }
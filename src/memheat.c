@@ -0,0 +1,228 @@
+/* umac guest memory heatmap
+ *
+ * Counters for each 4KB page of the bus (see memheat.h), bumped from
+ * the CPU's access functions in main.c.  The report sums them by
+ * region (RAM, ROM and each MMIO window), draws a map of the whole
+ * 16MB at 64KB per cell, and lists the busiest pages; which regions
+ * take the most accesses says which order the address decode in
+ * cpu_read_byte() and friends ought to test them.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "umac.h"
+#include "machw.h"
+#include "report.h"
+#include "memheat.h"
+
+#if ENABLE_MEMHEAT
+
+#ifdef DEBUG
+#define MHDBG(...)      printf(__VA_ARGS__)
+#else
+#define MHDBG(...)      do {} while(0)
+#endif
+
+#define MH_PAGE_SIZE    (1 << MEMHEAT_PAGE_SHIFT)
+#define MH_CELL_PAGES   16              /* 64KB per map cell */
+#define MH_TOP          20
+
+uint64_t memheat_counts[MEMHEAT_KINDS][MEMHEAT_PAGES];
+int memheat_active = 0;
+
+static FILE *mh_file;
+
+enum {
+        MH_LOWMEM,
+        MH_RAM,
+        MH_SCREEN,
+        MH_ROM,
+        MH_SCC_RD,
+        MH_SCC_WR,
+        MH_IWM,
+        MH_VIA,
+        MH_OTHER,
+        MH_NUM_REGIONS
+};
+
+static const char *mh_region_names[MH_NUM_REGIONS] = {
+        "Low memory", "RAM", "Screen", "ROM", "SCC (read)", "SCC (write)",
+        "IWM", "VIA", "Other",
+};
+
+static int      mh_overlaps(uint32_t a, uint32_t lo, uint32_t len)
+{
+        return a < lo + len && a + MH_PAGE_SIZE > lo;
+}
+
+/* Which region a page is in.  This goes by address alone, so page 0 is
+ * counted as RAM even whilst the ROM overlay's there, early in boot.
+ */
+static int      mh_region(uint32_t a)
+{
+        if (a < ROM_ADDR || (a & 0xe00000) == RAM_HIGH_ADDR) {
+                uint32_t off = CLAMP_RAM_ADDR(a & 0x1fffff);
+
+                if (off < MH_PAGE_SIZE)
+                        return MH_LOWMEM;
+                if (mh_overlaps(off, UMAC_FB_MAIN_OFFSET, DISP_WIDTH * DISP_HEIGHT / 8) ||
+                    mh_overlaps(off, UMAC_FB_ALT_OFFSET, DISP_WIDTH * DISP_HEIGHT / 8))
+                        return MH_SCREEN;
+                return MH_RAM;
+        }
+        if ((a & 0xf00000) == ROM_ADDR)
+                return MH_ROM;
+        if (IS_VIA(a))
+                return MH_VIA;
+        if (IS_IWM(a) || IS_IWM(a + MH_PAGE_SIZE - 1))
+                return MH_IWM;
+        if (IS_SCC_RD(a))
+                return MH_SCC_RD;
+        if (IS_SCC_WR(a))
+                return MH_SCC_WR;
+        return MH_OTHER;
+}
+
+static uint64_t mh_page_total(unsigned int p)
+{
+        return memheat_counts[MEMHEAT_READ][p] + memheat_counts[MEMHEAT_WRITE][p] +
+                memheat_counts[MEMHEAT_FETCH][p];
+}
+
+static int      mh_cmp_pages(const void *a, const void *b)
+{
+        uint64_t ta = mh_page_total(*(const unsigned int *)a);
+        uint64_t tb = mh_page_total(*(const unsigned int *)b);
+        return (ta < tb) - (ta > tb);
+}
+
+static double   mh_pc(uint64_t n, uint64_t total)
+{
+        return total ? 100.0 * n / total : 0.0;
+}
+
+static void     mh_report_map(FILE *f)
+{
+        static const char shades[] = " .:-=+*#%@";
+        uint64_t cells[MEMHEAT_PAGES / MH_CELL_PAGES];
+        uint64_t max = 0;
+
+        memset(cells, 0, sizeof(cells));
+        for (unsigned int p = 0; p < MEMHEAT_PAGES; p++)
+                cells[p / MH_CELL_PAGES] += mh_page_total(p);
+        for (unsigned int c = 0; c < MEMHEAT_PAGES / MH_CELL_PAGES; c++)
+                if (cells[c] > max)
+                        max = cells[c];
+
+        /* Shade by log(accesses), so quiet pages still show: */
+        fprintf(f, "\nMap, 64KB per cell, shaded '%s' by accesses (log scale, max %lld):\n",
+                shades + 1, (long long)max);
+        fprintf(f, "        0123456789abcdef\n");
+        for (unsigned int row = 0; row < 16; row++) {
+                fprintf(f, "%06x  ", row << 20);
+                for (unsigned int col = 0; col < 16; col++) {
+                        uint64_t n = cells[row * 16 + col];
+                        int s = 0;
+                        if (n)
+                                s = (max > 1) ? 1 + (int)(8.0 * log((double)n) / log((double)max)) : 9;
+                        fputc(shades[s], f);
+                }
+                fputc('\n', f);
+        }
+}
+
+void    memheat_report(FILE *f)
+{
+        uint64_t regions[MH_NUM_REGIONS][MEMHEAT_KINDS];
+        uint64_t totals[MEMHEAT_KINDS] = { 0, 0, 0 };
+        static unsigned int order[MEMHEAT_PAGES];
+        unsigned int n = 0;
+
+        memset(regions, 0, sizeof(regions));
+        for (unsigned int p = 0; p < MEMHEAT_PAGES; p++) {
+                int r = mh_region(p << MEMHEAT_PAGE_SHIFT);
+                for (int k = 0; k < MEMHEAT_KINDS; k++) {
+                        regions[r][k] += memheat_counts[k][p];
+                        totals[k] += memheat_counts[k][p];
+                }
+                if (mh_page_total(p))
+                        order[n++] = p;
+        }
+        uint64_t data = totals[MEMHEAT_READ] + totals[MEMHEAT_WRITE];
+
+        fprintf(f, "Memory heatmap: %lld reads, %lld writes, %lld fetches\n\n",
+                (long long)totals[MEMHEAT_READ], (long long)totals[MEMHEAT_WRITE],
+                (long long)totals[MEMHEAT_FETCH]);
+        fprintf(f, "%-12s %14s %14s %14s %7s\n", "Region", "Reads", "Writes", "Fetches", "Data%");
+        for (int r = 0; r < MH_NUM_REGIONS; r++) {
+                fprintf(f, "%-12s %14lld %14lld %14lld %6.2f%%\n", mh_region_names[r],
+                        (long long)regions[r][MEMHEAT_READ],
+                        (long long)regions[r][MEMHEAT_WRITE],
+                        (long long)regions[r][MEMHEAT_FETCH],
+                        mh_pc(regions[r][MEMHEAT_READ] + regions[r][MEMHEAT_WRITE], data));
+        }
+
+        mh_report_map(f);
+
+        qsort(order, n, sizeof(order[0]), mh_cmp_pages);
+        if (n > MH_TOP)
+                n = MH_TOP;
+        fprintf(f, "\nTop %u pages:\n", n);
+        fprintf(f, "%-8s %-12s %14s %14s %14s\n", "Page", "Region", "Reads", "Writes", "Fetches");
+        for (unsigned int i = 0; i < n; i++) {
+                unsigned int p = order[i];
+                fprintf(f, "%06x   %-12s %14lld %14lld %14lld\n", p << MEMHEAT_PAGE_SHIFT,
+                        mh_region_names[mh_region(p << MEMHEAT_PAGE_SHIFT)],
+                        (long long)memheat_counts[MEMHEAT_READ][p],
+                        (long long)memheat_counts[MEMHEAT_WRITE][p],
+                        (long long)memheat_counts[MEMHEAT_FETCH][p]);
+        }
+        fflush(f);
+}
+
+int     memheat_open(const char *spec)
+{
+        memheat_close();
+        mh_file = report_open(spec, "Memory heatmap");
+        if (!mh_file)
+                return -1;
+        memheat_active = 1;
+        return 0;
+}
+
+void    memheat_close(void)
+{
+        if (!mh_file)
+                return;
+        memheat_active = 0;
+        memheat_report(mh_file);
+        report_close(mh_file);
+        mh_file = NULL;
+}
+
+#endif
@@ -0,0 +1,228 @@
+/* umac metrics exporter
+ *
+ * Listens on a UNIX stream socket, and writes each client a snapshot of
+ * the core's counters (plus the emulated-to-real speed ratio) in the
+ * Prometheus text exposition format, then closes the connection; e.g.
+ * "nc -U <path>".  Everything happens in metrics_serve_poll(), so no
+ * locking is needed.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "umac.h"
+#include "scc.h"
+
+#ifdef DEBUG
+#define XDBG(...)       printf(__VA_ARGS__)
+#else
+#define XDBG(...)       do {} while(0)
+#endif
+
+#define XERR(...)       fprintf(stderr, __VA_ARGS__)
+
+/* Emulated CPU clock, as the core counts it (8 cycles per us): */
+#define METRICS_CPU_HZ          8000000.0
+#define METRICS_SPEED_PERIOD_US 1000000
+#define METRICS_BUF_SIZE        16384
+
+struct metrics_server {
+        int fd;
+        struct sockaddr_un sa;
+        uint64_t last_us;
+        uint64_t last_cycles;
+        double speed;
+        char *buf;
+};
+
+static const char *via_irq_names[8] = {
+        "ca2", "ca1", "sr", "cb2", "cb1", "t2", "t1", NULL
+};
+
+static const char *scc_reg_names[4] = {
+        "b_ctrl", "a_ctrl", "b_data", "a_data"
+};
+
+static uint64_t ms_now_us(void)
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+metrics_server_t *metrics_serve_open(const char *path)
+{
+        metrics_server_t *ms = calloc(1, sizeof(*ms));
+
+        if (!ms)
+                return NULL;
+        ms->buf = malloc(METRICS_BUF_SIZE);
+        ms->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (!ms->buf || ms->fd < 0) {
+                perror("Metrics socket");
+                goto fail;
+        }
+        ms->sa.sun_family = AF_UNIX;
+        strncpy(ms->sa.sun_path, path, sizeof(ms->sa.sun_path) - 1);
+        unlink(path);
+        if (bind(ms->fd, (struct sockaddr *)&ms->sa, sizeof(ms->sa)) || listen(ms->fd, 4) ||
+            fcntl(ms->fd, F_SETFL, fcntl(ms->fd, F_GETFL) | O_NONBLOCK)) {
+                perror("Metrics socket bind");
+                goto fail;
+        }
+        ms->last_us = ms_now_us();
+        printf("Metrics: serving on %s\n", path);
+        return ms;
+
+fail:
+        metrics_serve_close(ms);
+        return NULL;
+}
+
+void    metrics_serve_close(metrics_server_t *ms)
+{
+        if (!ms)
+                return;
+        if (ms->fd >= 0) {
+                close(ms->fd);
+                unlink(ms->sa.sun_path);
+        }
+        free(ms->buf);
+        free(ms);
+}
+
+struct mf {
+        char *buf;
+        unsigned int len, pos;
+};
+
+static void     mf_printf(struct mf *f, const char *fmt, ...)
+{
+        va_list ap;
+        int r;
+
+        va_start(ap, fmt);
+        r = vsnprintf(f->buf + (f->pos < f->len ? f->pos : f->len),
+                      f->pos < f->len ? f->len - f->pos : 0, fmt, ap);
+        va_end(ap);
+        if (r > 0)
+                f->pos += r;
+}
+
+static void     mf_counter(struct mf *f, const char *name, const char *help, uint64_t v)
+{
+        mf_printf(f, "# HELP umac_%s %s\n# TYPE umac_%s counter\numac_%s %llu\n",
+                  name, help, name, name, (unsigned long long)v);
+}
+
+int     metrics_format(char *buf, unsigned int len, const struct umac_metrics *m, double speed)
+{
+        struct mf f = { buf, len, 0 };
+        unsigned int queued, drops, retries;
+
+#ifdef ENABLE_DASM
+        /* Only counted by the instruction hook, so omitted without it: */
+        mf_counter(&f, "instructions_total", "Instructions executed", m->instructions);
+#endif
+        mf_counter(&f, "cycles_total", "CPU cycles executed", m->cycles);
+        mf_printf(&f, "# HELP umac_speed_ratio Emulated time per real time, over the last second\n"
+                  "# TYPE umac_speed_ratio gauge\numac_speed_ratio %.4f\n", speed);
+
+        mf_printf(&f, "# HELP umac_irqs_total Interrupts raised, by source\n"
+                  "# TYPE umac_irqs_total counter\n");
+        for (int i = 0; i < 8; i++)
+                if (via_irq_names[i])
+                        mf_printf(&f, "umac_irqs_total{source=\"via_%s\"} %llu\n",
+                                  via_irq_names[i], (unsigned long long)m->via_irqs[i]);
+        mf_printf(&f, "umac_irqs_total{source=\"scc_dcd_a\"} %llu\n"
+                  "umac_irqs_total{source=\"scc_dcd_b\"} %llu\n",
+                  (unsigned long long)m->scc_dcd_irqs[SCC_CH_A],
+                  (unsigned long long)m->scc_dcd_irqs[SCC_CH_B]);
+
+        mf_printf(&f, "# HELP umac_mmio_accesses_total Device register accesses\n"
+                  "# TYPE umac_mmio_accesses_total counter\n");
+        for (int i = 0; i < 16; i++)
+                if (m->via_accesses[i])
+                        mf_printf(&f, "umac_mmio_accesses_total{device=\"via\",reg=\"%d\"} %llu\n",
+                                  i, (unsigned long long)m->via_accesses[i]);
+        for (int i = 0; i < 16; i++)
+                if (m->iwm_accesses[i])
+                        mf_printf(&f, "umac_mmio_accesses_total{device=\"iwm\",reg=\"%d\"} %llu\n",
+                                  i, (unsigned long long)m->iwm_accesses[i]);
+        for (int i = 0; i < 4; i++)
+                mf_printf(&f, "umac_mmio_accesses_total{device=\"scc\",reg=\"%s\"} %llu\n",
+                          scc_reg_names[i], (unsigned long long)m->scc_accesses[i]);
+
+        umac_kbd_get_stats(&queued, &drops, &retries);
+        mf_counter(&f, "kbd_events_total", "Key events queued for the Mac", m->kbd_events);
+        mf_counter(&f, "kbd_drops_total", "Key events lost to a full queue", drops);
+        mf_counter(&f, "mouse_events_total", "Mouse movements and button changes",
+                   m->mouse_events);
+        mf_counter(&f, "disc_reads_total", "Disc read requests", m->disc_reads);
+        mf_counter(&f, "disc_read_bytes_total", "Bytes read from disc", m->disc_read_bytes);
+        mf_counter(&f, "disc_writes_total", "Disc write requests", m->disc_writes);
+        mf_counter(&f, "disc_write_bytes_total", "Bytes written to disc", m->disc_write_bytes);
+        mf_counter(&f, "vsyncs_total", "Emulated vertical blanks", m->vsyncs);
+        mf_counter(&f, "frames_presented_total", "Frames displayed", m->frames_presented);
+        mf_counter(&f, "frames_dropped_total", "Frame periods skipped through running late",
+                   m->frames_dropped);
+        return f.pos;
+}
+
+void    metrics_serve_poll(metrics_server_t *ms)
+{
+        struct umac_metrics m;
+        uint64_t now = ms_now_us();
+        int fd;
+
+        umac_get_metrics(&m);
+        if (now - ms->last_us >= METRICS_SPEED_PERIOD_US) {
+                ms->speed = ((m.cycles - ms->last_cycles) / METRICS_CPU_HZ) /
+                        ((now - ms->last_us) / 1000000.0);
+                ms->last_us = now;
+                ms->last_cycles = m.cycles;
+        }
+
+        while ((fd = accept(ms->fd, NULL, NULL)) >= 0) {
+                int len = metrics_format(ms->buf, METRICS_BUF_SIZE, &m, ms->speed);
+                if (len > METRICS_BUF_SIZE - 1)
+                        len = METRICS_BUF_SIZE - 1;
+                /* A snapshot's small, so fits in the socket buffer.
+                 * The client may already have gone (e.g. a probe that
+                 * only connects), so don't take SIGPIPE for it:
+                 */
+                if (send(fd, ms->buf, len, MSG_NOSIGNAL) != len)
+                        XDBG("Metrics: short write\n");
+                close(fd);
+        }
+}
@@ -0,0 +1,518 @@
+/* umac guest sampling profiler
+ *
+ * Every N emulated cycles, the PC of the instruction that was running
+ * is counted in a hash table, and the sample is attributed to a region
+ * of memory: ROM, the system or application heap (from the Memory
+ * Manager's zone pointers), or other RAM.  Instructions that touched
+ * a device are counted as MMIO instead, as that's where the emulator
+ * (rather than the guest) spends its time.
+ *
+ * The report symbolises PCs with symtab, so aggregates by routine.
+ *
+ * With the "stacks" option, a shadow call stack is kept too, and each
+ * sample counts the whole stack.  Frames are pushed on entry to a
+ * routine (after JSR/BSR), an A-line trap handler or an interrupt
+ * handler, and popped when the stack pointer rises above the frame's
+ * (so after RTS/RTD/RTE, or a longjmp-style unwind).  The Mac runs in
+ * supervisor mode, so one stack pointer covers everything.  The output
+ * is then folded stacks (";"-separated names and a count per line), as
+ * taken by flame graph tools.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machw.h"
+#include "m68k.h"
+#include "cpu_cb.h"
+#include "symtab.h"
+#include "report.h"
+#include "prof.h"
+
+#ifdef DEBUG
+#define PDBG(...)       printf(__VA_ARGS__)
+#else
+#define PDBG(...)       do {} while(0)
+#endif
+
+#define PERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#define PROF_HASH_SIZE          65536   /* Power of 2 */
+#define PROF_DEFAULT_INTERVAL   1000
+#define PROF_TOP                40
+#define PROF_DEPTH              48
+#define PROF_STACK_HASH_SIZE    16384   /* Power of 2 */
+
+/* Frame "addresses" that aren't, for exception frames: */
+#define PROF_FRAME_TRAP         0x80000000      /* | trap word */
+#define PROF_FRAME_IRQ          0x40000000      /* | level */
+#define PROF_AFTER_CALL         1
+#define PROF_AFTER_RETURN       2
+
+/* Low memory globals */
+#define LM_SYSZONE      0x2a6
+#define LM_APPLZONE     0x2aa
+
+enum prof_region {
+        PR_ROM,
+        PR_SYSHEAP,
+        PR_APPHEAP,
+        PR_RAM,
+        PR_MMIO,
+        PR_NUM
+};
+
+static const char *region_names[PR_NUM] = {
+        "ROM", "System heap", "App heap", "Other RAM", "MMIO",
+};
+
+struct prof_ent {
+        uint32_t key;                   /* PC + 1, 0 if empty */
+        uint32_t count;
+};
+
+struct prof_frame {
+        uint32_t addr;
+        uint32_t sp;
+};
+
+struct prof_stack {
+        uint32_t hash;                  /* 0 if empty */
+        uint32_t count;
+        uint32_t leaf;
+        uint8_t depth;
+        uint32_t addr[PROF_DEPTH];
+};
+
+int prof_active = 0;
+
+static FILE *prof_file;
+static struct prof_ent *prof_hash;
+static uint64_t prof_regions[PR_NUM];
+static uint64_t prof_samples, prof_lost;
+static uint64_t prof_next;
+static unsigned int prof_interval;
+static uint32_t prof_last_pc;
+static unsigned int prof_last_mmio;
+
+/* Shadow stack */
+static int prof_stacks;
+static struct prof_stack *prof_stack_hash;
+static struct prof_frame prof_frames[PROF_DEPTH];
+static unsigned int prof_depth;
+static uint32_t prof_after;             /* What the last instruction did */
+static uint64_t prof_stacks_lost;
+
+static void     prof_count(uint32_t pc)
+{
+        uint32_t key = pc + 1;
+        unsigned int h = (key * 2654435761u) >> 16;
+
+        for (unsigned int i = 0; i < PROF_HASH_SIZE; i++) {
+                struct prof_ent *e = &prof_hash[(h + i) & (PROF_HASH_SIZE - 1)];
+                if (e->key == key) {
+                        e->count++;
+                        return;
+                }
+                if (!e->key) {
+                        e->key = key;
+                        e->count = 1;
+                        return;
+                }
+        }
+        prof_lost++;
+}
+
+static uint16_t prof_read16(uint32_t addr)
+{
+        if (IS_RAM(addr))
+                return RAM_RD16(CLAMP_RAM_ADDR(addr));
+        if (IS_ROM(addr))
+                return ROM_RD16(addr & (ROM_SIZE - 1));
+        return 0;
+}
+
+static void     prof_count_stack(uint32_t pc)
+{
+        uint32_t h = pc * 2654435761u;
+
+        for (unsigned int i = 0; i < prof_depth; i++)
+                h = (h ^ prof_frames[i].addr) * 2654435761u;
+        h |= 1;
+        for (unsigned int i = 0; i < PROF_STACK_HASH_SIZE; i++) {
+                struct prof_stack *e = &prof_stack_hash[(h + i) & (PROF_STACK_HASH_SIZE - 1)];
+                if (!e->hash) {
+                        e->hash = h;
+                        e->count = 1;
+                        e->leaf = pc;
+                        e->depth = prof_depth;
+                        for (unsigned int j = 0; j < prof_depth; j++)
+                                e->addr[j] = prof_frames[j].addr;
+                        return;
+                }
+                if (e->hash == h && e->leaf == pc && e->depth == prof_depth) {
+                        unsigned int j;
+                        for (j = 0; j < prof_depth; j++)
+                                if (e->addr[j] != prof_frames[j].addr)
+                                        break;
+                        if (j == prof_depth) {
+                                e->count++;
+                                return;
+                        }
+                }
+        }
+        prof_stacks_lost++;
+}
+
+/* Drop frames the stack pointer has risen above (or, for a new frame,
+ * risen to: what was there has been abandoned):
+ */
+static void     prof_unwind(uint32_t sp, int inclusive)
+{
+        while (prof_depth && (prof_frames[prof_depth - 1].sp < sp ||
+                              (inclusive && prof_frames[prof_depth - 1].sp == sp)))
+                prof_depth--;
+}
+
+/* Follow calls and returns.  An instruction's effect is seen at the
+ * next one, when the stack pointer has been updated.  Frames too deep
+ * to record aren't pushed, but as frames are unwound by stack pointer
+ * the ones beneath them are still popped correctly.
+ */
+static void     prof_track(uint32_t pc)
+{
+        if (prof_after) {
+                uint32_t sp = ADR24(m68k_get_reg(NULL, M68K_REG_A7));
+
+                if (prof_after == PROF_AFTER_RETURN) {
+                        prof_unwind(sp, 0);
+                } else {
+                        prof_unwind(sp, 1);
+                        if (prof_depth < PROF_DEPTH) {
+                                prof_frames[prof_depth].addr =
+                                        (prof_after == PROF_AFTER_CALL) ? pc : prof_after;
+                                prof_frames[prof_depth].sp = sp;
+                                prof_depth++;
+                        }
+                }
+                prof_after = 0;
+        }
+
+        uint16_t op = prof_read16(pc);
+        if ((op & 0xffc0) == 0x4e80 || (op & 0xff00) == 0x6100)
+                prof_after = PROF_AFTER_CALL;                   /* JSR, BSR */
+        else if ((op & 0xf000) == 0xa000)
+                prof_after = PROF_FRAME_TRAP | op;
+        else if (op == 0x4e73 || op == 0x4e74 || op == 0x4e75 || op == 0x4e77)
+                prof_after = PROF_AFTER_RETURN;                 /* RTE, RTD, RTS, RTR */
+}
+
+void    prof_irq(int level)
+{
+        if (prof_stacks)
+                prof_after = PROF_FRAME_IRQ | level;
+}
+
+static int      prof_in_zone(uint32_t pc, uint32_t zone_ptr)
+{
+        uint32_t zone = ADR24(RAM_RD32(zone_ptr));
+        uint32_t lim;
+
+        if (!IS_RAM(zone) || zone >= RAM_SIZE - 4)
+                return 0;
+        lim = ADR24(RAM_RD32(zone));
+        return pc >= zone && pc < lim;
+}
+
+static enum prof_region prof_region(uint32_t pc, int mmio)
+{
+        if (mmio)
+                return PR_MMIO;
+        if (IS_ROM(pc))
+                return PR_ROM;
+        if (prof_in_zone(pc, LM_APPLZONE))
+                return PR_APPHEAP;
+        if (prof_in_zone(pc, LM_SYSZONE))
+                return PR_SYSHEAP;
+        return PR_RAM;
+}
+
+void    prof_insn(uint32_t pc, uint64_t cycle)
+{
+        /* The sample goes to the instruction that ran over the boundary: */
+        if (cycle >= prof_next) {
+                int mmio = cpu_mmio_accesses != prof_last_mmio;
+
+                prof_count(prof_last_pc);
+                if (prof_stacks)
+                        prof_count_stack(prof_last_pc);
+                prof_regions[prof_region(prof_last_pc, mmio)]++;
+                prof_samples++;
+                prof_next += prof_interval;
+                if (prof_next <= cycle)
+                        prof_next = cycle + prof_interval;
+        }
+        prof_last_pc = ADR24(pc);
+        prof_last_mmio = cpu_mmio_accesses;
+        if (prof_stacks)
+                prof_track(prof_last_pc);
+}
+
+struct prof_sym {
+        const char *name;
+        uint32_t pc;
+        uint64_t count;
+};
+
+static int      prof_sym_name_cmp(const void *a, const void *b)
+{
+        const struct prof_sym *sa = a, *sb = b;
+        if (sa->name != sb->name)
+                return (sa->name > sb->name) - (sa->name < sb->name);
+        return (sa->pc > sb->pc) - (sa->pc < sb->pc);
+}
+
+static int      prof_sym_count_cmp(const void *a, const void *b)
+{
+        const struct prof_sym *sa = a, *sb = b;
+        return (sa->count < sb->count) - (sa->count > sb->count);
+}
+
+void    prof_report(FILE *f)
+{
+        struct prof_sym *syms;
+        unsigned int n = 0, m = 0;
+        double total = prof_samples ? (double)prof_samples : 1.0;
+
+        if (!prof_hash)
+                return;
+        fprintf(f, "Profile: %lld samples, every %d cycles",
+                (long long)prof_samples, prof_interval);
+        if (prof_lost)
+                fprintf(f, " (%lld unrecorded)", (long long)prof_lost);
+        fprintf(f, "\n");
+        for (int i = 0; i < PR_NUM; i++)
+                fprintf(f, "  %-12s %10lld %6.2f%%\n", region_names[i],
+                        (long long)prof_regions[i], 100.0 * prof_regions[i] / total);
+
+        syms = malloc(PROF_HASH_SIZE * sizeof(*syms));
+        if (!syms)
+                return;
+        /* Name by routine, merging PCs within one: */
+        symtab_scan_traps();
+        for (unsigned int i = 0; i < PROF_HASH_SIZE; i++) {
+                if (!prof_hash[i].key)
+                        continue;
+                syms[n].pc = prof_hash[i].key - 1;
+                syms[n].name = symtab_lookup(syms[n].pc);
+                syms[n].count = prof_hash[i].count;
+                n++;
+        }
+        qsort(syms, n, sizeof(*syms), prof_sym_name_cmp);
+        for (unsigned int i = 0; i < n; i++) {
+                if (m && syms[i].name && syms[i].name == syms[m - 1].name)
+                        syms[m - 1].count += syms[i].count;
+                else
+                        syms[m++] = syms[i];
+        }
+        qsort(syms, m, sizeof(*syms), prof_sym_count_cmp);
+
+        fprintf(f, "Top routines:\n");
+        for (unsigned int i = 0; i < m && i < PROF_TOP; i++) {
+                fprintf(f, "  %10lld %6.2f%%  ", (long long)syms[i].count,
+                        100.0 * syms[i].count / total);
+                if (syms[i].name)
+                        fprintf(f, "%s\n", syms[i].name);
+                else
+                        fprintf(f, "$%06x\n", syms[i].pc);
+        }
+        free(syms);
+}
+
+struct prof_line {
+        char *text;
+        uint64_t count;
+};
+
+static int      prof_line_cmp(const void *a, const void *b)
+{
+        return strcmp(((const struct prof_line *)a)->text, ((const struct prof_line *)b)->text);
+}
+
+static void     prof_frame_name(char *buf, size_t len, uint32_t addr)
+{
+        const char *n;
+
+        if (addr & PROF_FRAME_TRAP) {
+                n = symtab_trap_name(addr & 0xffff);
+                if (n)
+                        snprintf(buf, len, "%s", n);
+                else
+                        snprintf(buf, len, "_%04X", addr & 0xffff);
+        } else if (addr & PROF_FRAME_IRQ) {
+                snprintf(buf, len, "[IRQ %d]", addr & 7);
+        } else {
+                n = symtab_lookup(addr);
+                if (n)
+                        snprintf(buf, len, "%s", n);
+                else
+                        snprintf(buf, len, "$%06x", addr);
+        }
+}
+
+/* Folded stacks, outermost first, merging those that name the same: */
+static void     prof_report_folded(FILE *f)
+{
+        struct prof_line *lines = malloc(PROF_STACK_HASH_SIZE * sizeof(*lines));
+        char text[PROF_DEPTH * 64 + 64], name[64];
+        unsigned int n = 0, m = 0;
+
+        if (!lines)
+                return;
+        symtab_scan_traps();
+        for (unsigned int i = 0; i < PROF_STACK_HASH_SIZE; i++) {
+                struct prof_stack *e = &prof_stack_hash[i];
+                size_t len = 0;
+
+                if (!e->hash)
+                        continue;
+                text[0] = '\0';
+                for (unsigned int j = 0; j < e->depth; j++) {
+                        prof_frame_name(name, sizeof(name), e->addr[j]);
+                        len += snprintf(text + len, sizeof(text) - len, "%s%s", j ? ";" : "", name);
+                }
+                /* Then the leaf, unless it's the innermost routine (or
+                 * anonymous code within it):
+                 */
+                const char *leaf = symtab_lookup(e->leaf);
+                int in_routine = e->depth &&
+                        !(e->addr[e->depth - 1] & (PROF_FRAME_TRAP | PROF_FRAME_IRQ));
+                if (leaf ? (!e->depth || strcmp(name, leaf)) : !in_routine) {
+                        if (leaf)
+                                snprintf(name, sizeof(name), "%s", leaf);
+                        else
+                                snprintf(name, sizeof(name), "$%06x", e->leaf);
+                        snprintf(text + len, sizeof(text) - len, "%s%s", e->depth ? ";" : "", name);
+                }
+                lines[n].text = strdup(text);
+                lines[n].count = e->count;
+                if (lines[n].text)
+                        n++;
+        }
+        qsort(lines, n, sizeof(*lines), prof_line_cmp);
+        for (unsigned int i = 0; i < n; i++) {
+                if (m && !strcmp(lines[i].text, lines[m - 1].text)) {
+                        lines[m - 1].count += lines[i].count;
+                        free(lines[i].text);
+                } else {
+                        lines[m++] = lines[i];
+                }
+        }
+        for (unsigned int i = 0; i < m; i++) {
+                fprintf(f, "%s %lld\n", lines[i].text, (long long)lines[i].count);
+                free(lines[i].text);
+        }
+        if (prof_stacks_lost)
+                PERR("Profile: %lld samples' stacks unrecorded\n", (long long)prof_stacks_lost);
+        free(lines);
+}
+
+int     prof_open(const char *spec)
+{
+        char *s = strdup(spec);
+        char *opt, *next;
+
+        if (!s)
+                return -1;
+        prof_close();
+        prof_interval = PROF_DEFAULT_INTERVAL;
+        prof_stacks = 0;
+
+        opt = strchr(s, ',');
+        if (opt)
+                *opt++ = '\0';
+        for (; opt; opt = next) {
+                next = strchr(opt, ',');
+                if (next)
+                        *next++ = '\0';
+                if (!strncmp(opt, "interval=", 9) && atoi(opt + 9) > 0) {
+                        prof_interval = atoi(opt + 9);
+                } else if (!strcmp(opt, "stacks")) {
+                        prof_stacks = 1;
+                } else {
+                        PERR("Profile: bad option '%s'\n", opt);
+                        free(s);
+                        return -1;
+                }
+        }
+
+        prof_file = report_open(s, "Profile");
+        free(s);
+        if (!prof_file)
+                return -1;
+        prof_hash = calloc(PROF_HASH_SIZE, sizeof(struct prof_ent));
+        if (prof_stacks)
+                prof_stack_hash = calloc(PROF_STACK_HASH_SIZE, sizeof(struct prof_stack));
+        if (!prof_hash || (prof_stacks && !prof_stack_hash)) {
+                perror("Profile");
+                report_close(prof_file);
+                prof_file = NULL;
+                free(prof_hash);
+                prof_hash = NULL;
+                free(prof_stack_hash);
+                prof_stack_hash = NULL;
+                return -1;
+        }
+        memset(prof_regions, 0, sizeof(prof_regions));
+        prof_samples = 0;
+        prof_lost = 0;
+        prof_next = prof_interval;
+        prof_last_pc = 0;
+        prof_last_mmio = cpu_mmio_accesses;
+        prof_depth = 0;
+        prof_after = 0;
+        prof_stacks_lost = 0;
+        prof_active = 1;
+        PDBG("Profiling every %d cycles\n", prof_interval);
+        return 0;
+}
+
+void    prof_close(void)
+{
+        if (!prof_file)
+                return;
+        prof_active = 0;
+        if (prof_stacks)
+                prof_report_folded(prof_file);
+        else
+                prof_report(prof_file);
+        report_close(prof_file);
+        prof_file = NULL;
+        free(prof_hash);
+        prof_hash = NULL;
+        free(prof_stack_hash);
+        prof_stack_hash = NULL;
+}
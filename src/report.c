@@ -0,0 +1,56 @@
+/* umac report files
+ *
+ * Where the profilers and the other tools that report on exit put
+ * their output.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "report.h"
+
+#ifdef DEBUG
+#define RDBG(...)       printf(__VA_ARGS__)
+#else
+#define RDBG(...)       do {} while(0)
+#endif
+
+FILE    *report_open(const char *spec, const char *what)
+{
+        FILE *f = strcmp(spec, "-") ? fopen(spec, "w") : stdout;
+
+        if (!f) {
+                perror(what);
+                return NULL;
+        }
+        RDBG("%s to '%s'\n", what, spec);
+        return f;
+}
+
+void    report_close(FILE *f)
+{
+        if (f && f != stdout)
+                fclose(f);
+}
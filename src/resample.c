@@ -0,0 +1,184 @@
+/* umac audio resampler
+ *
+ * Converts the Mac's ~22.25kHz sound stream to whatever rate the host
+ * audio device runs at, rather than relying on the device (or SDL's
+ * per-callback conversion) to take the odd rate.
+ *
+ * This is a polyphase windowed-sinc filter: RS_TAPS taps, with
+ * coefficients tabulated for RS_PHASES fractional positions and
+ * linearly interpolated between adjacent phases.  Cutoff is a little
+ * below the lower of the two Nyquist rates, and the window is Kaiser.
+ * The dot products use GCC vector extensions, so map onto SSE/NEON
+ * where available (and plain scalar code otherwise).
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resample.h"
+
+#define RS_TAPS         16      /* Multiple of 4 */
+#define RS_PHASES       256     /* Power of 2 */
+#define RS_PHASE_BITS   8
+#define RS_BUF          4096    /* Input samples */
+#define RS_KAISER_BETA  8.0
+#define RS_CUTOFF       0.9     /* Fraction of the lower Nyquist rate */
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+struct resampler {
+        /* One extra phase, so phase p+1 always exists to interpolate with */
+        v4sf coef[RS_PHASES + 1][RS_TAPS / 4];
+        float buf[RS_BUF];
+        unsigned int head;      /* Valid samples in buf */
+        uint64_t pos;           /* 32.32 position in buf of next output */
+        uint64_t step;
+        uint64_t step_nominal;
+};
+
+static double   bessel_i0(double x)
+{
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; k++) {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+        }
+        return sum;
+}
+
+static void     rs_make_coefs(resampler_t *rs, double in_rate, double out_rate)
+{
+        double fc = RS_CUTOFF * ((out_rate < in_rate) ? out_rate / in_rate : 1.0);
+        double i0b = bessel_i0(RS_KAISER_BETA);
+
+        for (int p = 0; p <= RS_PHASES; p++) {
+                double frac = (double)p / RS_PHASES;
+                float c[RS_TAPS];
+                double sum = 0;
+
+                for (int k = 0; k < RS_TAPS; k++) {
+                        /* Distance of tap k from the output position: */
+                        double t = (k - (RS_TAPS / 2 - 1)) - frac;
+                        double x = t / (RS_TAPS / 2);
+                        double w = (fabs(x) >= 1.0) ? 0.0 :
+                                bessel_i0(RS_KAISER_BETA * sqrt(1.0 - x * x)) / i0b;
+                        double s = (t == 0.0) ? 1.0 : sin(M_PI * fc * t) / (M_PI * fc * t);
+                        c[k] = s * w;
+                        sum += c[k];
+                }
+                /* Unity gain at DC, for every phase */
+                for (int k = 0; k < RS_TAPS; k++)
+                        c[k] /= sum;
+                memcpy(rs->coef[p], c, sizeof(c));
+        }
+}
+
+resampler_t     *resampler_new(double in_rate, double out_rate)
+{
+        resampler_t *rs = aligned_alloc(16, (sizeof(resampler_t) + 15) & ~15);
+        if (!rs)
+                return NULL;
+        memset(rs, 0, sizeof(*rs));
+        rs_make_coefs(rs, in_rate, out_rate);
+        rs->step_nominal = rs->step = (uint64_t)((in_rate / out_rate) * 4294967296.0);
+        /* Start with a filter's worth of silence behind the first sample */
+        rs->head = RS_TAPS / 2 - 1;
+        rs->pos = (uint64_t)(RS_TAPS / 2 - 1) << 32;
+        return rs;
+}
+
+void    resampler_free(resampler_t *rs)
+{
+        free(rs);
+}
+
+void    resampler_set_adjust(resampler_t *rs, double adjust)
+{
+        rs->step = (uint64_t)(rs->step_nominal * adjust);
+}
+
+unsigned int    resampler_space(resampler_t *rs)
+{
+        /* Input before the filter's left edge is no longer needed */
+        unsigned int first = (rs->pos >> 32) - (RS_TAPS / 2 - 1);
+        return RS_BUF - rs->head + first;
+}
+
+unsigned int    resampler_push(resampler_t *rs, const int16_t *in, unsigned int num)
+{
+        unsigned int first = (rs->pos >> 32) - (RS_TAPS / 2 - 1);
+
+        if (rs->head + num > RS_BUF && first) {
+                memmove(rs->buf, &rs->buf[first], (rs->head - first) * sizeof(float));
+                rs->head -= first;
+                rs->pos -= (uint64_t)first << 32;
+        }
+        if (num > RS_BUF - rs->head)
+                num = RS_BUF - rs->head;
+        for (unsigned int i = 0; i < num; i++)
+                rs->buf[rs->head + i] = in[i];
+        rs->head += num;
+        return num;
+}
+
+unsigned int    resampler_pull(resampler_t *rs, int16_t *out, unsigned int num)
+{
+        unsigned int n;
+
+        for (n = 0; n < num; n++) {
+                uint32_t i = rs->pos >> 32;
+                if (i + RS_TAPS / 2 >= rs->head)
+                        break;
+
+                uint32_t frac = (uint32_t)rs->pos;
+                unsigned int ph = frac >> (32 - RS_PHASE_BITS);
+                float sub = (float)(frac & ((1u << (32 - RS_PHASE_BITS)) - 1)) /
+                        (float)(1u << (32 - RS_PHASE_BITS));
+                const float *x = &rs->buf[i - (RS_TAPS / 2 - 1)];
+                const v4sf *c0 = rs->coef[ph];
+                const v4sf *c1 = rs->coef[ph + 1];
+                v4sf a0 = {0, 0, 0, 0};
+                v4sf a1 = {0, 0, 0, 0};
+
+                for (int k = 0; k < RS_TAPS / 4; k++) {
+                        v4sf xv;
+                        memcpy(&xv, &x[k * 4], sizeof(xv));
+                        a0 += c0[k] * xv;
+                        a1 += c1[k] * xv;
+                }
+                float y0 = a0[0] + a0[1] + a0[2] + a0[3];
+                float y1 = a1[0] + a1[1] + a1[2] + a1[3];
+                float y = y0 + sub * (y1 - y0);
+
+                if (y > 32767.0f)
+                        y = 32767.0f;
+                else if (y < -32768.0f)
+                        y = -32768.0f;
+                out[n] = (int16_t)lrintf(y);
+                rs->pos += rs->step;
+        }
+        return n;
+}
@@ -1,6 +1,23 @@
-/* SCC 85C30 model: just enough to model DCD interrupts.
+/* SCC 85C30 model: DCD interrupts (for the mouse), and async serial
+ * on both channels.
  * God, I hate this chip, it's fugly AF.
  *
+ * Serial data is paced by the baud rate the Mac programs: received
+ * bytes are queued by the host (scc_rx_char()) and move into the 3-byte
+ * RX FIFO one character time apart, and transmitted bytes are passed
+ * to the tx callback a character time after they start shifting out.
+ * Rather than overrun the FIFO, received bytes wait in the queue, so
+ * the host side is effectively flow-controlled by how fast the Mac
+ * reads them.  A channel can also be made "fast", where a character
+ * takes a token few cycles regardless of baud rate.
+ *
+ * In SDLC mode (as used for LocalTalk), whole frames are passed in
+ * and out instead: received frames are clocked into the FIFO followed
+ * by two (dummy) CRC bytes, the last flagged End of Frame in RR1, and
+ * a frame's transmitted when the TX underruns.  Address search, hunt
+ * and the TX underrun/EOM latch are modelled; CRCs aren't.  Frame
+ * buffers are allocated on first use, so cost nothing otherwise.
+ *
  * Copyright 2024 Matt Evans
  *
  * Permission is hereby granted, free of charge, to any person
@@ -25,18 +42,30 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 
 #include "scc.h"
+#include "metrics.h"
+#include "log.h"
 
-#ifdef DEBUG
-#define SDBG(...)       printf(__VA_ARGS__)
-#else
-#define SDBG(...)       do {} while(0)
-#endif
+#define SDBG(...)       LOG(LOG_SCC, LOG_DEBUG, __VA_ARGS__)
 
 #define SERR(...)       fprintf(stderr, __VA_ARGS__)
 
+/* Clocks: the Mac feeds 3.672MHz to PCLK and RTxC.  TRxC is only
+ * driven by external devices; assume a MIDI interface's 1MHz.
+ */
+#define SCC_PCLK_HZ     3672000
+#define SCC_TRXC_HZ     1000000
+#define SCC_CPU_HZ      7833600
+
+#define SCC_RX_FIFO     3
+#define SCC_INQ_SIZE    1024    /* Power of 2 */
+#define SCC_FAST_CYCLES 64
+#define SCC_FRAME_SLOTS 8       /* Power of 2 */
+#define SCC_MIN_SLICE   400     /* Don't chop execution finer than this */
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // SCC
@@ -51,9 +80,15 @@ static uint8_t scc_ie[2] = {0};
 #define SCC_IE_CTS              0x20
 #define SCC_IE_TXUNDER          0x40
 #define SCC_IE_ABORT            0x80
+#define SCC_RR1_EOF             0x80
+#define SCC_RR1_RESIDUE         0x06    /* 8 bits/char */
 static uint8_t scc_irq_pending = 0;
 #define SCC_IP_B_EXT            0x01
+#define SCC_IP_B_TX             0x02
+#define SCC_IP_B_RX             0x04
 #define SCC_IP_A_EXT            0x08
+#define SCC_IP_A_TX             0x10
+#define SCC_IP_A_RX             0x20
 
 static uint8_t scc_vec = 0;
 static uint8_t scc_irq = 0;
@@ -63,14 +98,128 @@ static uint8_t scc_dcd_pins = 0;        // 0 = A, 1 = B
 static uint8_t scc_dcd_a_changed = 0;
 static uint8_t scc_dcd_b_changed = 0;
 
+/* SDLC frame buffers: */
+struct scc_sdlc {
+        uint8_t rx[SCC_FRAME_SLOTS][SCC_FRAME_MAX];
+        unsigned int rx_len[SCC_FRAME_SLOTS];
+        unsigned int rx_rd, rx_wr;
+        unsigned int rx_pos;            /* In rx[rx_rd], including CRC */
+        uint8_t tx[SCC_FRAME_MAX];
+        unsigned int tx_len;
+};
+
+/* Per-channel serial state, indexed by AnB (i.e. [1] is channel A): */
+struct scc_chan {
+        uint8_t wr[16];                 /* WR1, 3-5, 8, 10-14 used */
+        /* Receive */
+        uint8_t fifo[SCC_RX_FIFO];
+        uint8_t fifo_stat[SCC_RX_FIFO]; /* RR1 bits for each byte */
+        unsigned int fifo_n;
+        uint8_t rr1;                    /* Status of last byte read */
+        uint8_t inq[SCC_INQ_SIZE];      /* From host, not yet "on the wire" */
+        unsigned int inq_rd, inq_wr;
+        int rx_count;                   /* Cycles until next char arrives */
+        int rx_first;                   /* RX IRQ on first char armed */
+        /* Transmit */
+        uint8_t tx_buf;
+        uint8_t tx_shift;
+        int tx_buf_full;
+        int tx_busy;
+        int tx_count;                   /* Cycles until shift completes */
+        int tx_ip;
+        int fast;
+        int cts;                        /* Pin state, 1 = asserted */
+        int cts_changed;
+        /* SDLC */
+        struct scc_sdlc *sdlc;
+        int hunt;
+        int hunt_changed;
+        int eom;                        /* TX underrun/EOM latch */
+        int eom_changed;
+};
+static struct scc_chan scc_chan[2];
+
+#define WR1_EXT_IE      0x01
+#define WR1_TX_IE       0x02
+#define WR1_RX_MODE(x)  (((x) >> 3) & 3)
+#define WR3_RX_EN       0x01
+#define WR5_TX_EN       0x08
+#define WR3_ADDR_SEARCH 0x04
+#define WR3_HUNT        0x10
+#define WR14_BRG_EN     0x01
+
+#define SCC_IS_SDLC(c)  (((c)->wr[4] & 0x3c) == 0x20)
+
 static void     scc_assess_irq(void);
+static int      scc_char_cycles(struct scc_chan *c);
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static void     scc_chan_reset(int AnB)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+
+        c->wr[1] = 0;
+        c->wr[3] &= ~WR3_RX_EN;
+        c->wr[5] &= ~WR5_TX_EN;
+        c->wr[14] &= ~WR14_BRG_EN;
+        c->fifo_n = 0;
+        c->rx_first = 1;
+        c->rr1 = SCC_RR1_RESIDUE;
+        c->tx_buf_full = 0;
+        c->tx_busy = 0;
+        c->tx_ip = 0;
+        c->hunt = 1;
+        c->eom = 1;
+        if (c->sdlc) {
+                c->sdlc->rx_rd = c->sdlc->rx_wr;
+                c->sdlc->rx_pos = 0;
+                c->sdlc->tx_len = 0;
+        }
+}
+
+static struct scc_sdlc *scc_get_sdlc(struct scc_chan *c)
+{
+        if (!c->sdlc)
+                c->sdlc = calloc(1, sizeof(struct scc_sdlc));
+        return c->sdlc;
+}
+
+/* SDLC frame input.  Free slots are filled in place (e.g. straight
+ * from a socket), then committed in order.
+ */
+unsigned int    scc_rx_frame_space(int AnB)
+{
+        struct scc_sdlc *f = scc_get_sdlc(&scc_chan[AnB]);
+        return f ? SCC_FRAME_SLOTS - (f->rx_wr - f->rx_rd) : 0;
+}
+
+uint8_t         *scc_rx_frame_slot(int AnB, unsigned int i)
+{
+        struct scc_sdlc *f = scc_chan[AnB].sdlc;
+        return f->rx[(f->rx_wr + i) % SCC_FRAME_SLOTS];
+}
+
+void    scc_rx_frame_commit(int AnB, unsigned int len)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+        struct scc_sdlc *f = c->sdlc;
+
+        if (!len || len > SCC_FRAME_MAX)
+                return;
+        if (f->rx_rd == f->rx_wr)
+                c->rx_count = scc_char_cycles(c);
+        f->rx_len[f->rx_wr++ % SCC_FRAME_SLOTS] = len;
+}
+
 void    scc_init(struct scc_cb *cb)
 {
         if (cb)
                 scc_callbacks = *cb;
+        for (int i = 0; i < 2; i++) {
+                scc_chan[i].cts = 1;
+                scc_chan_reset(i);
+        }
 }
 
 void    scc_set_dcd(int a, int b)
@@ -85,15 +234,286 @@ void    scc_set_dcd(int a, int b)
         scc_assess_irq();
 }
 
+void    scc_set_cts(int AnB, int asserted)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+        asserted = !!asserted;
+        if (asserted != c->cts) {
+                c->cts = asserted;
+                c->cts_changed = 1;
+                scc_assess_irq();
+        }
+}
+
+void    scc_set_fast(int AnB, int fast)
+{
+        scc_chan[AnB].fast = fast;
+}
+
+/* Queue a byte from the outside world; it's received by the SCC
+ * after a character time, once there's space in the FIFO.  Bytes
+ * arriving whilst the receiver's disabled are lost, as on the wire.
+ */
+int     scc_rx_char(int AnB, uint8_t data)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+
+        if (!(c->wr[3] & WR3_RX_EN))
+                return 0;
+        if ((c->inq_wr - c->inq_rd) >= SCC_INQ_SIZE)
+                return -1;
+        if (c->inq_wr == c->inq_rd)     /* Starts arriving now */
+                c->rx_count = scc_char_cycles(c);
+        c->inq[c->inq_wr++ % SCC_INQ_SIZE] = data;
+        return 0;
+}
+
+unsigned int    scc_rx_space(int AnB)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+        return SCC_INQ_SIZE - (c->inq_wr - c->inq_rd);
+}
+
+/* Cycles per character, from clock mode, source and format; 0 if the
+ * channel has no clock.
+ */
+static int      scc_char_cycles(struct scc_chan *c)
+{
+        static const int clk_mul[4] = { 1, 16, 32, 64 };
+        static const int data_bits[4] = { 5, 7, 6, 8 };
+        /* In half bits, async modes only */
+        static const int stop_2bits[4] = { 2, 2, 3, 4 };
+        double clk;
+
+        if (c->fast)
+                return SCC_FAST_CYCLES;
+
+        switch ((c->wr[11] >> 5) & 3) {
+        case 1:         /* TRxC pin */
+                clk = SCC_TRXC_HZ;
+                break;
+        case 2:         /* BRG */
+                if (!(c->wr[14] & WR14_BRG_EN))
+                        return 0;
+                clk = SCC_PCLK_HZ / (2.0 * ((c->wr[12] | (c->wr[13] << 8)) + 2));
+                break;
+        case 3:         /* DPLL, from RTxC: 16x bit rate in FM modes */
+                clk = SCC_PCLK_HZ / 16.0;
+                break;
+        default:        /* RTxC pin */
+                clk = SCC_PCLK_HZ;
+        }
+        int half_bits;
+        if (SCC_IS_SDLC(c) || !(c->wr[4] & 0x0c))
+                half_bits = 2 * data_bits[c->wr[3] >> 6];       /* Sync: no framing */
+        else
+                half_bits = 2 * (1 + data_bits[c->wr[3] >> 6] + (c->wr[4] & 1)) +
+                        stop_2bits[(c->wr[4] >> 2) & 3];
+        double cycles = (double)half_bits * clk_mul[c->wr[4] >> 6] * SCC_CPU_HZ / (2.0 * clk);
+        return (cycles < 1.0) ? 1 : (int)cycles;
+}
+
+/* Start shifting out the buffered TX byte, if any: */
+static void     scc_tx_start(struct scc_chan *c, int char_cycles)
+{
+        if (c->tx_busy || !c->tx_buf_full || !(c->wr[5] & WR5_TX_EN) || !char_cycles)
+                return;
+        c->tx_shift = c->tx_buf;
+        c->tx_buf_full = 0;
+        c->tx_busy = 1;
+        c->tx_count += char_cycles;
+        if (c->tx_count <= 0)
+                c->tx_count = char_cycles;
+        /* Buffer's now empty: */
+        if (c->wr[1] & WR1_TX_IE)
+                c->tx_ip = 1;
+}
+
+static void     scc_rx_push(struct scc_chan *c, uint8_t data, uint8_t stat)
+{
+        c->fifo_stat[c->fifo_n] = stat;
+        c->fifo[c->fifo_n++] = data;
+}
+
+static uint8_t  scc_rx_pop(struct scc_chan *c)
+{
+        uint8_t d = c->fifo[0];
+        if (!c->fifo_n)
+                return d;       /* Stale, like the real thing */
+        c->rr1 = c->fifo_stat[0];
+        for (unsigned int i = 1; i < c->fifo_n; i++) {
+                c->fifo[i - 1] = c->fifo[i];
+                c->fifo_stat[i - 1] = c->fifo_stat[i];
+        }
+        c->fifo_n--;
+        c->rx_first = 0;
+        return d;
+}
+
+static void     scc_set_hunt(struct scc_chan *c, int hunt)
+{
+        if (hunt != c->hunt) {
+                c->hunt = hunt;
+                c->hunt_changed = 1;
+        }
+}
+
+/* Clock the next byte of the current SDLC frame into the FIFO.
+ * Returns 0 if there's nothing to receive.
+ */
+static int      scc_sdlc_rx_byte(struct scc_chan *c)
+{
+        struct scc_sdlc *f = c->sdlc;
+
+        while (f->rx_rd != f->rx_wr) {
+                uint8_t *fr = f->rx[f->rx_rd % SCC_FRAME_SLOTS];
+                unsigned int len = f->rx_len[f->rx_rd % SCC_FRAME_SLOTS];
+
+                if (f->rx_pos == 0) {
+                        /* Opening flag and address: */
+                        if ((c->wr[3] & WR3_ADDR_SEARCH) &&
+                            fr[0] != c->wr[6] && fr[0] != 0xff) {
+                                f->rx_rd++;
+                                continue;
+                        }
+                        scc_set_hunt(c, 0);
+                }
+                if (f->rx_pos < len) {
+                        scc_rx_push(c, fr[f->rx_pos++], SCC_RR1_RESIDUE);
+                } else if (f->rx_pos == len) {
+                        scc_rx_push(c, 0, SCC_RR1_RESIDUE);     /* CRC */
+                        f->rx_pos++;
+                } else {
+                        scc_rx_push(c, 0, SCC_RR1_RESIDUE | SCC_RR1_EOF);
+                        f->rx_pos = 0;
+                        f->rx_rd++;
+                }
+                return 1;
+        }
+        return 0;
+}
+
+static int      scc_rx_pending(struct scc_chan *c)
+{
+        if (SCC_IS_SDLC(c))
+                return c->sdlc && c->sdlc->rx_rd != c->sdlc->rx_wr;
+        return c->inq_rd != c->inq_wr;
+}
+
+/* SDLC: TX underrun ends the frame. */
+static void     scc_sdlc_tx_end(int AnB, struct scc_chan *c)
+{
+        struct scc_sdlc *f = c->sdlc;
+
+        if (f && f->tx_len) {
+                SDBG("[SCC: TX%c frame, %d bytes]\n", 'B' - AnB, f->tx_len);
+                if (scc_callbacks.tx_frame)
+                        scc_callbacks.tx_frame(AnB, f->tx, f->tx_len);
+                f->tx_len = 0;
+        }
+        if (!c->eom) {
+                c->eom = 1;
+                c->eom_changed = 1;
+        }
+}
+
+static void     scc_chan_tick(int AnB, int cycles)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+        int ct = scc_char_cycles(c);
+
+        if (!ct)
+                return;
+
+        if (c->tx_busy) {
+                c->tx_count -= cycles;
+                while (c->tx_busy && c->tx_count <= 0) {
+                        c->tx_busy = 0;
+                        if (SCC_IS_SDLC(c)) {
+                                struct scc_sdlc *f = scc_get_sdlc(c);
+                                if (f && f->tx_len < SCC_FRAME_MAX)
+                                        f->tx[f->tx_len++] = c->tx_shift;
+                        } else {
+                                SDBG("[SCC: TX%c %02x]\n", 'B' - AnB, c->tx_shift);
+                                if (scc_callbacks.tx)
+                                        scc_callbacks.tx(AnB, c->tx_shift);
+                        }
+                        scc_tx_start(c, ct);
+                        if (!c->tx_busy && SCC_IS_SDLC(c))
+                                scc_sdlc_tx_end(AnB, c);
+                }
+        } else {
+                c->tx_count = 0;
+        }
+
+        if (c->sdlc && !SCC_IS_SDLC(c)) {
+                /* Frames are missed unless in SDLC mode.  (They're held
+                 * whilst the receiver's briefly off, e.g. during TX, as
+                 * replies can be generated sooner than on the wire.)
+                 */
+                c->sdlc->rx_rd = c->sdlc->rx_wr;
+                c->sdlc->rx_pos = 0;
+        }
+        if ((c->wr[3] & WR3_RX_EN) && scc_rx_pending(c) && c->fifo_n < SCC_RX_FIFO) {
+                c->rx_count -= cycles;
+                while (c->rx_count <= 0 && c->fifo_n < SCC_RX_FIFO) {
+                        if (SCC_IS_SDLC(c)) {
+                                if (!scc_sdlc_rx_byte(c))
+                                        break;
+                        } else if (c->inq_rd != c->inq_wr) {
+                                scc_rx_push(c, c->inq[c->inq_rd++ % SCC_INQ_SIZE],
+                                            SCC_RR1_RESIDUE);
+                        } else {
+                                break;
+                        }
+                        c->rx_count += ct;
+                }
+        } else {
+                /* Line idle (or held): next char takes a full char time */
+                c->rx_count = ct;
+        }
+}
+
+void    scc_tick(int cycles)
+{
+        scc_chan_tick(0, cycles);
+        scc_chan_tick(1, cycles);
+        scc_assess_irq();
+}
+
+/* Shorten an execution slice so that the next character's not late: */
+int     scc_limit_cycles(int cycles)
+{
+        for (int i = 0; i < 2; i++) {
+                struct scc_chan *c = &scc_chan[i];
+                int n = cycles;
+
+                if (c->tx_busy)
+                        n = c->tx_count;
+                if ((c->wr[3] & WR3_RX_EN) && scc_rx_pending(c) &&
+                    c->fifo_n < SCC_RX_FIFO && c->rx_count < n)
+                        n = c->rx_count;
+                if (n < SCC_MIN_SLICE)
+                        n = SCC_MIN_SLICE;
+                if (n < cycles)
+                        cycles = n;
+        }
+        return cycles;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // WR0: Reg pointers, command
-static void     scc_wr0(uint8_t data)
+static void     scc_wr0(int AnB, uint8_t data)
 {
+        struct scc_chan *c = &scc_chan[AnB];
+
         scc_reg_ptr = data & 7;
 
-        if (data & 0xc0) {
-                // Reset commands, e.g. CRC generators, EOM latch
+        // Reset commands, e.g. CRC generators, EOM latch
+        if ((data & 0xc0) == 0xc0 && c->eom) {
+                c->eom = 0;
+                c->eom_changed = 1;
         }
         int cmd = (data & 0x38) >> 3;
         switch (cmd) {
@@ -102,8 +522,27 @@ static void     scc_wr0(uint8_t data)
         case 1: // Point high
                 scc_reg_ptr |= 8;
                 break;
-                // 2: reset Ext/Status IRQs
-                // enables RR0 status to be re-latched (cause IRQ again if sometihng's pending?)
+        case 2: // Reset Ext/Status IRQs
+                // Enables RR0 status to be re-latched.  Pending ext
+                // IRQs are consumed by the RR2 read (see below).
+                break;
+        case 4: // Enable IRQ on next RX char
+                c->rx_first = 1;
+                break;
+        case 5: // Reset TX IRQ pending
+                c->tx_ip = 0;
+                break;
+        case 3: // Send abort (SDLC)
+                if (c->sdlc)
+                        c->sdlc->tx_len = 0;
+                break;
+        case 6: // Error reset: only EOF is generated, clear it
+                c->rr1 &= ~SCC_RR1_EOF;
+                if (c->fifo_n)
+                        c->fifo_stat[0] &= ~SCC_RR1_EOF;
+                break;
+        case 7: // Reset highest IUS: no IUS nesting is modelled
+                break;
         default:
                 SDBG("(SCC WR0: Command %d unhandled!)\n", cmd);
         }
@@ -118,12 +557,24 @@ static void     scc_wr2(uint8_t data)
 // WR3: Receive Parameters & Control
 static void     scc_wr3(int AnB, uint8_t data)
 {
-        (void)AnB;
         // Keep an eye out for bit 0x10 (enter hunt mode), and external/status is asserted
 
-        if (data & 0x10) {
-                // Enter hunt mode (Don't really need to do anything, 7.5.5 doesn't care)
+        if (data & WR3_HUNT) {
+                // Enter hunt mode (7.5.5 doesn't care, but SDLC does)
+                scc_set_hunt(&scc_chan[AnB], 1);
         }
+        scc_chan[AnB].wr[3] = data & ~WR3_HUNT;
+}
+
+// WR8: Transmit buffer
+static void     scc_wr8(int AnB, uint8_t data)
+{
+        struct scc_chan *c = &scc_chan[AnB];
+
+        c->tx_buf = data;
+        c->tx_buf_full = 1;
+        c->tx_ip = 0;
+        scc_tx_start(c, scc_char_cycles(c));
 }
 
 int scc_get_mie() { return scc_mie; }
@@ -131,9 +582,11 @@ int scc_get_mie() { return scc_mie; }
 // WR9: Master Interrupt control and reset commands
 static void     scc_wr9(uint8_t data)
 {
-        // 7:8 = Various reset commands, channel A/B/HW reset
-        if (data & 0xc0) {
-        }
+        // 7:6 = Various reset commands, channel A/B/HW reset
+        if (data & 0x40)
+                scc_chan_reset(0);
+        if (data & 0x80)
+                scc_chan_reset(1);
         scc_mie = !!(data & 0x08);
         scc_read_acks = !!(data & 0x20);
         scc_status_hi = !!(data & 0x10);
@@ -145,9 +598,16 @@ static void     scc_wr15(int AnB, uint8_t data)
         scc_ie[AnB] = data;
 }
 
+// A special receive condition (EOF) at the head of the FIFO:
+static int      scc_rx_special(struct scc_chan *c)
+{
+        return c->fifo_n && (c->fifo_stat[0] & SCC_RR1_EOF);
+}
+
 // RR0: Transmit and Receive buffer status and external status
 static uint8_t  scc_rr0(int AnB)
 {
+        struct scc_chan *c = &scc_chan[AnB];
         uint8_t v = 0;
         // [3]: If IE[channel].DCD = 0, reports /DCD pin state.  Else, reports
         //      state as of last pin change (?).. samples as of IRQ?
@@ -158,9 +618,16 @@ static uint8_t  scc_rr0(int AnB)
         } else {
                 v = (scc_dcd_pins & 2) ? 0x08 : 0;
         }
-        // (Other bits: [2] = TX empty, [5] = /CTS)
-        v |= 0x10; // Sync/Hunt status (set on reset/by hunt?)
-        v |= 0x40; // TxUnderrun/EOM
+        if (c->fifo_n)
+                v |= 0x01; // RX char available
+        if (!c->tx_buf_full)
+                v |= 0x04; // TX buffer empty
+        if (c->cts)
+                v |= 0x20;
+        if (c->hunt || !SCC_IS_SDLC(c))
+                v |= 0x10; // Sync/Hunt status (set on reset/by hunt)
+        if (c->eom || !SCC_IS_SDLC(c))
+                v |= 0x40; // TxUnderrun/EOM
 
         return v;
 }
@@ -168,28 +635,40 @@ static uint8_t  scc_rr0(int AnB)
 // RR1: Special Receive condition
 static uint8_t  scc_rr1(int AnB)
 {
-        uint8_t v = 0x01 /* All sent */ | 0x06 /* SDLC, set to 011 on channel reset */;
-        (void)AnB;
+        struct scc_chan *c = &scc_chan[AnB];
+        // Residue code: SDLC, set to 011 on channel reset.  Status is
+        // that of the byte at the head of the FIFO, or last read.
         // Note, not really necessary (7.5.5 is OK to return 0) but A Bit Better
+        uint8_t v = c->fifo_n ? c->fifo_stat[0] : c->rr1;
+        if (!c->tx_busy && !c->tx_buf_full)
+                v |= 0x01; // All sent
         return v;
 }
 
 // RR2:
 // Some special behaviour; if scc_read_acks, then a read will do an ack, de-assert IRQ
-// If read from A, raw vector.  If read from B, "modified vector" == ?
+// If read from A, raw vector.  If read from B, "modified vector", with
+// status of the highest-priority pending IRQ:
+//  A RX = 110 (special 111), A TX = 100, A ext = 101,
+//  B RX = 010 (special 011), B TX = 000, B ext = 001
 static uint8_t  scc_rr2(int AnB)
 {
         if (AnB)
                 return scc_vec;
 
-        //status high shift << 3
-        // B external = 001
-        // A external = 101
         uint8_t v = 0;
-        if (scc_irq_pending & SCC_IP_A_EXT) {
+        if (scc_irq_pending & SCC_IP_A_RX) {
+                v = scc_rx_special(&scc_chan[1]) ? 7 : 6;
+        } else if (scc_irq_pending & SCC_IP_A_TX) {
+                v = 4;
+        } else if (scc_irq_pending & SCC_IP_A_EXT) {
                 v = 5;
 
                 scc_irq_pending &= ~SCC_IP_A_EXT;
+        } else if (scc_irq_pending & SCC_IP_B_RX) {
+                v = scc_rx_special(&scc_chan[0]) ? 3 : 2;
+        } else if (scc_irq_pending & SCC_IP_B_TX) {
+                v = 0;
         } else if (scc_irq_pending & SCC_IP_B_EXT) {
                 v = 1;
 
@@ -199,7 +678,8 @@ static uint8_t  scc_rr2(int AnB)
         }
         // VIS
 
-        // FIXME: consume/clear in pending..?
+        // RX/TX IPs are cleared at source (reading data, writing data
+        // or WR0 reset TX IP), so aren't consumed here.
         //
         if (scc_status_hi)
                 v = (scc_vec & 0x8f) | (v << 4);
@@ -216,6 +696,12 @@ static uint8_t  scc_rr3(int AnB)
         return scc_irq_pending;
 }
 
+// RR8: Receive buffer
+static uint8_t  scc_rr8(int AnB)
+{
+        return scc_rx_pop(&scc_chan[AnB]);
+}
+
 // RR15: Reflects WR15 (interrupt enables)
 static uint8_t  scc_rr15(int AnB)
 {
@@ -230,12 +716,62 @@ static void     scc_assess_irq(void)
 {
         if (scc_dcd_a_changed && (scc_ie[1] & SCC_IE_DCD)) {
                 scc_irq_pending |= SCC_IP_A_EXT;
+                METRIC_INC(scc_dcd_irqs[SCC_CH_A]);
                 scc_dcd_a_changed = 0;
         }
         if (scc_dcd_b_changed && (scc_ie[0] & SCC_IE_DCD)) {
                 scc_irq_pending |= SCC_IP_B_EXT;
+                METRIC_INC(scc_dcd_irqs[SCC_CH_B]);
                 scc_dcd_b_changed = 0;
         }
+        if (scc_chan[1].cts_changed && (scc_ie[1] & SCC_IE_CTS) &&
+            (scc_chan[1].wr[1] & WR1_EXT_IE)) {
+                scc_irq_pending |= SCC_IP_A_EXT;
+                scc_chan[1].cts_changed = 0;
+        }
+        if (scc_chan[0].cts_changed && (scc_ie[0] & SCC_IE_CTS) &&
+            (scc_chan[0].wr[1] & WR1_EXT_IE)) {
+                scc_irq_pending |= SCC_IP_B_EXT;
+                scc_chan[0].cts_changed = 0;
+        }
+
+        for (int i = 0; i < 2; i++) {
+                struct scc_chan *c = &scc_chan[i];
+                int ext = 0;
+                if (c->hunt_changed) {
+                        ext |= scc_ie[i] & SCC_IE_SYNCHUNT;
+                        c->hunt_changed = 0;
+                }
+                if (c->eom_changed) {
+                        ext |= scc_ie[i] & SCC_IE_TXUNDER;
+                        c->eom_changed = 0;
+                }
+                if (ext && (c->wr[1] & WR1_EXT_IE))
+                        scc_irq_pending |= i ? SCC_IP_A_EXT : SCC_IP_B_EXT;
+        }
+
+        /* RX/TX are level-style, recomputed from channel state: */
+        scc_irq_pending &= ~(SCC_IP_A_RX | SCC_IP_A_TX | SCC_IP_B_RX | SCC_IP_B_TX);
+        for (int i = 0; i < 2; i++) {
+                struct scc_chan *c = &scc_chan[i];
+                int rx = 0;
+
+                switch (WR1_RX_MODE(c->wr[1])) {
+                case 1: // First char (or special condition)
+                        rx = (c->fifo_n && c->rx_first) || scc_rx_special(c);
+                        break;
+                case 2: // All chars (or special condition)
+                        rx = c->fifo_n != 0;
+                        break;
+                case 3: // Special condition only
+                        rx = scc_rx_special(c);
+                        break;
+                }
+                if (rx)
+                        scc_irq_pending |= i ? SCC_IP_A_RX : SCC_IP_B_RX;
+                if (c->tx_ip && (c->wr[1] & WR1_TX_IE))
+                        scc_irq_pending |= i ? SCC_IP_A_TX : SCC_IP_B_TX;
+        }
 
         if (scc_irq_pending && scc_mie) {
                 if (!scc_irq) {
@@ -262,14 +798,15 @@ void    scc_write(unsigned int address, uint8_t data)
         SDBG("[SCC: Write %x %02x]: ", address, data);
 
         if (DnC) {
-                SDBG("[SCC: Data write (%c) ignored]\n", 'B' - AnB);
+                SDBG("[SCC: Data write (%c) %02x]\n", 'B' - AnB, data);
+                scc_wr8(AnB, data);
         } else {
                 SDBG("[SCC: WR %02x -> WR%d%c]\n",
                      data, scc_reg_ptr, 'B' - AnB);
 
                 switch (scc_reg_ptr) {
                 case 0:
-                        scc_wr0(data);
+                        scc_wr0(AnB, data);
                         break;
                 case 2:
                         scc_wr2(data);
@@ -279,6 +816,10 @@ void    scc_write(unsigned int address, uint8_t data)
                         scc_wr3(AnB, data);
                         scc_reg_ptr = 0;
                         break;
+                case 8:
+                        scc_wr8(AnB, data);
+                        scc_reg_ptr = 0;
+                        break;
                 case 9:
                         scc_wr9(data);
                         scc_reg_ptr = 0;
@@ -287,6 +828,20 @@ void    scc_write(unsigned int address, uint8_t data)
                         scc_wr15(AnB, data);
                         scc_reg_ptr = 0;
                         break;
+                case 1:
+                case 4:
+                case 5:
+                case 6:
+                case 7:
+                case 10:
+                case 11:
+                case 12:
+                case 13:
+                case 14:
+                        // Modes, SDLC address/flag, clocking, BRG time constant
+                        scc_chan[AnB].wr[scc_reg_ptr] = data;
+                        scc_reg_ptr = 0;
+                        break;
                 default:
                         SDBG("[SCC: unhandled WR %02x to reg %d]\n",
                              data, scc_reg_ptr);
@@ -305,24 +860,38 @@ uint8_t scc_read(unsigned int address)
 
         SDBG("[SCC: Read %x]: ", address);
         if (DnC) {
-                SDBG("[SCC: Data read (%c) ignored]\n", 'B' - AnB);
+                data = scc_rr8(AnB);
+                SDBG("[SCC: Data read (%c) %02x]\n", 'B' - AnB, data);
+                scc_assess_irq();
         } else {
                 SDBG("[SCC: RD <- RR%d%c = ",
                      scc_reg_ptr, 'B' - AnB);
 
                 switch (scc_reg_ptr) {
                 case 0:
+                case 4:         // Images of RR0-3
                         data = scc_rr0(AnB);
                         break;
                 case 1:
+                case 5:
                         data = scc_rr1(AnB);
                         break;
                 case 2:
+                case 6:
                         data = scc_rr2(AnB);
                         break;
                 case 3:
+                case 7:
                         data = scc_rr3(AnB);
                         break;
+                case 8:
+                        data = scc_rr8(AnB);
+                        scc_assess_irq();
+                        break;
+                case 12:
+                case 13:
+                        data = scc_chan[AnB].wr[scc_reg_ptr];
+                        break;
                 case 15:
                         data = scc_rr15(AnB);
                         break;
@@ -336,4 +905,3 @@ uint8_t scc_read(unsigned int address)
         scc_reg_ptr = 0;
         return data;
 }
-
@@ -0,0 +1,261 @@
+/* umac serial bridge
+ *
+ * Connects an SCC channel to a host PTY or UNIX socket.  Input is read
+ * only as fast as the SCC can queue it, and output is buffered; if
+ * the host end stops reading, CTS is dropped so that a Mac using
+ * hardware handshaking pauses, and only when the buffer's full are
+ * bytes lost.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serbridge.h"
+#include "scc.h"
+
+#ifdef DEBUG
+#define BDBG(...)       printf(__VA_ARGS__)
+#else
+#define BDBG(...)       do {} while(0)
+#endif
+
+#define BERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#define SB_OBUF_SIZE    4096
+#define SB_CTS_OFF      (SB_OBUF_SIZE * 3 / 4)
+#define SB_CTS_ON       (SB_OBUF_SIZE / 4)
+
+struct serbridge {
+        int AnB;
+        int fd;                 /* Data; -1 if not connected */
+        int listen_fd;          /* Listening socket, or -1 */
+        int is_sock;            /* fd is a socket (not a PTY) */
+        uint8_t obuf[SB_OBUF_SIZE];
+        unsigned int olen;
+        unsigned int drops;
+        int cts;
+};
+
+static int      sb_nonblock(int fd)
+{
+        int fl = fcntl(fd, F_GETFL);
+        return (fl < 0) ? -1 : fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+static int      sb_open_pty(void)
+{
+        struct termios t;
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+        if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+                perror("Serial PTY");
+                if (fd >= 0)
+                        close(fd);
+                return -1;
+        }
+        /* Raw, 8-bit clean: */
+        if (tcgetattr(fd, &t) == 0) {
+                cfmakeraw(&t);
+                tcsetattr(fd, TCSANOW, &t);
+        }
+        printf("Serial: PTY is %s\n", ptsname(fd));
+        return fd;
+}
+
+static void     sb_open_socket(serbridge_t *sb, const char *path)
+{
+        struct sockaddr_un sa;
+        int fd;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+                perror("Serial socket");
+                return;
+        }
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+                printf("Serial: connected to %s\n", path);
+                sb->fd = fd;
+                sb->is_sock = 1;
+                return;
+        }
+        /* Nobody there, so wait for someone to connect: */
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 1)) {
+                perror("Serial socket bind");
+                close(fd);
+                return;
+        }
+        printf("Serial: listening on %s\n", path);
+        sb->listen_fd = fd;
+        sb->is_sock = 1;
+}
+
+serbridge_t     *serbridge_open(int AnB, const char *spec)
+{
+        serbridge_t *sb = calloc(1, sizeof(*sb));
+        char *path = strdup(spec);
+        char *opt;
+
+        if (!sb || !path) {
+                free(sb);
+                free(path);
+                return NULL;
+        }
+        sb->AnB = AnB;
+        sb->fd = -1;
+        sb->listen_fd = -1;
+        sb->cts = 1;
+
+        opt = strchr(path, ',');
+        if (opt) {
+                *opt++ = '\0';
+                if (strcmp(opt, "fast")) {
+                        BERR("Serial: unknown option '%s'\n", opt);
+                        goto fail;
+                }
+                scc_set_fast(AnB, 1);
+        }
+        if (!strcmp(path, "pty"))
+                sb->fd = sb_open_pty();
+        else
+                sb_open_socket(sb, path);
+        if (sb->fd < 0 && sb->listen_fd < 0)
+                goto fail;
+        if ((sb->fd >= 0 && sb_nonblock(sb->fd)) ||
+            (sb->listen_fd >= 0 && sb_nonblock(sb->listen_fd))) {
+                perror("Serial fcntl");
+                goto fail;
+        }
+        free(path);
+        return sb;
+
+fail:
+        serbridge_close(sb);
+        free(path);
+        return NULL;
+}
+
+void    serbridge_close(serbridge_t *sb)
+{
+        if (!sb)
+                return;
+        if (sb->drops)
+                printf("Serial: %d bytes of output lost\n", sb->drops);
+        if (sb->fd >= 0)
+                close(sb->fd);
+        if (sb->listen_fd >= 0)
+                close(sb->listen_fd);
+        free(sb);
+}
+
+static void     sb_disconnect(serbridge_t *sb)
+{
+        BDBG("Serial: peer went away\n");
+        close(sb->fd);
+        sb->fd = -1;
+        sb->olen = 0;
+}
+
+static void     sb_flush(serbridge_t *sb)
+{
+        if (sb->fd >= 0 && sb->olen) {
+                /* A socket peer that's gone raises SIGPIPE, which would
+                 * kill us before we see EPIPE; don't let it:
+                 */
+                ssize_t r = sb->is_sock ?
+                        send(sb->fd, sb->obuf, sb->olen, MSG_NOSIGNAL) :
+                        write(sb->fd, sb->obuf, sb->olen);
+                if (r > 0) {
+                        memmove(sb->obuf, sb->obuf + r, sb->olen - r);
+                        sb->olen -= r;
+                } else if (r < 0 && errno != EAGAIN && errno != EINTR && errno != EIO) {
+                        sb_disconnect(sb);
+                }
+        }
+        /* Flow control towards the Mac: */
+        if (sb->cts && sb->olen >= SB_CTS_OFF) {
+                sb->cts = 0;
+                scc_set_cts(sb->AnB, 0);
+        } else if (!sb->cts && sb->olen <= SB_CTS_ON) {
+                sb->cts = 1;
+                scc_set_cts(sb->AnB, 1);
+        }
+}
+
+void    serbridge_tx(serbridge_t *sb, uint8_t data)
+{
+        if (sb->olen == SB_OBUF_SIZE) {
+                sb->drops++;
+                return;
+        }
+        sb->obuf[sb->olen++] = data;
+        /* Flushed by serbridge_poll(), so bursts go out together */
+}
+
+void    serbridge_poll(serbridge_t *sb)
+{
+        uint8_t buf[256];
+
+        if (sb->fd < 0 && sb->listen_fd >= 0) {
+                sb->fd = accept(sb->listen_fd, NULL, NULL);
+                if (sb->fd < 0)
+                        return;
+                sb_nonblock(sb->fd);
+                BDBG("Serial: accepted connection\n");
+        }
+        if (sb->fd < 0)
+                return;
+
+        sb_flush(sb);
+        if (sb->fd < 0)
+                return;
+
+        unsigned int space = scc_rx_space(sb->AnB);
+        if (space > sizeof(buf))
+                space = sizeof(buf);
+        if (!space)
+                return;
+        ssize_t r = read(sb->fd, buf, space);
+        if (r > 0) {
+                for (ssize_t i = 0; i < r; i++)
+                        scc_rx_char(sb->AnB, buf[i]);
+        } else if (r == 0) {
+                sb_disconnect(sb);
+        }
+        /* (A PTY with no slave open reads EIO; just try again later.) */
+}
@@ -0,0 +1,407 @@
+/* umac guest symbol table
+ *
+ * Maps guest code addresses to routine names, for the profilers and
+ * traces.  See symtab.h for the sources of names.  Lookups are made
+ * when reporting, not whilst running, so favour simplicity over
+ * speed.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machw.h"
+#include "symtab.h"
+
+#ifdef DEBUG
+#define YDBG(...)       printf(__VA_ARGS__)
+#else
+#define YDBG(...)       do {} while(0)
+#endif
+
+#define YERR(...)       fprintf(stderr, __VA_ARGS__)
+
+/* Don't attribute code further than this past a symbol to it: */
+#define SYM_MAP_MAX_DIST        0x4000
+#define SYM_TRAP_MAX_DIST       0x2000
+/* How far to look for the end of a routine, for its MacsBug name: */
+#define SYM_MACSBUG_SCAN        0x4000
+#define SYM_NAME_MAX            64
+
+/* Trap dispatch tables, Mac Plus layout: */
+#define OS_TRAP_TABLE           0x400
+#define OS_TRAP_NUM             256
+#define TB_TRAP_TABLE           0xc00
+#define TB_TRAP_NUM             512
+
+struct sym {
+        uint32_t addr;
+        const char *name;
+};
+
+struct symlist {
+        struct sym *syms;
+        unsigned int num, size;
+};
+
+static struct symlist sym_map;
+static struct symlist sym_traps;
+
+/* Known trap names.  OS traps are indexed by bits [7:0] (as bits [10:8]
+ * are flags), Toolbox traps by bits [9:0].
+ */
+static const struct {
+        uint16_t trap;
+        const char *name;
+} trap_names[] = {
+        { 0xa000, "Open" }, { 0xa001, "Close" }, { 0xa002, "Read" }, { 0xa003, "Write" },
+        { 0xa004, "Control" }, { 0xa005, "Status" }, { 0xa006, "KillIO" },
+        { 0xa007, "GetVolInfo" }, { 0xa008, "Create" }, { 0xa009, "Delete" },
+        { 0xa00a, "OpenRF" }, { 0xa00b, "Rename" }, { 0xa00c, "GetFileInfo" },
+        { 0xa00d, "SetFileInfo" }, { 0xa00e, "UnmountVol" }, { 0xa00f, "MountVol" },
+        { 0xa010, "Allocate" }, { 0xa011, "GetEOF" }, { 0xa012, "SetEOF" },
+        { 0xa013, "FlushVol" }, { 0xa014, "GetVol" }, { 0xa015, "SetVol" },
+        { 0xa016, "InitQueue" }, { 0xa017, "Eject" }, { 0xa018, "GetFPos" },
+        { 0xa019, "InitZone" }, { 0xa01a, "GetZone" }, { 0xa01b, "SetZone" },
+        { 0xa01c, "FreeMem" }, { 0xa01d, "MaxMem" }, { 0xa01e, "NewPtr" },
+        { 0xa01f, "DisposPtr" }, { 0xa020, "SetPtrSize" }, { 0xa021, "GetPtrSize" },
+        { 0xa022, "NewHandle" }, { 0xa023, "DisposHandle" }, { 0xa024, "SetHandleSize" },
+        { 0xa025, "GetHandleSize" }, { 0xa026, "HandleZone" }, { 0xa027, "ReallocHandle" },
+        { 0xa028, "RecoverHandle" }, { 0xa029, "HLock" }, { 0xa02a, "HUnlock" },
+        { 0xa02b, "EmptyHandle" }, { 0xa02c, "InitApplZone" }, { 0xa02d, "SetApplLimit" },
+        { 0xa02e, "BlockMove" }, { 0xa02f, "PostEvent" }, { 0xa030, "OSEventAvail" },
+        { 0xa031, "GetOSEvent" }, { 0xa032, "FlushEvents" }, { 0xa033, "VInstall" },
+        { 0xa034, "VRemove" }, { 0xa035, "OffLine" }, { 0xa036, "MoreMasters" },
+        { 0xa037, "ReadParam" }, { 0xa038, "WriteParam" }, { 0xa039, "ReadDateTime" },
+        { 0xa03a, "SetDateTime" }, { 0xa03b, "Delay" }, { 0xa03c, "CmpString" },
+        { 0xa03d, "DrvrInstall" }, { 0xa03e, "DrvrRemove" }, { 0xa03f, "InitUtil" },
+        { 0xa040, "ResrvMem" }, { 0xa041, "SetFilLock" }, { 0xa042, "RstFilLock" },
+        { 0xa043, "SetFilType" }, { 0xa044, "SetFPos" }, { 0xa045, "FlushFile" },
+        { 0xa046, "GetTrapAddress" }, { 0xa047, "SetTrapAddress" }, { 0xa048, "PtrZone" },
+        { 0xa049, "HPurge" }, { 0xa04a, "HNoPurge" }, { 0xa04b, "SetGrowZone" },
+        { 0xa04c, "CompactMem" }, { 0xa04d, "PurgeMem" }, { 0xa04e, "AddDrive" },
+        { 0xa04f, "RDrvrInstall" }, { 0xa050, "RelString" }, { 0xa051, "ReadXPRam" },
+        { 0xa052, "WriteXPRam" }, { 0xa054, "UprString" }, { 0xa055, "StripAddress" },
+        { 0xa057, "SetApplBase" }, { 0xa058, "InsTime" }, { 0xa059, "RmvTime" },
+        { 0xa05a, "PrimeTime" }, { 0xa060, "HFSDispatch" }, { 0xa061, "MaxBlock" },
+        { 0xa062, "PurgeSpace" }, { 0xa063, "MaxApplZone" }, { 0xa064, "MoveHHi" },
+        { 0xa065, "StackSpace" }, { 0xa066, "NewEmptyHandle" }, { 0xa067, "HSetRBit" },
+        { 0xa068, "HClrRBit" }, { 0xa069, "HGetState" }, { 0xa06a, "HSetState" },
+
+        { 0xa850, "InitCursor" }, { 0xa851, "SetCursor" }, { 0xa852, "HideCursor" },
+        { 0xa853, "ShowCursor" }, { 0xa86e, "InitGraf" }, { 0xa86f, "OpenPort" },
+        { 0xa873, "SetPort" }, { 0xa874, "GetPort" }, { 0xa878, "SetOrigin" },
+        { 0xa879, "SetClip" }, { 0xa87b, "ClipRect" }, { 0xa882, "StdText" },
+        { 0xa883, "DrawChar" }, { 0xa884, "DrawString" }, { 0xa885, "DrawText" },
+        { 0xa886, "TextWidth" }, { 0xa887, "TextFont" }, { 0xa888, "TextFace" },
+        { 0xa889, "TextMode" }, { 0xa88a, "TextSize" }, { 0xa88c, "StringWidth" },
+        { 0xa88d, "CharWidth" }, { 0xa890, "StdLine" }, { 0xa891, "LineTo" },
+        { 0xa893, "MoveTo" }, { 0xa8a0, "StdRect" }, { 0xa8a1, "FrameRect" },
+        { 0xa8a2, "PaintRect" }, { 0xa8a3, "EraseRect" }, { 0xa8a4, "InverRect" },
+        { 0xa8a5, "FillRect" }, { 0xa8d8, "NewRgn" }, { 0xa8d9, "DisposRgn" },
+        { 0xa8eb, "StdBits" }, { 0xa8ec, "CopyBits" }, { 0xa8ef, "ScrollRect" },
+        { 0xa8f6, "DrawPicture" }, { 0xa8fe, "InitFonts" },
+        { 0xa912, "InitWindows" }, { 0xa913, "NewWindow" }, { 0xa914, "DisposWindow" },
+        { 0xa915, "ShowWindow" }, { 0xa916, "HideWindow" }, { 0xa91b, "MoveWindow" },
+        { 0xa91c, "HiliteWindow" }, { 0xa91d, "SizeWindow" }, { 0xa91f, "SelectWindow" },
+        { 0xa922, "BeginUpdate" }, { 0xa923, "EndUpdate" }, { 0xa924, "FrontWindow" },
+        { 0xa925, "DragWindow" }, { 0xa928, "InvalRect" }, { 0xa92c, "FindWindow" },
+        { 0xa92d, "CloseWindow" }, { 0xa930, "InitMenus" }, { 0xa937, "DrawMenuBar" },
+        { 0xa938, "HiliteMenu" }, { 0xa93d, "MenuSelect" }, { 0xa93e, "MenuKey" },
+        { 0xa970, "GetNextEvent" }, { 0xa971, "EventAvail" }, { 0xa972, "GetMouse" },
+        { 0xa973, "StillDown" }, { 0xa974, "Button" }, { 0xa975, "TickCount" },
+        { 0xa976, "GetKeys" }, { 0xa977, "WaitMouseUp" }, { 0xa97b, "InitDialogs" },
+        { 0xa97c, "GetNewDialog" }, { 0xa97d, "NewDialog" }, { 0xa980, "IsDialogEvent" },
+        { 0xa981, "DialogSelect" }, { 0xa982, "DrawDialog" }, { 0xa983, "CloseDialog" },
+        { 0xa984, "DisposDialog" }, { 0xa985, "Alert" }, { 0xa986, "StopAlert" },
+        { 0xa987, "NoteAlert" }, { 0xa988, "CautionAlert" }, { 0xa991, "ModalDialog" },
+        { 0xa994, "CurResFile" }, { 0xa995, "InitResources" }, { 0xa996, "RsrcZoneInit" },
+        { 0xa997, "OpenResFile" }, { 0xa998, "UseResFile" }, { 0xa999, "UpdateResFile" },
+        { 0xa99a, "CloseResFile" }, { 0xa99b, "SetResLoad" }, { 0xa99c, "CountResources" },
+        { 0xa99d, "GetIndResource" }, { 0xa99e, "CountTypes" }, { 0xa99f, "GetIndType" },
+        { 0xa9a0, "GetResource" }, { 0xa9a1, "GetNamedResource" }, { 0xa9a2, "LoadResource" },
+        { 0xa9a3, "ReleaseResource" }, { 0xa9a4, "HomeResFile" }, { 0xa9a5, "SizeRsrc" },
+        { 0xa9a6, "GetResAttrs" }, { 0xa9a8, "GetResInfo" }, { 0xa9aa, "ChangedResource" },
+        { 0xa9ab, "AddResource" }, { 0xa9ad, "RmveResource" }, { 0xa9af, "ResError" },
+        { 0xa9b0, "WriteResource" }, { 0xa9b2, "SystemEvent" }, { 0xa9b3, "SystemClick" },
+        { 0xa9b4, "SystemTask" }, { 0xa9b5, "SystemMenu" }, { 0xa9b6, "OpenDeskAcc" },
+        { 0xa9b7, "CloseDeskAcc" }, { 0xa9c6, "Secs2Date" }, { 0xa9c7, "Date2Secs" },
+        { 0xa9c8, "SysBeep" }, { 0xa9c9, "SysError" }, { 0xa9e7, "Pack0" },
+        { 0xa9e8, "Pack1" }, { 0xa9e9, "Pack2" }, { 0xa9ea, "Pack3" }, { 0xa9eb, "Pack4" },
+        { 0xa9ec, "Pack5" }, { 0xa9ed, "Pack6" }, { 0xa9ee, "Pack7" }, { 0xa9f0, "LoadSeg" },
+        { 0xa9f1, "UnloadSeg" }, { 0xa9f2, "Launch" }, { 0xa9f3, "Chain" },
+        { 0xa9f4, "ExitToShell" }, { 0xa9f5, "GetAppParms" }, { 0xa9ff, "Debugger" },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Interned names
+
+#define INTERN_BUCKETS  1024
+
+struct intern {
+        struct intern *next;
+        char name[];
+};
+
+static struct intern *intern_tab[INTERN_BUCKETS];
+
+static const char *intern(const char *name)
+{
+        unsigned int h = 5381;
+        for (const char *p = name; *p; p++)
+                h = h * 33 + (uint8_t)*p;
+        h %= INTERN_BUCKETS;
+
+        for (struct intern *i = intern_tab[h]; i; i = i->next)
+                if (!strcmp(i->name, name))
+                        return i->name;
+        struct intern *i = malloc(sizeof(*i) + strlen(name) + 1);
+        if (!i)
+                return NULL;
+        strcpy(i->name, name);
+        i->next = intern_tab[h];
+        intern_tab[h] = i;
+        return i->name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int      sym_cmp(const void *a, const void *b)
+{
+        const struct sym *sa = a, *sb = b;
+        return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+static void     symlist_add(struct symlist *l, uint32_t addr, const char *name)
+{
+        if (l->num == l->size) {
+                unsigned int n = l->size ? l->size * 2 : 256;
+                struct sym *s = realloc(l->syms, n * sizeof(*s));
+                if (!s)
+                        return;
+                l->syms = s;
+                l->size = n;
+        }
+        l->syms[l->num].addr = addr;
+        l->syms[l->num].name = name;
+        l->num++;
+}
+
+/* Index of the first symbol above addr: */
+static unsigned int symlist_above(struct symlist *l, uint32_t addr)
+{
+        unsigned int lo = 0, hi = l->num;
+
+        while (lo < hi) {
+                unsigned int mid = (lo + hi) / 2;
+                if (l->syms[mid].addr <= addr)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+/* Nearest symbol at or below addr, within max_dist: */
+static const char *symlist_find(struct symlist *l, uint32_t addr, uint32_t max_dist)
+{
+        unsigned int i = symlist_above(l, addr);
+
+        if (i == 0 || addr - l->syms[i - 1].addr > max_dist)
+                return NULL;
+        return l->syms[i - 1].name;
+}
+
+/* ROM addresses are normalised to the regular (non-overlay) mapping: */
+static uint32_t sym_norm(uint32_t addr)
+{
+        addr = ADR24(addr);
+        if (IS_ROM(addr))
+                return ROM_ADDR | (addr & (ROM_SIZE - 1));
+        return addr;
+}
+
+int     symtab_load(const char *path)
+{
+        FILE *f = fopen(path, "r");
+        char line[256], name[SYM_NAME_MAX];
+        unsigned int addr;
+        unsigned int n = 0;
+
+        if (!f) {
+                perror("Symbols");
+                return -1;
+        }
+        while (fgets(line, sizeof(line), f)) {
+                if (line[0] == '#' || sscanf(line, "%x %63s", &addr, name) != 2)
+                        continue;
+                if (addr < ROM_SIZE)
+                        addr |= ROM_ADDR;
+                symlist_add(&sym_map, ADR24(addr), intern(name));
+                n++;
+        }
+        fclose(f);
+        qsort(sym_map.syms, sym_map.num, sizeof(struct sym), sym_cmp);
+        printf("Symbols: %d from '%s'\n", n, path);
+        return 0;
+}
+
+const char      *symtab_trap_name(uint16_t trap)
+{
+        /* Drop the flag bits: */
+        uint16_t t = (trap & 0x0800) ? (trap & 0xfbff) : (trap & 0xf8ff);
+        unsigned int lo = 0, hi = sizeof(trap_names) / sizeof(trap_names[0]);
+
+        while (lo < hi) {
+                unsigned int mid = (lo + hi) / 2;
+                if (trap_names[mid].trap == t)
+                        return trap_names[mid].name;
+                if (trap_names[mid].trap < t)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return NULL;
+}
+
+static void     symtab_scan_table(uint32_t table, unsigned int num, uint16_t base)
+{
+        char buf[16];
+
+        for (unsigned int i = 0; i < num; i++) {
+                uint32_t a = ADR24(RAM_RD32(table + i * 4));
+                const char *n = symtab_trap_name(base + i);
+                if (!a || a >= ROM_ADDR + ROM_SIZE)
+                        continue;
+                if (!n) {
+                        snprintf(buf, sizeof(buf), "_%04X", base + i);
+                        n = buf;
+                }
+                symlist_add(&sym_traps, sym_norm(a), intern(n));
+        }
+}
+
+void    symtab_scan_traps(void)
+{
+        sym_traps.num = 0;
+        symtab_scan_table(OS_TRAP_TABLE, OS_TRAP_NUM, 0xa000);
+        symtab_scan_table(TB_TRAP_TABLE, TB_TRAP_NUM, 0xa800);
+        qsort(sym_traps.syms, sym_traps.num, sizeof(struct sym), sym_cmp);
+        YDBG("Symbols: %d trap entry points\n", sym_traps.num);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MacsBug symbols
+
+static uint8_t  sym_rd8(uint32_t a)
+{
+        return RAM_RD8(CLAMP_RAM_ADDR(a));
+}
+
+static int      sym_name_char(uint8_t c)
+{
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                c == '_' || c == '%' || c == '.' || c == ' ';
+}
+
+/* Decode a MacsBug name at a, into buf; returns 0 if there isn't one. */
+static int      macsbug_name(uint32_t a, char *buf)
+{
+        uint8_t b = sym_rd8(a);
+        unsigned int len, i;
+
+        if (b >= 0x80 && b <= 0x9f) {
+                /* Variable length: 0x80 | len, or 0x80 then len */
+                len = b & 0x1f;
+                a++;
+                if (!len)
+                        len = sym_rd8(a++);
+                if (!len || len >= SYM_NAME_MAX)
+                        return 0;
+                for (i = 0; i < len; i++) {
+                        buf[i] = sym_rd8(a + i);
+                        if (!sym_name_char(buf[i]) || buf[i] == ' ')
+                                return 0;
+                }
+        } else if (b > 0xa0) {
+                /* Fixed 8 (or 16, if the second char also has bit 7 set) */
+                len = (sym_rd8(a + 1) & 0x80) ? 16 : 8;
+                for (i = 0; i < len; i++) {
+                        buf[i] = sym_rd8(a + i) & ((i < 2) ? 0x7f : 0xff);
+                        if (!sym_name_char(buf[i]))
+                                return 0;
+                }
+                while (len && buf[len - 1] == ' ')
+                        len--;
+                if (!len || buf[0] == ' ')
+                        return 0;
+        } else {
+                return 0;
+        }
+        buf[len] = '\0';
+        return 1;
+}
+
+/* Scan forward for the end of the routine, stopping short of the next
+ * trap entry point (which must be another routine):
+ */
+static const char *macsbug_lookup(uint32_t addr)
+{
+        char buf[SYM_NAME_MAX];
+        uint32_t end = addr + SYM_MACSBUG_SCAN;
+        unsigned int i = symlist_above(&sym_traps, addr);
+
+        if (i < sym_traps.num && sym_traps.syms[i].addr < end)
+                end = sym_traps.syms[i].addr;
+        if (end > RAM_SIZE - 4)
+                end = RAM_SIZE - 4;
+        addr &= ~1;
+        for (uint32_t a = addr; a < end; a += 2) {
+                uint16_t op = (sym_rd8(a) << 8) | sym_rd8(a + 1);
+                uint32_t n;
+                if (op == 0x4e75 || op == 0x4ed0)       /* RTS, JMP (A0) */
+                        n = a + 2;
+                else if (op == 0x4e74)                  /* RTD #imm */
+                        n = a + 4;
+                else
+                        continue;
+                if (macsbug_name(n, buf))
+                        return intern(buf);
+        }
+        return NULL;
+}
+
+const char      *symtab_lookup(uint32_t addr)
+{
+        const char *n;
+
+        addr = sym_norm(addr);
+        n = symlist_find(&sym_map, addr, SYM_MAP_MAX_DIST);
+        if (!n && addr < RAM_SIZE)
+                n = macsbug_lookup(addr);
+        if (!n)
+                n = symlist_find(&sym_traps, addr, SYM_TRAP_MAX_DIST);
+        return n;
+}
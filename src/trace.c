@@ -0,0 +1,536 @@
+/* umac binary instruction trace
+ *
+ * Each traced instruction is a fixed-size record (cycle stamp, PC and
+ * the instruction's words), optionally followed by records for the
+ * memory writes it makes and the registers it changed.  Records go into a ring
+ * that's written out in large chunks, so tracing a whole boot costs
+ * little more than the memory traffic.  The CPU runs on one thread,
+ * so there's a single ring.
+ *
+ * When no trace is open, the per-instruction hook isn't called at all
+ * (see cpu_instr_hook in m68kconf.h).
+ *
+ * A trace can also be played back against a run, as a lockstep check
+ * of one build (or CPU engine) against another: the reference's
+ * records are read as the run goes, and the first instruction whose
+ * PC, words or (if recorded) registers or writes differ is reported.
+ * Writes are checked as they happen, so a bad store is caught at the
+ * instruction making it rather than whenever the value's next used.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machw.h"
+#include "m68k.h"
+#include "trace.h"
+
+#ifdef DEBUG
+#define TDBG(...)       printf(__VA_ARGS__)
+#else
+#define TDBG(...)       do {} while(0)
+#endif
+
+#define TERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#define TRACE_RING_RECS 16384           /* 384KB */
+#define TRACE_MAX_PC_RANGES 8
+
+int trace_active = 0;
+int trace_write_hook = 0;
+
+static FILE *trace_file;
+static struct trace_rec *trace_ring;
+static unsigned int trace_n;
+static uint64_t trace_total;
+
+/* Filters */
+static struct {
+        uint32_t lo, hi;
+} trace_pc[TRACE_MAX_PC_RANGES];
+static int trace_num_pc;
+static uint16_t trace_trap_lo, trace_trap_hi;
+static int trace_traps;
+static uint64_t trace_cyc_lo, trace_cyc_hi = UINT64_MAX;
+static int trace_regs;
+static uint32_t trace_last_regs[TRACE_NUM_REGS];
+static int trace_regs_first;
+static int trace_writes;
+static int trace_in_insn;               /* Current instruction was recorded */
+static uint64_t trace_insn_cycle;
+
+static int      check_write(uint32_t addr, int size, uint32_t value);
+static void     trace_update_write_hook(void);
+
+static void     trace_flush(void)
+{
+        if (trace_n && fwrite(trace_ring, sizeof(struct trace_rec), trace_n, trace_file) != trace_n)
+                TERR("Trace: write failed\n");
+        trace_n = 0;
+}
+
+static inline struct trace_rec *trace_rec_new(void)
+{
+        if (trace_n == TRACE_RING_RECS)
+                trace_flush();
+        trace_total++;
+        return &trace_ring[trace_n++];
+}
+
+/* Opcode fetch, without the faults a bad PC gets via the CPU: */
+static uint16_t trace_read16(uint32_t addr)
+{
+        if (IS_RAM(addr))
+                return RAM_RD16(CLAMP_RAM_ADDR(addr));
+        if (IS_ROM(addr))
+                return ROM_RD16(addr & (ROM_SIZE - 1));
+        return 0;
+}
+
+static uint32_t trace_reg(int i)
+{
+        return m68k_get_reg(NULL, (i < 16) ? (m68k_register_t)(M68K_REG_D0 + i) : M68K_REG_SR);
+}
+
+static void     trace_reg_deltas(uint64_t cycle)
+{
+        for (int i = 0; i < TRACE_NUM_REGS; i++) {
+                uint32_t v = trace_reg(i);
+                if (v != trace_last_regs[i] || trace_regs_first) {
+                        struct trace_rec *r = trace_rec_new();
+                        r->cycle = cycle;
+                        r->pc = v;
+                        r->type = TRACE_REC_REG;
+                        r->reg = i;
+                        trace_last_regs[i] = v;
+                }
+        }
+        trace_regs_first = 0;
+}
+
+void    trace_insn(uint32_t pc, uint64_t cycle)
+{
+        trace_in_insn = 0;
+        pc = ADR24(pc);
+        if (cycle < trace_cyc_lo)
+                return;
+        if (cycle > trace_cyc_hi) {
+                trace_close();
+                return;
+        }
+        if (trace_num_pc) {
+                int i;
+                for (i = 0; i < trace_num_pc; i++)
+                        if (pc >= trace_pc[i].lo && pc <= trace_pc[i].hi)
+                                break;
+                if (i == trace_num_pc)
+                        return;
+        }
+        uint16_t op = trace_read16(pc);
+        if (trace_traps && ((op & 0xf000) != 0xa000 ||
+                            op < trace_trap_lo || op > trace_trap_hi))
+                return;
+
+        /* Changes made by whatever ran since the last record: */
+        if (trace_regs)
+                trace_reg_deltas(cycle);
+
+        struct trace_rec *r = trace_rec_new();
+        r->cycle = cycle;
+        r->pc = pc;
+        r->type = TRACE_REC_INSN;
+        r->reg = 0;
+        r->words[0] = op;
+        for (int i = 1; i < TRACE_INSN_WORDS; i++)
+                r->words[i] = trace_read16(pc + i * 2);
+        trace_in_insn = 1;
+        trace_insn_cycle = cycle;
+}
+
+static void     trace_rec_write(uint32_t addr, int size, uint32_t value)
+{
+        struct trace_rec *r = trace_rec_new();
+        r->cycle = trace_insn_cycle;
+        r->pc = value;
+        r->type = TRACE_REC_WRITE;
+        r->reg = size;
+        r->words[0] = addr >> 16;
+        r->words[1] = addr & 0xffff;
+        for (int i = 2; i < TRACE_INSN_WORDS; i++)
+                r->words[i] = 0;
+}
+
+int     trace_write(uint32_t addr, int size, uint32_t value)
+{
+        addr = ADR24(addr);
+        if (size < 4)
+                value &= (1U << (size * 8)) - 1;
+        if (trace_active && trace_writes && trace_in_insn)
+                trace_rec_write(addr, size, value);
+        if (trace_check_active)
+                return check_write(addr, size, value);
+        return 0;
+}
+
+static int      trace_parse_range(const char *s, int base, uint64_t *lo, uint64_t *hi)
+{
+        char *e;
+
+        *lo = strtoull(s, &e, base);
+        if (e == s)
+                return -1;
+        if (*e == '-') {
+                s = e + 1;
+                *hi = strtoull(s, &e, base);
+                if (e == s)
+                        return -1;
+        } else {
+                *hi = *lo;
+        }
+        return (*e == '\0' && *lo <= *hi) ? 0 : -1;
+}
+
+int     trace_open(const char *spec)
+{
+        char *s = strdup(spec);
+        char *opt, *next;
+        struct trace_hdr h;
+
+        if (!s)
+                return -1;
+        trace_close();
+        trace_num_pc = 0;
+        trace_traps = 0;
+        trace_regs = 0;
+        trace_writes = 0;
+        trace_cyc_lo = 0;
+        trace_cyc_hi = UINT64_MAX;
+
+        opt = strchr(s, ',');
+        if (opt)
+                *opt++ = '\0';
+        for (; opt; opt = next) {
+                uint64_t lo, hi;
+
+                next = strchr(opt, ',');
+                if (next)
+                        *next++ = '\0';
+                if (!strncmp(opt, "pc=", 3) && trace_num_pc < TRACE_MAX_PC_RANGES &&
+                    !trace_parse_range(opt + 3, 16, &lo, &hi)) {
+                        trace_pc[trace_num_pc].lo = ADR24(lo);
+                        trace_pc[trace_num_pc].hi = ADR24(hi);
+                        trace_num_pc++;
+                } else if (!strncmp(opt, "trap=", 5) && !trace_parse_range(opt + 5, 16, &lo, &hi)) {
+                        trace_trap_lo = lo;
+                        trace_trap_hi = hi;
+                        trace_traps = 1;
+                } else if (!strncmp(opt, "cycles=", 7) &&
+                           !trace_parse_range(opt + 7, 10, &trace_cyc_lo, &trace_cyc_hi)) {
+                        /* OK */
+                } else if (!strcmp(opt, "regs")) {
+                        trace_regs = 1;
+                } else if (!strcmp(opt, "writes")) {
+                        trace_writes = 1;
+                } else {
+                        TERR("Trace: bad option '%s'\n", opt);
+                        free(s);
+                        return -1;
+                }
+        }
+
+        trace_ring = malloc(TRACE_RING_RECS * sizeof(struct trace_rec));
+        trace_file = fopen(s, "wb");
+        if (!trace_ring || !trace_file) {
+                perror("Trace");
+                free(trace_ring);
+                trace_ring = NULL;
+                if (trace_file)
+                        fclose(trace_file);
+                trace_file = NULL;
+                free(s);
+                return -1;
+        }
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+        h.rec_size = sizeof(struct trace_rec);
+        h.flags = (trace_regs ? TRACE_F_REGS : 0) | (trace_writes ? TRACE_F_WRITES : 0);
+        if (trace_num_pc || trace_traps || trace_cyc_lo || trace_cyc_hi != UINT64_MAX)
+                h.flags |= TRACE_F_FILTERED;
+        fwrite(&h, sizeof(h), 1, trace_file);
+
+        /* The first instruction's records give every register's value: */
+        trace_regs_first = 1;
+        trace_n = 0;
+        trace_total = 0;
+        trace_in_insn = 0;
+        trace_active = 1;
+        trace_update_write_hook();
+        printf("Tracing to '%s'\n", s);
+        free(s);
+        return 0;
+}
+
+void    trace_close(void)
+{
+        if (!trace_file)
+                return;
+        trace_flush();
+        fclose(trace_file);
+        trace_file = NULL;
+        free(trace_ring);
+        trace_ring = NULL;
+        trace_active = 0;
+        trace_update_write_hook();
+        printf("Trace: %lld records\n", (long long)trace_total);
+}
+
+/**********************************************************************/
+// Lockstep check
+
+int trace_check_active = 0;
+
+static FILE *check_file;
+static struct trace_rec *check_ring;
+static unsigned int check_n, check_pos;
+static int check_regs, check_writes;
+static uint32_t check_expect[TRACE_NUM_REGS];
+static uint64_t check_insns;
+static uint32_t check_last_pc;
+static uint64_t check_last_cycle;
+
+static const char *check_reg_names[TRACE_NUM_REGS] = {
+        "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+        "A0", "A1", "A2", "A3", "A4", "A5", "A6", "A7", "SR",
+};
+
+static struct trace_rec *check_next(void)
+{
+        if (check_pos == check_n) {
+                check_n = fread(check_ring, sizeof(struct trace_rec), TRACE_RING_RECS, check_file);
+                check_pos = 0;
+                if (!check_n)
+                        return NULL;
+        }
+        return &check_ring[check_pos++];
+}
+
+/* Disassemble words (e.g. the reference's) as the instruction at pc: */
+static const char *check_dasm(char *buf, uint32_t pc, const uint16_t *words)
+{
+        uint8_t op[16] = {0};
+
+        for (int i = 0; i < TRACE_INSN_WORDS; i++) {
+                op[i * 2] = words[i] >> 8;
+                op[i * 2 + 1] = words[i] & 0xff;
+        }
+        m68k_disassemble_raw(buf, pc, op, NULL, M68K_CPU_TYPE_68000);
+        return buf;
+}
+
+/* The run's instruction at pc: */
+static const char *check_dasm_run(char *buf, uint32_t pc)
+{
+        uint16_t words[TRACE_INSN_WORDS];
+
+        for (int i = 0; i < TRACE_INSN_WORDS; i++)
+                words[i] = trace_read16(pc + i * 2);
+        return check_dasm(buf, pc, words);
+}
+
+static uint32_t check_rec_addr(const struct trace_rec *r)
+{
+        return ((uint32_t)r->words[0] << 16) | r->words[1];
+}
+
+static void     check_write_diverged(void)
+{
+        char buf[100];
+
+        TERR("Lockstep: diverged at a write, after %lld instructions, at cycle %lld\n",
+             (long long)check_insns, (long long)check_last_cycle);
+        TERR("  At    %06x: %s\n", check_last_pc, check_dasm_run(buf, check_last_pc));
+}
+
+/* Called for each write the run makes, which must be the reference's
+ * next record:
+ */
+static int      check_write(uint32_t addr, int size, uint32_t value)
+{
+        struct trace_rec *r;
+
+        if (!check_file || !check_writes)
+                return 0;
+        r = check_next();
+        if (!r) {
+                printf("Lockstep: end of reference trace, %lld instructions matched\n",
+                       (long long)check_insns);
+                trace_check_close();
+                return 0;
+        }
+        if (r->type == TRACE_REC_WRITE && r->reg == size &&
+            check_rec_addr(r) == addr && r->pc == value)
+                return 0;
+
+        check_write_diverged();
+        TERR("  Run wrote %d bytes %0*x to %06x\n", size, size * 2, value, addr);
+        if (r->type == TRACE_REC_WRITE)
+                TERR("  reference wrote %d bytes %0*x to %06x\n",
+                     r->reg, r->reg * 2, r->pc, check_rec_addr(r));
+        else
+                TERR("  reference made no (further) write\n");
+        trace_check_close();
+        return -1;
+}
+
+int     trace_check_insn(uint32_t pc, uint64_t cycle)
+{
+        struct trace_rec *r;
+        char buf[100];
+        int diff = 0;
+
+        if (!check_file)
+                return 0;
+        pc = ADR24(pc);
+        /* The reference's register changes up to this instruction; any
+         * write left over is one the previous instruction didn't make:
+         */
+        while ((r = check_next()) && r->type != TRACE_REC_INSN) {
+                if (r->type == TRACE_REC_REG && r->reg < TRACE_NUM_REGS) {
+                        check_expect[r->reg] = r->pc;
+                } else if (r->type == TRACE_REC_WRITE) {
+                        check_write_diverged();
+                        TERR("  Run made no (further) write\n");
+                        TERR("  reference wrote %d bytes %0*x to %06x\n",
+                             r->reg, r->reg * 2, r->pc, check_rec_addr(r));
+                        trace_check_close();
+                        return -1;
+                }
+        }
+        if (!r) {
+                printf("Lockstep: end of reference trace, %lld instructions matched\n",
+                       (long long)check_insns);
+                trace_check_close();
+                return 0;
+        }
+
+        if (r->pc != pc)
+                diff = 1;
+        for (int i = 0; i < TRACE_INSN_WORDS; i++)
+                if (trace_read16(pc + i * 2) != r->words[i])
+                        diff = 1;
+        if (check_regs)
+                for (int i = 0; i < TRACE_NUM_REGS; i++)
+                        if (trace_reg(i) != check_expect[i])
+                                diff = 1;
+        if (!diff) {
+                check_insns++;
+                check_last_pc = pc;
+                check_last_cycle = cycle;
+                return 0;
+        }
+
+        TERR("Lockstep: diverged after %lld instructions, at cycle %lld (reference %lld)\n",
+             (long long)check_insns, (long long)cycle, (long long)r->cycle);
+        TERR("  PC    %06x, reference %06x\n", pc, r->pc);
+        TERR("  Words");
+        for (int i = 0; i < TRACE_INSN_WORDS; i++)
+                TERR(" %04x", trace_read16(pc + i * 2));
+        TERR(", reference");
+        for (int i = 0; i < TRACE_INSN_WORDS; i++)
+                TERR(" %04x", r->words[i]);
+        TERR("\n");
+        TERR("  Run:       %s\n", check_dasm_run(buf, pc));
+        TERR("  Reference: %s\n", check_dasm(buf, r->pc, r->words));
+        for (int i = 0; check_regs && i < TRACE_NUM_REGS; i++) {
+                uint32_t v = trace_reg(i);
+                if (v != check_expect[i])
+                        TERR("  %-5s %08x, reference %08x\n", check_reg_names[i], v, check_expect[i]);
+        }
+        trace_check_close();
+        return -1;
+}
+
+int     trace_check_open(const char *path)
+{
+        struct trace_hdr h;
+
+        trace_check_close();
+        check_file = fopen(path, "rb");
+        if (!check_file) {
+                perror("Lockstep trace");
+                return -1;
+        }
+        if (fread(&h, sizeof(h), 1, check_file) != 1 ||
+            memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+            h.rec_size != sizeof(struct trace_rec)) {
+                TERR("Lockstep: '%s' isn't a trace\n", path);
+                goto fail;
+        }
+        if (h.flags & TRACE_F_FILTERED) {
+                TERR("Lockstep: '%s' is filtered; record the reference without filters\n", path);
+                goto fail;
+        }
+        check_ring = malloc(TRACE_RING_RECS * sizeof(struct trace_rec));
+        if (!check_ring)
+                goto fail;
+        check_regs = !!(h.flags & TRACE_F_REGS);
+        check_writes = !!(h.flags & TRACE_F_WRITES);
+        check_n = check_pos = 0;
+        check_insns = 0;
+        check_last_pc = 0;
+        check_last_cycle = 0;
+        memset(check_expect, 0, sizeof(check_expect));
+        trace_check_active = 1;
+        trace_update_write_hook();
+        printf("Lockstep: checking against '%s'%s%s\n", path,
+               check_regs ? ", with registers" : "", check_writes ? ", with writes" : "");
+        if (!check_writes)
+                printf("Lockstep: reference has no writes (record it with 'writes'), so they're not checked\n");
+        return 0;
+
+fail:
+        fclose(check_file);
+        check_file = NULL;
+        return -1;
+}
+
+void    trace_check_close(void)
+{
+        if (!check_file)
+                return;
+        fclose(check_file);
+        check_file = NULL;
+        free(check_ring);
+        check_ring = NULL;
+        trace_check_active = 0;
+        trace_update_write_hook();
+}
+
+static void     trace_update_write_hook(void)
+{
+        trace_write_hook = (trace_active && trace_writes) ||
+                (trace_check_active && check_writes);
+}
@@ -0,0 +1,239 @@
+/* umac A-line trap profiler
+ *
+ * The instruction hook spots A-line opcodes as they're about to trap,
+ * and pushes the call's return address onto a shadow stack.  When
+ * execution reaches a pending return address (with the stack no deeper
+ * than at the call) the call's complete, and its cycles are charged
+ * to the trap.  Calls that never return (e.g. ExitToShell, or a
+ * longjmp out of a trap) are unwound when an outer call returns.
+ *
+ * Toolbox traps with the auto-pop bit are reached via glue that's
+ * JSRed to, so return to the glue's caller.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machw.h"
+#include "m68k.h"
+#include "symtab.h"
+#include "report.h"
+#include "trapprof.h"
+
+#ifdef DEBUG
+#define TPDBG(...)      printf(__VA_ARGS__)
+#else
+#define TPDBG(...)      do {} while(0)
+#endif
+
+#define TPERR(...)      fprintf(stderr, __VA_ARGS__)
+
+#define TP_DEPTH        64
+#define TP_TOP          30
+/* Stats index: OS traps by bits [7:0], Toolbox traps by bits [9:0] */
+#define TP_NUM_OS       256
+#define TP_NUM          (TP_NUM_OS + 1024)
+
+struct tp_call {
+        uint32_t ret;
+        uint32_t sp;
+        uint64_t start;
+        uint16_t idx;
+};
+
+struct tp_stat {
+        uint64_t calls;
+        uint64_t cycles;
+        uint64_t unreturned;
+};
+
+int trapprof_active = 0;
+
+static FILE *tp_file;
+static struct tp_stat *tp_stats;
+static struct tp_call tp_stack[TP_DEPTH];
+static unsigned int tp_depth;
+static uint64_t tp_first_cycle, tp_last_cycle;
+static uint64_t tp_overflows;
+
+static uint16_t tp_read16(uint32_t addr)
+{
+        if (IS_RAM(addr))
+                return RAM_RD16(CLAMP_RAM_ADDR(addr));
+        if (IS_ROM(addr))
+                return ROM_RD16(addr & (ROM_SIZE - 1));
+        return 0;
+}
+
+static uint32_t tp_read32(uint32_t addr)
+{
+        return ((uint32_t)tp_read16(addr) << 16) | tp_read16(addr + 2);
+}
+
+static uint16_t tp_trap_word(unsigned int idx)
+{
+        return (idx < TP_NUM_OS) ? (0xa000 | idx) : (0xa800 | (idx - TP_NUM_OS));
+}
+
+/* Pop calls down to (and including) entry i; the ones above it never returned: */
+static void     tp_return(unsigned int i, uint64_t cycle)
+{
+        while (tp_depth > i) {
+                struct tp_call *c = &tp_stack[--tp_depth];
+                tp_stats[c->idx].cycles += cycle - c->start;
+                if (tp_depth != i)
+                        tp_stats[c->idx].unreturned++;
+        }
+}
+
+void    trapprof_insn(uint32_t pc, uint64_t cycle)
+{
+        pc = ADR24(pc);
+        tp_last_cycle = cycle;
+
+        for (int i = tp_depth - 1; i >= 0; i--) {
+                if (tp_stack[i].ret == pc &&
+                    ADR24(m68k_get_reg(NULL, M68K_REG_A7)) >= tp_stack[i].sp) {
+                        tp_return(i, cycle);
+                        break;
+                }
+        }
+
+        uint16_t op = tp_read16(pc);
+        if ((op & 0xf000) != 0xa000)
+                return;
+
+        unsigned int idx = (op & 0x0800) ? TP_NUM_OS + (op & 0x3ff) : (op & 0xff);
+        tp_stats[idx].calls++;
+        if (tp_depth == TP_DEPTH) {
+                tp_overflows++;
+                return;
+        }
+        struct tp_call *c = &tp_stack[tp_depth++];
+        c->idx = idx;
+        c->start = cycle;
+        c->sp = ADR24(m68k_get_reg(NULL, M68K_REG_A7));
+        c->ret = pc + 2;
+        if ((op & 0x0c00) == 0x0c00) {
+                /* Auto-pop: return to the glue's caller */
+                c->ret = ADR24(tp_read32(c->sp));
+                c->sp += 4;
+        }
+}
+
+static int      tp_cmp_cycles(const void *a, const void *b)
+{
+        const struct tp_stat *sa = &tp_stats[*(const uint16_t *)a];
+        const struct tp_stat *sb = &tp_stats[*(const uint16_t *)b];
+        return (sa->cycles < sb->cycles) - (sa->cycles > sb->cycles);
+}
+
+static int      tp_cmp_calls(const void *a, const void *b)
+{
+        const struct tp_stat *sa = &tp_stats[*(const uint16_t *)a];
+        const struct tp_stat *sb = &tp_stats[*(const uint16_t *)b];
+        return (sa->calls < sb->calls) - (sa->calls > sb->calls);
+}
+
+static void     tp_report_list(FILE *f, const uint16_t *order, unsigned int n, double total)
+{
+        fprintf(f, "  %14s %6s %10s %10s  %s\n", "Cycles", "%", "Calls", "Avg", "Trap");
+        for (unsigned int i = 0; i < n && i < TP_TOP; i++) {
+                const struct tp_stat *s = &tp_stats[order[i]];
+                uint16_t word = tp_trap_word(order[i]);
+                const char *name = symtab_trap_name(word);
+                fprintf(f, "  %14lld %6.2f %10lld %10lld  %04X %s",
+                        (long long)s->cycles, 100.0 * s->cycles / total,
+                        (long long)s->calls, (long long)(s->calls ? s->cycles / s->calls : 0),
+                        word, name ? name : "");
+                if (s->unreturned)
+                        fprintf(f, " (%lld unreturned)", (long long)s->unreturned);
+                fprintf(f, "\n");
+        }
+}
+
+void    trapprof_report(FILE *f)
+{
+        uint16_t order[TP_NUM];
+        unsigned int n = 0;
+        uint64_t calls = 0;
+        double total;
+
+        if (!tp_stats)
+                return;
+        for (unsigned int i = 0; i < TP_NUM; i++) {
+                if (!tp_stats[i].calls)
+                        continue;
+                calls += tp_stats[i].calls;
+                order[n++] = i;
+        }
+        total = (tp_last_cycle > tp_first_cycle) ? (double)(tp_last_cycle - tp_first_cycle) : 1.0;
+        fprintf(f, "Trap profile: %lld calls to %d traps over %lld cycles",
+                (long long)calls, n, (long long)(tp_last_cycle - tp_first_cycle));
+        if (tp_depth)
+                fprintf(f, ", %d in progress", tp_depth);
+        if (tp_overflows)
+                fprintf(f, ", %lld too deeply nested to time", (long long)tp_overflows);
+        fprintf(f, "\nBy inclusive time:\n");
+        qsort(order, n, sizeof(order[0]), tp_cmp_cycles);
+        tp_report_list(f, order, n, total);
+        fprintf(f, "By calls:\n");
+        qsort(order, n, sizeof(order[0]), tp_cmp_calls);
+        tp_report_list(f, order, n, total);
+        fflush(f);
+}
+
+int     trapprof_open(const char *spec)
+{
+        trapprof_close();
+        tp_file = report_open(spec, "Trap profile");
+        if (!tp_file)
+                return -1;
+        tp_stats = calloc(TP_NUM, sizeof(struct tp_stat));
+        if (!tp_stats) {
+                perror("Trap profile");
+                report_close(tp_file);
+                tp_file = NULL;
+                return -1;
+        }
+        tp_depth = 0;
+        tp_overflows = 0;
+        tp_first_cycle = tp_last_cycle = 0;
+        trapprof_active = 1;
+        return 0;
+}
+
+void    trapprof_close(void)
+{
+        if (!tp_file)
+                return;
+        trapprof_active = 0;
+        trapprof_report(tp_file);
+        report_close(tp_file);
+        tp_file = NULL;
+        free(tp_stats);
+        tp_stats = NULL;
+}
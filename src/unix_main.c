@@ -29,8 +29,10 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -45,6 +47,23 @@
 #include "umac.h"
 #include "machw.h"
 #include "disc.h"
+#include "disc_wb.h"
+#include "dstore.h"
+#include "resample.h"
+#include "wavcap.h"
+#include "scc.h"
+#include "serbridge.h"
+#include "ltalk.h"
+#include "trace.h"
+#include "prof.h"
+#include "symtab.h"
+#include "trapprof.h"
+#include "memheat.h"
+#include "latency.h"
+#include "frametime.h"
+#include "metrics.h"
+#include "hud.h"
+#include "log.h"
 
 #include "keymap_sdl.h"
 
@@ -55,12 +74,54 @@ static void     print_help(char *n)
                "\t-W <rom dump path>\tDump ROM after patching\n"
                "\t-d <disc path>\n"
                "\t-w\t\t\tEnable persistent disc writes (default R/O)\n"
+               "\t-F <policy>\t\tDisc write-back policy for -w: none, eject, sync,\n"
+               "\t\t\t\tperiodic:<ms> or group:<ms> (default group:500)\n"
+               "\t-P <profile>\t\tDisc boot profile: prefetch from, and update\n"
+               "\t-S <pool>\t\tDisc path is a map into this dedup pool\n"
+               "\t-s <a|b>:<pty|socket>\tBridge serial port A (modem) or B (printer)\n"
+               "\t\t\t\tto a new PTY or UNIX socket; add ',fast' to\n"
+               "\t\t\t\tignore the baud rate\n"
+               "\t-L <hub socket>\t\tConnect printer port to a LocalTalk hub (lthub)\n"
+#if ENABLE_AUDIO
+               "\t-a <wav path>\t\tCapture sound output to a WAV file\n"
+               "\t-q\t\t\tDon't open an audio device\n"
+#endif
+               "\t-t <file>[,<filters>]\tBinary instruction trace, for tools/tracedump;\n"
+               "\t\t\t\tfilters are pc=<lo>-<hi>, trap=<lo>[-<hi>],\n"
+               "\t\t\t\tcycles=<from>-<to>, regs, writes\n"
+               "\t-C <file>\t\tLockstep check against an unfiltered trace from -t\n"
+               "\t-D\t\t\tTime frames from emulated, not host, time, so\n"
+               "\t\t\t\truns without input are repeatable\n"
+               "\t-p <file|->[,interval=N][,stacks]\n"
+               "\t\t\t\tSample guest PCs (and call stacks) every N\n"
+               "\t\t\t\tcycles, and write a profile at exit\n"
+               "\t-T <file|->\t\tCount A-line trap calls and time, and write a\n"
+               "\t\t\t\tprofile at exit\n"
+               "\t-f <file|->\t\tTime each frame's phases (CPU, disc, display),\n"
+               "\t\t\t\tand write histograms at exit\n"
+               "\t-I <file|->\t\tTime input events through to the screen, and\n"
+               "\t\t\t\twrite latency histograms at exit\n"
+#if ENABLE_MEMHEAT
+               "\t-H <file|->\t\tWrite a heatmap of guest memory accesses at exit\n"
+#endif
+               "\t-l <cat>=<level>[,...]\tLog levels: cat is main, mem, via, scc, disc,\n"
+               "\t\t\t\tkbd or all; level is off, error, warn, info\n"
+               "\t\t\t\tor debug (default warn)\n"
+               "\t-M <socket>\t\tServe metrics on a UNIX socket\n"
+               "\t-Y <map>\t\tSymbol names for profiles (\"<hex addr> <name>\")\n"
                "\t-i\t\t\tDisassembled instruction trace\n", n);
 }
 
 #define DISP_SCALE      (DISP_WIDTH < 800 && DISP_HEIGHT < 600 ? 2 : 1)
 
 static uint32_t framebuffer[DISP_WIDTH*DISP_HEIGHT];
+/* The Mac's current screen buffer, which changes on a page flip: */
+static uint8_t *fb_base;
+
+static void     fb_changed(unsigned int offset)
+{
+        fb_base = ram_get_base() + offset;
+}
 
 /* Blit a 1bpp FB to a 32BPP RGBA output.  SDL2 doesn't appear to support
  * bitmap/1bpp textures, so expand.
@@ -82,42 +143,511 @@ static void     copy_fb(uint32_t *fb_out, uint8_t *fb_in)
         }
 }
 
+/* The Mac's video frame (and sound buffer) rate is 60.15Hz */
+#define VSYNC_PERIOD_US 16626
+
 #if ENABLE_AUDIO
-// audio_callback is called from a thread, so pending_v_retrace can't be a regular variable
-atomic_int pending_v_retrace;
+/* Sound: the emulator produces a block of samples each time the Mac
+ * plays a frame from its sound buffer (umac_audio_frame(), on the
+ * emulator thread)
+ * and the SDL audio callback (on its own thread) consumes them.  They
+ * are decoupled by a single-producer/single-consumer ring of blocks:
+ * wr is only written by the producer, rd by the consumer, and both
+ * are free-running counters.  If the producer gets too far ahead, a
+ * block's dropped (overrun); if the consumer finds the ring empty, it
+ * plays silence (underrun).  Neither affects video timing.
+ *
+ * The consumer resamples from the Mac's rate to the device's native
+ * rate.  The emulator's notion of time drifts from the wall clock (and
+ * the device's), which shows up as the ring slowly filling or
+ * draining: the resampling ratio is nudged to hold the fill level
+ * around AUDIO_RING_TARGET.
+ */
+#define AUDIO_BLK_SAMPLES       370
+#define AUDIO_RING_BLKS         8       /* Power of 2 */
+#define AUDIO_RING_TARGET       2.0
+#define AUDIO_MAC_RATE          22254.545       /* 15.6672MHz/704 */
+#define AUDIO_HOST_RATE         48000
+#define AUDIO_MAX_ADJUST        0.005
+
 static int volscale;
-uint8_t *audio_base;
 
-int16_t audio[370];
+static int16_t audio_ring[AUDIO_RING_BLKS][AUDIO_BLK_SAMPLES];
+static atomic_uint audio_ring_wr;
+static atomic_uint audio_ring_rd;
+static atomic_uint audio_underruns;
+static atomic_uint audio_overruns;
+static resampler_t *audio_rs;
+static double audio_adjust = 1.0;
+
+/* Capture, independent of the audio device (if any): */
+static wavcap_t *audio_wav;
+static int audio_volume, audio_sndres;
 
 void umac_audio_cfg(int umac_volume, int umac_sndres) {
         volscale = umac_sndres ? 0 : 65536 * umac_volume / 7;
+        audio_volume = umac_volume;
+        audio_sndres = umac_sndres;
 }
 
-void umac_audio_trap() {
+void umac_audio_frame(void) {
     int32_t  offset = 128;
-    uint16_t *audiodata = (uint16_t*)audio_base;
+    uint8_t *buf = ram_get_base() + umac_get_audio_offset();
+    uint16_t *audiodata = (uint16_t*)buf;
     int scale = volscale;
-    if (!scale) {
-        memset(audio, 0, sizeof(audio));
+    /* Captured as it's played, from whichever buffer that is: */
+    if (audio_wav)
+        wavcap_frame(audio_wav, buf, AUDIO_BLK_SAMPLES, audio_volume, audio_sndres);
+    if (!audio_rs)              /* No device */
+        return;
+    unsigned int wr = atomic_load_explicit(&audio_ring_wr, memory_order_relaxed);
+    unsigned int rd = atomic_load_explicit(&audio_ring_rd, memory_order_acquire);
+    if ((wr - rd) >= AUDIO_RING_BLKS) {
+        atomic_fetch_add_explicit(&audio_overruns, 1, memory_order_relaxed);
         return;
     }
-    int16_t *stream = audio;
-    for(int i=0; i<370; i++) {
-        int32_t a = (*audiodata++ & 0xff) - offset;
-        a = (a * scale) >> 8;
-        *stream++ = a;
+    int16_t *stream = audio_ring[wr % AUDIO_RING_BLKS];
+    if (!scale) {
+        memset(stream, 0, AUDIO_BLK_SAMPLES * sizeof(int16_t));
+    } else {
+        for(int i=0; i<AUDIO_BLK_SAMPLES; i++) {
+            int32_t a = (*audiodata++ & 0xff) - offset;
+            a = (a * scale) >> 8;
+            *stream++ = a;
+        }
     }
+    atomic_store_explicit(&audio_ring_wr, wr + 1, memory_order_release);
 }
 
 static void audio_callback(void *userdata, Uint8 *stream_in, int len_bytes) {
         (void) userdata;
-        assert(len_bytes == sizeof(audio));
-        atomic_store(&pending_v_retrace, 1);
-        memcpy(stream_in, audio, sizeof(audio));
+        int16_t *out = (int16_t *)stream_in;
+        unsigned int n = len_bytes / sizeof(int16_t);
+        unsigned int rd = atomic_load_explicit(&audio_ring_rd, memory_order_relaxed);
+        unsigned int wr = rd;
+
+        while (n) {
+                unsigned int g = resampler_pull(audio_rs, out, n);
+                out += g;
+                n -= g;
+                if (!n)
+                        break;
+                /* Resampler needs more input: */
+                wr = atomic_load_explicit(&audio_ring_wr, memory_order_acquire);
+                if (rd == wr) {
+                        if (rd)         /* Not counted before the first block */
+                                atomic_fetch_add_explicit(&audio_underruns, 1, memory_order_relaxed);
+                        memset(out, 0, n * sizeof(int16_t));
+                        break;
+                }
+                resampler_push(audio_rs, audio_ring[rd % AUDIO_RING_BLKS], AUDIO_BLK_SAMPLES);
+                atomic_store_explicit(&audio_ring_rd, ++rd, memory_order_release);
+        }
+
+        /* Drift compensation: proportional to fill error, smoothed */
+        wr = atomic_load_explicit(&audio_ring_wr, memory_order_acquire);
+        double adj = 1.0 + ((double)(wr - rd) - AUDIO_RING_TARGET) * 0.001;
+        if (adj > 1.0 + AUDIO_MAX_ADJUST)
+                adj = 1.0 + AUDIO_MAX_ADJUST;
+        else if (adj < 1.0 - AUDIO_MAX_ADJUST)
+                adj = 1.0 - AUDIO_MAX_ADJUST;
+        audio_adjust += (adj - audio_adjust) * 0.05;
+        resampler_set_adjust(audio_rs, audio_adjust);
+}
+
+/* Open the default device, creating the resampler for its rate.
+ * Returns 0 on failure.
+ */
+static SDL_AudioDeviceID        audio_open(void)
+{
+        SDL_AudioSpec desired, obtained;
+        SDL_AudioDeviceID dev;
+
+        SDL_zero(desired);
+        /* Take the device's own rate/buffer size if it differs; we
+         * resample to that.
+         */
+        desired.freq = AUDIO_HOST_RATE;
+        desired.channels = 1;
+        desired.samples = 512;
+        desired.userdata = NULL;
+        desired.callback = audio_callback;
+        desired.format = AUDIO_S16SYS;
+
+        dev = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained,
+                                  SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                                  SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+        if (!dev) {
+                char buf[500];
+                SDL_GetErrorMsg(buf, sizeof(buf));
+                printf("SDL audio_deviceSDL_GetError() -> %s\n", buf);
+                return 0;
+        }
+        audio_rs = resampler_new(AUDIO_MAC_RATE, obtained.freq);
+        if (!audio_rs) {
+                printf("Can't create resampler!\n");
+                SDL_CloseAudioDevice(dev);
+                return 0;
+        }
+        printf("Audio: %dHz, %d sample buffer\n", obtained.freq, obtained.samples);
+        return dev;
+}
+
+/* Number of blocks queued, and under/overrun counts: */
+static void     audio_get_stats(unsigned int *fill, unsigned int *underruns, unsigned int *overruns)
+{
+        *fill = atomic_load(&audio_ring_wr) - atomic_load(&audio_ring_rd);
+        *underruns = atomic_load(&audio_underruns);
+        *overruns = atomic_load(&audio_overruns);
+}
+
+static void     exit_audio_stats(void)
+{
+        unsigned int fill, under, over;
+        audio_get_stats(&fill, &under, &over);
+        printf("Audio: %d underruns, %d overruns\n", under, over);
+}
+
+static void     exit_audio_capture(void)
+{
+        wavcap_close(audio_wav);
+        audio_wav = NULL;
 }
 #endif
 
+/**********************************************************************/
+// Disc boot profile: a text file of "offset length" extents, in the
+// order they were first read.
+
+#define DISC_PROFILE_MAGIC      "umac-disc-profile 1"
+#define DISC_PROFILE_MAX        65536
+
+static char *disc_profile_filename = NULL;
+static uint8_t *disc_map_base = NULL;
+
+/* ctx isn't used, as it might belong to the write-back code */
+static void     disc_prefetch_mapped(void *ctx, unsigned int offset, unsigned int len)
+{
+        uint8_t *base = disc_map_base;
+        (void)ctx;
+        uintptr_t pg = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)(base + offset) & ~(pg - 1);
+        uintptr_t end = ((uintptr_t)(base + offset + len) + pg - 1) & ~(pg - 1);
+        madvise((void *)start, end - start, MADV_WILLNEED);
+}
+
+static void     disc_profile_load(const char *filename)
+{
+        FILE *f = fopen(filename, "r");
+        char line[64];
+        if (!f)
+                return;         /* None yet; this run will make one */
+
+        disc_extent_t *ext = malloc(DISC_PROFILE_MAX * sizeof(disc_extent_t));
+        unsigned int n = 0;
+        if (ext && fgets(line, sizeof(line), f) &&
+            !strncmp(line, DISC_PROFILE_MAGIC, strlen(DISC_PROFILE_MAGIC))) {
+                while (n < DISC_PROFILE_MAX &&
+                       fscanf(f, "%" SCNx32 " %" SCNx32, &ext[n].offset, &ext[n].len) == 2)
+                        n++;
+        }
+        fclose(f);
+        printf("Disc profile: replaying %d extents from '%s'\n", n, filename);
+        disc_profile_replay(0, ext, n);
+        free(ext);
+}
+
+static void     exit_disc_profile_save(void)
+{
+        const disc_extent_t *ext;
+        int n = disc_profile_get(0, &ext);
+        FILE *f;
+
+        if (n <= 0 || !(f = fopen(disc_profile_filename, "w")))
+                return;
+        fprintf(f, DISC_PROFILE_MAGIC "\n");
+        for (int i = 0; i < n; i++)
+                fprintf(f, "%" PRIx32 " %" PRIx32 "\n", ext[i].offset, ext[i].len);
+        fclose(f);
+}
+
+/**********************************************************************/
+
+static disc_wb_t *disc_wb = NULL;
+
+/* Also reached via exit() when the guest ejects the disc: */
+static void     exit_disc_commit(void)
+{
+        disc_wb_close(disc_wb);
+        disc_wb = NULL;
+}
+
+static dstore_t *disc_ds = NULL;
+
+/* Syncs a persistent overlay: */
+static void     exit_disc_store_close(void)
+{
+        dstore_close(disc_ds);
+        disc_ds = NULL;
+}
+
+/**********************************************************************/
+// Mouse: motion is coalesced, and passed to the Mac at most once per
+// frame (just before the VBL interrupt, whose task picks it up).
+// Button transitions are queued and passed one per frame, so that even
+// a click shorter than a frame is seen by the Mac's polling.
+
+#define MOUSE_BTN_QUEUE 16      /* Power of 2 */
+
+static int mouse_absx, mouse_absy;
+static int mouse_relx, mouse_rely;
+static int mouse_moved;
+static int mouse_button;
+static uint8_t mouse_btn_q[MOUSE_BTN_QUEUE];
+static unsigned int mouse_btn_rd, mouse_btn_wr;
+
+static void     mouse_motion_event(int x, int y, int dx, int dy)
+{
+        mouse_absx = x;
+        mouse_absy = y;
+        mouse_relx += dx;
+        mouse_rely += dy;
+        mouse_moved = 1;
+        latency_input(UMAC_INPUT_MOUSE_MOVE, 1);
+}
+
+static void     mouse_button_event(int down)
+{
+        unsigned int n = mouse_btn_wr - mouse_btn_rd;
+        int last = n ? mouse_btn_q[(mouse_btn_wr - 1) % MOUSE_BTN_QUEUE] : mouse_button;
+
+        if (down == last)
+                return;
+        if (n == MOUSE_BTN_QUEUE) {
+                /* Lose a whole click, rather than the final state */
+                mouse_btn_wr--;
+                return;
+        }
+        mouse_btn_q[mouse_btn_wr++ % MOUSE_BTN_QUEUE] = down;
+        latency_input(UMAC_INPUT_MOUSE_BUTTON, 1);
+}
+
+static void     mouse_flush(int absmouse)
+{
+        if (mouse_btn_rd != mouse_btn_wr)
+                mouse_button = mouse_btn_q[mouse_btn_rd++ % MOUSE_BTN_QUEUE];
+        else if (!mouse_moved)
+                return;
+
+        if (absmouse)
+                umac_absmouse(mouse_absx, mouse_absy, mouse_button);
+        else
+                umac_mouse(mouse_relx, mouse_rely, mouse_button);
+        mouse_relx = 0;
+        mouse_rely = 0;
+        mouse_moved = 0;
+}
+
+/**********************************************************************/
+// Serial ports, indexed by SCC AnB
+
+static serbridge_t *serial[2];
+
+static void     serial_tx(int AnB, uint8_t data)
+{
+        if (serial[AnB])
+                serbridge_tx(serial[AnB], data);
+}
+
+static void     exit_serial_close(void)
+{
+        for (int i = 0; i < 2; i++) {
+                serbridge_close(serial[i]);
+                serial[i] = NULL;
+        }
+}
+
+// LocalTalk, on the printer port
+static ltalk_t *ltalk;
+
+static void     serial_tx_frame(int AnB, const uint8_t *data, unsigned int len)
+{
+        if (ltalk && AnB == SCC_CH_B)
+                ltalk_tx_frame(ltalk, data, len);
+}
+
+static void     exit_ltalk_close(void)
+{
+        ltalk_close(ltalk);
+        ltalk = NULL;
+}
+
+static void     exit_log_flush(void)
+{
+        log_flush(stdout);
+}
+
+// Metrics exporter
+static metrics_server_t *metrics;
+
+static void     exit_metrics_close(void)
+{
+        metrics_serve_close(metrics);
+        metrics = NULL;
+}
+
+// Profiles so far, on SIGUSR1
+static volatile sig_atomic_t prof_report_wanted = 0;
+
+static void     sigusr1_handler(int sig)
+{
+        (void)sig;
+        prof_report_wanted = 1;
+}
+
+static void     prof_report_live(void)
+{
+        prof_report_wanted = 0;
+        if (prof_active)
+                prof_report(stdout);
+        if (trapprof_active)
+                trapprof_report(stdout);
+        if (latency_active)
+                latency_report(stdout);
+        if (frametime_active)
+                frametime_report(stdout);
+#if ENABLE_MEMHEAT
+        if (memheat_active)
+                memheat_report(stdout);
+#endif
+}
+
+/**********************************************************************/
+// Performance HUD, toggled with F10.  Timings are only taken whilst
+// it's shown, and the figures are refreshed once a second.
+
+#define HUD_PERIOD_US   1000000
+#define HUD_FG          0xff00ff00      /* RGBA32, as a little-endian word */
+#define HUD_BG          0xff000000
+
+static int hud_on;
+static struct {
+        uint64_t start_us;
+        uint64_t start_cycles;
+        uint64_t start_disc_ops;
+        uint64_t loop_us;               /* In umac_loop() */
+        uint64_t render_us;             /* copy_fb() through present */
+        uint64_t last_frame_us;
+        uint64_t frame_min, frame_max, frame_sum;
+        unsigned int frames;
+} hud_acc;
+static char hud_str[256];
+
+static uint64_t hud_now_us(void)
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t hud_disc_ops(void)
+{
+        struct umac_metrics m;
+        umac_get_metrics(&m);
+        return m.disc_reads + m.disc_writes;
+}
+
+static void     hud_reset(uint64_t now)
+{
+        memset(&hud_acc, 0, sizeof(hud_acc));
+        hud_acc.start_us = now;
+        hud_acc.start_cycles = umac_get_cycles();
+        hud_acc.start_disc_ops = hud_disc_ops();
+        hud_acc.frame_min = UINT64_MAX;
+}
+
+static void     hud_toggle(void)
+{
+        hud_on = !hud_on;
+        hud_reset(hud_now_us());
+        snprintf(hud_str, sizeof(hud_str), "...");
+}
+
+/* A frame's been presented at now: */
+static void     hud_frame(uint64_t now)
+{
+        if (hud_acc.last_frame_us) {
+                uint64_t t = now - hud_acc.last_frame_us;
+                if (t < hud_acc.frame_min)
+                        hud_acc.frame_min = t;
+                if (t > hud_acc.frame_max)
+                        hud_acc.frame_max = t;
+                hud_acc.frame_sum += t;
+                hud_acc.frames++;
+        }
+        hud_acc.last_frame_us = now;
+}
+
+static void     hud_update(uint64_t now)
+{
+        uint64_t period = now - hud_acc.start_us;
+        char audio[32], disc[16];
+
+        if (period < HUD_PERIOD_US)
+                return;
+        double mhz = (umac_get_cycles() - hud_acc.start_cycles) / (double)period;
+        unsigned int n = hud_acc.frames ? hud_acc.frames : 1;
+#if ENABLE_AUDIO
+        if (audio_rs) {
+                unsigned int fill, under, over;
+                audio_get_stats(&fill, &under, &over);
+                snprintf(audio, sizeof(audio), "%u/%u U%u O%u", fill, AUDIO_RING_BLKS, under, over);
+        } else
+#endif
+        {
+                snprintf(audio, sizeof(audio), "NONE");
+        }
+#if ENABLE_METRICS
+        snprintf(disc, sizeof(disc), "%.0f/S",
+                 (hud_disc_ops() - hud_acc.start_disc_ops) * 1000000.0 / period);
+#else
+        /* Disc requests are only counted with metrics */
+        snprintf(disc, sizeof(disc), "N/A");
+#endif
+        snprintf(hud_str, sizeof(hud_str),
+                 "EMU %.2fMHZ X%.2f\n"
+                 "HOST LOOP %d%% DRAW %d%%\n"
+                 "FRAME %.1f/%.1f/%.1fMS\n"
+                 "AUDIO %s\n"
+                 "DISC %s",
+                 mhz, mhz / 8.0,
+                 (int)(100 * hud_acc.loop_us / period),
+                 (int)(100 * hud_acc.render_us / period),
+                 hud_acc.frames ? hud_acc.frame_min / 1000.0 : 0.0,
+                 hud_acc.frame_sum / 1000.0 / n,
+                 hud_acc.frame_max / 1000.0,
+                 audio, disc);
+        uint64_t last_frame = hud_acc.last_frame_us;
+        hud_reset(now);
+        hud_acc.last_frame_us = last_frame;
+}
+
+static void     hud_draw(uint32_t *fb)
+{
+#if ENABLE_AUDIO
+        /* The sound buffer's samples, as bits in the left-hand pixels: */
+        uint16_t *audioptr = (uint16_t *)(ram_get_base() + umac_get_audio_offset());
+        for (int i = 0; i < DISP_HEIGHT; i++) {
+                int d = *audioptr++ & 0xff;
+                for (int j = 0; j < 8; j++) {
+                        if (d & (1 << j))
+                                fb[j + i * DISP_WIDTH] |= 0xff;
+                }
+        }
+#endif
+        hud_text(fb, DISP_WIDTH, DISP_HEIGHT, 10, 2, hud_str, HUD_FG, HUD_BG);
+}
+
 /**********************************************************************/
 
 /* The emulator core expects to be given ROM and RAM pointers,
@@ -136,15 +666,21 @@ int     main(int argc, char *argv[])
         char *rom_dump_filename = NULL;
         char *ram_filename = "ram.bin";
         char *disc_filename = NULL;
+        char *disc_pool_filename = NULL;
         int ofd;
         int ch;
         int opt_disassemble = 0;
+        int opt_emulated_time = 0;
+        int opt_no_audio = 0;
+        char *wav_filename = NULL;
         int opt_write = 0;
+        int opt_wb_policy = DISC_WB_GROUP;
+        unsigned int opt_wb_ms = 500;
 
         ////////////////////////////////////////////////////////////////////////
         // Args
 
-        while ((ch = getopt(argc, argv, "r:d:W:ihw")) != -1) {
+        while ((ch = getopt(argc, argv, "r:d:W:ihwF:P:S:a:qs:L:t:p:T:H:I:f:Y:M:l:C:D")) != -1) {
                 switch (ch) {
                 case 'r':
                         rom_filename = strdup(optarg);
@@ -154,6 +690,16 @@ int     main(int argc, char *argv[])
                         opt_disassemble = 1;
                         break;
 
+                case 'D':
+                        opt_emulated_time = 1;
+                        break;
+
+                case 'C':
+                        if (trace_check_open(optarg))
+                                return 1;
+                        atexit(trace_check_close);
+                        break;
+
                 case 'd':
                         disc_filename = strdup(optarg);
                         break;
@@ -166,12 +712,113 @@ int     main(int argc, char *argv[])
                         rom_dump_filename = strdup(optarg);
                         break;
 
+                case 'S':
+                        disc_pool_filename = strdup(optarg);
+                        break;
+
+                case 'P':
+                        disc_profile_filename = strdup(optarg);
+                        break;
+
+                case 'a':
+                        wav_filename = strdup(optarg);
+                        break;
+
+                case 'q':
+                        opt_no_audio = 1;
+                        break;
+
+                case 's': {
+                        int AnB = (optarg[0] == 'a') ? SCC_CH_A : SCC_CH_B;
+                        if ((optarg[0] != 'a' && optarg[0] != 'b') || optarg[1] != ':') {
+                                print_help(argv[0]);
+                                return 1;
+                        }
+                        serbridge_close(serial[AnB]);
+                        serial[AnB] = serbridge_open(AnB, optarg + 2);
+                        if (!serial[AnB])
+                                return 1;
+                } break;
+
+                case 't':
+                        if (trace_open(optarg))
+                                return 1;
+                        atexit(trace_close);
+                        break;
+
+                case 'p':
+                        if (prof_open(optarg))
+                                return 1;
+                        atexit(prof_close);
+                        break;
+
+                case 'T':
+                        if (trapprof_open(optarg))
+                                return 1;
+                        atexit(trapprof_close);
+                        break;
+
+                case 'f':
+                        if (frametime_open(optarg))
+                                return 1;
+                        atexit(frametime_close);
+                        break;
+
+                case 'I':
+                        if (latency_open(optarg))
+                                return 1;
+                        atexit(latency_close);
+                        break;
+
+#if ENABLE_MEMHEAT
+                case 'H':
+                        if (memheat_open(optarg))
+                                return 1;
+                        atexit(memheat_close);
+                        break;
+#endif
+
+                case 'Y':
+                        if (symtab_load(optarg))
+                                return 1;
+                        break;
+
+                case 'l':
+                        if (log_set_levels(optarg))
+                                return 1;
+                        break;
+
+                case 'M':
+                        metrics_serve_close(metrics);
+                        metrics = metrics_serve_open(optarg);
+                        if (!metrics)
+                                return 1;
+                        break;
+
+                case 'L':
+                        ltalk_close(ltalk);
+                        ltalk = ltalk_open(SCC_CH_B, optarg);
+                        if (!ltalk)
+                                return 1;
+                        break;
+
+                case 'F':
+                        if (disc_wb_parse_policy(optarg, &opt_wb_policy, &opt_wb_ms)) {
+                                print_help(argv[0]);
+                                return 1;
+                        }
+                        break;
+
                 case 'h':
                 default:
                         print_help(argv[0]);
                         return 1;
                 }
         }
+        if (ltalk && serial[SCC_CH_B]) {
+                printf("-L and -s b: both want the printer port\n");
+                return 1;
+        }
 
         ////////////////////////////////////////////////////////////////////////
         // Load memories/discs
@@ -234,7 +881,26 @@ int     main(int argc, char *argv[])
 
         disc_descr_t discs[DISC_NUM_DRIVES] = {0};
 
-        if (disc_filename) {
+        if (disc_filename && disc_pool_filename) {
+                /* Deduplicated image: block map into a shared pool.
+                 * Guest writes go to a private overlay, persisted if
+                 * opt_write.
+                 */
+                printf("Opening disc map '%s' in pool '%s'\n",
+                       disc_filename, disc_pool_filename);
+                disc_ds = dstore_open(disc_pool_filename, disc_filename, opt_write);
+                if (!disc_ds) {
+                        printf("Can't open disc from pool!\n");
+                        return 1;
+                }
+                atexit(exit_disc_store_close);
+                discs[0].size = dstore_size(disc_ds);
+                discs[0].op_ctx = disc_ds;
+                discs[0].op_read = dstore_read;
+                discs[0].op_write = dstore_write;
+                discs[0].op_flush = dstore_flush;
+                discs[0].op_prefetch = dstore_prefetch;
+        } else if (disc_filename) {
                 printf("Opening disc '%s'\n", disc_filename);
                 // FIXME: >1 disc
                 ofd = open(disc_filename, opt_write ? O_RDWR : O_RDONLY);
@@ -243,17 +909,23 @@ int     main(int argc, char *argv[])
                         return 1;
                 }
 
+                int journalled = opt_write && opt_wb_policy != DISC_WB_NONE;
+                if (journalled && disc_wb_recover(disc_filename, ofd))
+                        return 1;
+
                 fstat(ofd, &sb);
                 size_t disc_size = sb.st_size;
 
                 /* Discs are always _writable_ from the perspective of
                  * the Mac, but by default data is a MAP_PRIVATE copy
                  * and is not synchronised to the backing file.  If
-                 * opt_write, we use MAP_SHARED and open the file RW,
-                 * so writes persist to the disc image.
+                 * opt_write, the file is opened RW and writes persist
+                 * to the disc image: either journalled and committed
+                 * per the write-back policy (the map stays private),
+                 * or with policy "none", directly via MAP_SHARED.
                  */
                 disc_base = mmap(0, disc_size, PROT_READ | PROT_WRITE,
-                                 opt_write ? MAP_SHARED : MAP_PRIVATE,
+                                 (opt_write && !journalled) ? MAP_SHARED : MAP_PRIVATE,
                                  ofd, 0);
                 if (disc_base == MAP_FAILED) {
                         printf("Can't mmap disc!\n");
@@ -264,6 +936,21 @@ int     main(int argc, char *argv[])
                 discs[0].base = disc_base;
                 discs[0].read_only = 0;         /* See above */
                 discs[0].size = disc_size;
+                disc_map_base = disc_base;
+                discs[0].op_prefetch = disc_prefetch_mapped;
+
+                if (journalled) {
+                        disc_wb = disc_wb_open(disc_filename, ofd, disc_base, disc_size,
+                                               opt_wb_policy, opt_wb_ms);
+                        if (!disc_wb) {
+                                printf("Can't set up disc journal!\n");
+                                return 1;
+                        }
+                        discs[0].op_ctx = disc_wb;
+                        discs[0].op_write = disc_wb_write;
+                        discs[0].op_flush = disc_wb_flush;
+                        atexit(exit_disc_commit);
+                }
         }
 
         ////////////////////////////////////////////////////////////////////////
@@ -272,11 +959,7 @@ int     main(int argc, char *argv[])
         SDL_Renderer *renderer;
         SDL_Texture *texture;
 
-        SDL_Init(SDL_INIT_VIDEO
-#if ENABLE_AUDIO
-                | SDL_INIT_AUDIO
-#endif
-);
+        SDL_Init(SDL_INIT_VIDEO | ((ENABLE_AUDIO && !opt_no_audio) ? SDL_INIT_AUDIO : 0));
         SDL_Window *window = SDL_CreateWindow("umac",
                                               SDL_WINDOWPOS_UNDEFINED,
                                               SDL_WINDOWPOS_UNDEFINED,
@@ -315,55 +998,70 @@ int     main(int argc, char *argv[])
         }
 
 #if ENABLE_AUDIO
-        SDL_AudioSpec desired, obtained;
+        SDL_AudioDeviceID audio_device = 0;
 
-        audio_base = (uint8_t*)ram_base + umac_get_audio_offset();
-
-        SDL_zero(desired);
-        desired.freq = 22256; // wat
-        desired.channels = 1;
-        desired.samples = 370;
-        desired.userdata = (uint8_t*)ram_base + umac_get_audio_offset();
-        desired.callback = audio_callback;
-        desired.format = AUDIO_S16;
-
-        SDL_AudioDeviceID audio_device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
-        if (!audio_device) {
-                char buf[500];
-                SDL_GetErrorMsg(buf, sizeof(buf));
-                printf("SDL audio_deviceSDL_GetError() -> %s\n", buf);
-                return 1;
+        if (wav_filename) {
+                audio_wav = wavcap_open(wav_filename, (unsigned int)(AUDIO_MAC_RATE + 0.5));
+                if (!audio_wav)
+                        return 1;
+                printf("Capturing audio to '%s'\n", wav_filename);
+                atexit(exit_audio_capture);
+        }
+        if (!opt_no_audio) {
+                audio_device = audio_open();
+                if (!audio_device)
+                        return 1;
         }
+#else
+        if (wav_filename)
+                printf("Built without audio, ignoring -a\n");
 #endif
 
         ////////////////////////////////////////////////////////////////////////
         // Emulator init
 
         umac_init(ram_base, rom_base, discs);
+        fb_changed(umac_get_fb_offset());
+        umac_set_fb_change(fb_changed);
+        umac_serial_set_tx(serial_tx);
+        atexit(exit_serial_close);
+        umac_serial_set_tx_frame(serial_tx_frame);
+        atexit(exit_ltalk_close);
+        atexit(exit_metrics_close);
+        atexit(exit_log_flush);
         umac_opt_disassemble(opt_disassemble);
+        if (latency_active)
+                umac_set_input_consumed(latency_consumed);
+        signal(SIGUSR1, sigusr1_handler);
+
+        if (disc_filename && disc_profile_filename) {
+                disc_profile_load(disc_profile_filename);
+                if (disc_profile_record(0, DISC_PROFILE_MAX) == 0)
+                        atexit(exit_disc_profile_save);
+        }
 
 #if ENABLE_AUDIO
-        // Default state is paused, this unpauses it
-        SDL_PauseAudioDevice(audio_device, 0);
+        if (audio_device) {
+                // Default state is paused, this unpauses it
+                SDL_PauseAudioDevice(audio_device, 0);
+                atexit(exit_audio_stats);
+        }
 #endif
 
         ////////////////////////////////////////////////////////////////////////
         // Main loop
 
         int done = 0;
-        int mouse_button = 0;
-#if !ENABLE_AUDIO
-        uint64_t last_vsync = 0;
-#endif
-        uint64_t last_1hz = 0;
+        /* Time starts now, so the first vsync isn't counted as years late: */
+        struct timeval tv_start;
+        gettimeofday(&tv_start, NULL);
+        uint64_t last_vsync = opt_emulated_time ? umac_get_cycles() / 8 :
+                (uint64_t)tv_start.tv_sec * 1000000 + tv_start.tv_usec;
+        uint64_t last_1hz = last_vsync;
         do {
                 struct timeval tv_now;
                 SDL_Event event;
-                int mousex = 0;
-                int mousey = 0;
-                int send_mouse = 0;
-                static int absmousex, absmousey;
-                if (SDL_PollEvent(&event)) {
+                while (SDL_PollEvent(&event)) {
                         switch (event.type) {
                         case SDL_QUIT:
                                 done = 1;
@@ -371,73 +1069,105 @@ int     main(int argc, char *argv[])
 
                         case SDL_KEYDOWN:
                         case SDL_KEYUP: {
+                                if (event.key.keysym.scancode == SDL_SCANCODE_F10) {
+                                        if (event.type == SDL_KEYDOWN)
+                                                hud_toggle();
+                                        break;
+                                }
+                                if (event.key.keysym.scancode == SDL_SCANCODE_F9) {
+                                        /* Paste host clipboard, straight into the event queue */
+                                        if (event.type == SDL_KEYDOWN && SDL_HasClipboardText()) {
+                                                char *text = SDL_GetClipboardText();
+                                                printf("Pasting %d chars\n", umac_type_text(text, 1));
+                                                SDL_free(text);
+                                        }
+                                        break;
+                                }
                                 int c = SDLScan2MacKeyCode(event.key.keysym.scancode);
                                 c = (c << 1) | 1;
-                                printf("Key 0x%x -> 0x%x\n", event.key.keysym.scancode, c);
-                                if (c != MKC_None)
+                                LOG(LOG_KBD, LOG_DEBUG, "Key 0x%x -> 0x%x\n",
+                                    event.key.keysym.scancode, c);
+                                if (c != MKC_None) {
                                         umac_kbd_event(c, (event.type == SDL_KEYDOWN));
+                                        latency_input(UMAC_INPUT_KEY, event.type == SDL_KEYDOWN);
+                                }
                         } break;
 
                         case SDL_MOUSEMOTION:
-                                send_mouse = 1;
-                                absmousex = event.motion.x / DISP_SCALE;
-                                absmousey = event.motion.y / DISP_SCALE;
-                                mousex = event.motion.xrel;
-                                mousey = -event.motion.yrel;
+                                mouse_motion_event(event.motion.x / DISP_SCALE,
+                                                   event.motion.y / DISP_SCALE,
+                                                   event.motion.xrel, -event.motion.yrel);
                                 break;
 
                         case SDL_MOUSEBUTTONDOWN:
-                                send_mouse = 1;
-                                mouse_button = 1;
+                                mouse_button_event(1);
                                 break;
 
                         case SDL_MOUSEBUTTONUP:
-                                send_mouse = 1;
-                                mouse_button = 0;
+                                mouse_button_event(0);
                                 break;
                         }
                 }
 
-                if (send_mouse) {
-                    if(absmouse) {
-                        umac_absmouse(absmousex, absmousey, mouse_button);
-                    } else {
-                        umac_mouse(mousex, mousey, mouse_button);
-                    }
-                }
-
+                uint64_t hud_t0 = hud_on ? hud_now_us() : 0;
                 done |= umac_loop();
+                if (hud_on)
+                        hud_acc.loop_us += hud_now_us() - hud_t0;
+                disc_wb_poll(disc_wb);
+                for (int i = 0; i < 2; i++)
+                        if (serial[i])
+                                serbridge_poll(serial[i]);
+                if (ltalk)
+                        ltalk_poll(ltalk);
+                if (prof_report_wanted)
+                        prof_report_live();
+                if (metrics)
+                        metrics_serve_poll(metrics);
+                log_flush(stdout);
 
                 gettimeofday(&tv_now, NULL);
                 uint64_t now_usec = (tv_now.tv_sec * 1000000) + tv_now.tv_usec;
+                if (opt_emulated_time)
+                        now_usec = umac_get_cycles() / 8;
 
                 /* Passage of time: */
-#if ENABLE_AUDIO
-                int do_v_retrace = atomic_exchange(&pending_v_retrace, 0);
-#else
-                int do_v_retrace = (now_usec - last_vsync) >= 16667;
-#endif
+                int do_v_retrace = (now_usec - last_vsync) >= VSYNC_PERIOD_US;
                 if (do_v_retrace) {
-                        umac_vsync_event();
+                        /* Keep to the average rate, unless we've fallen a long way behind */
+                        last_vsync += VSYNC_PERIOD_US;
+                        if ((now_usec - last_vsync) >= VSYNC_PERIOD_US) {
+                                METRIC_ADD(frames_dropped, (now_usec - last_vsync) / VSYNC_PERIOD_US);
+                                last_vsync = now_usec;
+                        }
 
-                        copy_fb(framebuffer, ram_get_base() + umac_get_fb_offset());
+                        mouse_flush(absmouse);
+                        umac_vsync_event();
 
-        uint16_t *audioptr = (uint16_t*)((uint8_t*)ram_base + umac_get_audio_offset());
-        for(int i=0; i<DISP_HEIGHT; i++) {
-            int d = *audioptr++ & 0xff;
-            for(int j=0; j<8; j++) {
-                if (d & (1 << j)) {
-                    uint32_t fbdata = framebuffer[j + i * DISP_WIDTH];
-                    fbdata = (fbdata & ~0xff) | ((d & (1 << j)) ? 0xff : 0);
-                    framebuffer[j + i * DISP_WIDTH] = fbdata;
-                }
-            }
-        }
+                        latency_frame(fb_base, DISP_WIDTH * DISP_HEIGHT / 8);
+                        hud_t0 = hud_on ? hud_now_us() : 0;
+                        uint64_t ft0 = frametime_active ? frametime_now_ns() : 0;
+                        copy_fb(framebuffer, fb_base);
+                        if (hud_on)
+                                hud_draw(framebuffer);
+                        uint64_t ft1 = frametime_active ? frametime_now_ns() : 0;
                         SDL_UpdateTexture(texture, NULL, framebuffer,
                                           DISP_WIDTH * sizeof (Uint32));
                         /* Scales texture up to window size */
                         SDL_RenderCopy(renderer, texture, NULL, NULL);
                         SDL_RenderPresent(renderer);
+                        latency_presented();
+                        METRIC_INC(frames_presented);
+                        if (frametime_active) {
+                                frametime_add(FT_CONVERT, ft1 - ft0);
+                                frametime_add(FT_PRESENT, frametime_now_ns() - ft1);
+                                frametime_frame(VSYNC_PERIOD_US * 1000ULL);
+                        }
+                        if (hud_on) {
+                                uint64_t t = hud_now_us();
+                                hud_acc.render_us += t - hud_t0;
+                                hud_frame(t);
+                                hud_update(t);
+                        }
                 }
                 if ((now_usec - last_1hz) >= 1000000) {
                         umac_1hz_event();
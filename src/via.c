@@ -31,12 +31,10 @@
 
 #include "m68kcpu.h"
 #include "via.h"
+#include "metrics.h"
+#include "log.h"
 
-#ifdef DEBUG
-#define VDBG(...)       printf(__VA_ARGS__)
-#else
-#define VDBG(...)       do {} while(0)
-#endif
+#define VDBG(...)       LOG(LOG_VIA, LOG_DEBUG, __VA_ARGS__)
 
 #define VERR(...)       fprintf(stderr, __VA_ARGS__)
 
@@ -132,6 +130,7 @@ static void via_update_sr(uint8_t data)
                  */
                 sr_tx_pending = data;
                 irq_active |= VIA_IRQ_SR;
+                METRIC_INC(via_irqs[METRIC_VIA_SR]);
         } else if ((via_regs[VIA_ACR] & 0x1c) == 0x18) {
                 /* Mac sends a byte of zeroes fuelled by phi2, as a
                  * method to pull KbdData low (to get the kbd's
@@ -353,13 +352,19 @@ void    via_caX_event(int ca)
 {
         if (ca == 1) {
                 irq_active |= VIA_IRQ_CA;
+                METRIC_INC(via_irqs[METRIC_VIA_CA2]);
         } else if (ca == 2) {
                 irq_active |= VIA_IRQ_CB;
+                METRIC_INC(via_irqs[METRIC_VIA_CA1]);
         }
         via_assess_irq();
 }
 
-void    via_sr_rx(uint8_t val)
+/* Returns 0 if the byte was received, or -1 if the SR isn't set up
+ * to receive (e.g. the ISR hasn't yet switched it over after a TX),
+ * in which case the sender should try again later.
+ */
+int     via_sr_rx(uint8_t val)
 {
         /* If SR config in ACR is external (yes! a Mac assumption!)
          * then fill SR with value and trigger SR IRQ:
@@ -368,9 +373,12 @@ void    via_sr_rx(uint8_t val)
         if ((via_regs[VIA_ACR] & 0x1c) == 0x0c) {
                 via_regs[VIA_SR] = val;
                 irq_active |= VIA_IRQ_SR;
+                METRIC_INC(via_irqs[METRIC_VIA_SR]);
                 VDBG("[VIA sr_rx received, IRQ pending]\n");
                 via_assess_irq();
+                return 0;
         } else {
                 VDBG("[VIA ACR SR state %02x, not receiving]\n", via_regs[VIA_ACR]);
+                return -1;
         }
 }
@@ -0,0 +1,142 @@
+/* umac WAV capture
+ *
+ * Writes the Mac's sound buffer, once per frame, to a WAV file at
+ * the Mac's own sample rate.  Output is buffered through stdio (a
+ * frame is only 370 bytes), and the RIFF/data lengths are filled in
+ * when the file's closed.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavcap.h"
+
+#define WERR(...)       fprintf(stderr, __VA_ARGS__)
+
+#define WAV_HDR_SIZE    44
+#define WAV_BUF_SIZE    65536
+#define WAV_MAX_FRAME   1024
+
+struct wavcap {
+        FILE *f;
+        char *iobuf;
+        unsigned int rate;
+        uint32_t bytes;
+};
+
+static void     put_le32(uint8_t *p, uint32_t v)
+{
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        p[3] = v >> 24;
+}
+
+static void     put_le16(uint8_t *p, uint16_t v)
+{
+        p[0] = v;
+        p[1] = v >> 8;
+}
+
+static int      wavcap_write_hdr(wavcap_t *wc)
+{
+        uint8_t h[WAV_HDR_SIZE];
+
+        memcpy(&h[0], "RIFF", 4);
+        put_le32(&h[4], 36 + wc->bytes);
+        memcpy(&h[8], "WAVEfmt ", 8);
+        put_le32(&h[16], 16);
+        put_le16(&h[20], 1);            /* PCM */
+        put_le16(&h[22], 1);            /* Mono */
+        put_le32(&h[24], wc->rate);
+        put_le32(&h[28], wc->rate);     /* Bytes/s */
+        put_le16(&h[32], 1);            /* Block align */
+        put_le16(&h[34], 8);            /* Bits/sample */
+        memcpy(&h[36], "data", 4);
+        put_le32(&h[40], wc->bytes);
+
+        if (fseek(wc->f, 0, SEEK_SET) || fwrite(h, WAV_HDR_SIZE, 1, wc->f) != 1)
+                return -1;
+        return 0;
+}
+
+wavcap_t        *wavcap_open(const char *path, unsigned int rate)
+{
+        wavcap_t *wc = calloc(1, sizeof(*wc));
+
+        if (!wc)
+                return NULL;
+        wc->rate = rate;
+        wc->f = fopen(path, "wb");
+        if (!wc->f) {
+                perror("WAV capture");
+                free(wc);
+                return NULL;
+        }
+        wc->iobuf = malloc(WAV_BUF_SIZE);
+        if (wc->iobuf)
+                setvbuf(wc->f, wc->iobuf, _IOFBF, WAV_BUF_SIZE);
+        /* Placeholder lengths, rewritten on close */
+        if (wavcap_write_hdr(wc)) {
+                WERR("WAV capture: can't write '%s'\n", path);
+                fclose(wc->f);
+                free(wc->iobuf);
+                free(wc);
+                return NULL;
+        }
+        return wc;
+}
+
+void    wavcap_frame(wavcap_t *wc, const uint8_t *buf, unsigned int num,
+                     int volume, int sndres)
+{
+        uint8_t out[WAV_MAX_FRAME];
+
+        if (num > WAV_MAX_FRAME)
+                num = WAV_MAX_FRAME;
+        if (sndres) {
+                memset(out, 0x80, num);
+        } else {
+                for (unsigned int i = 0; i < num; i++) {
+                        int s = buf[i * 2] - 128;
+                        out[i] = 128 + (s * volume) / 7;
+                }
+        }
+        fwrite(out, num, 1, wc->f);
+        wc->bytes += num;
+}
+
+void    wavcap_close(wavcap_t *wc)
+{
+        if (!wc)
+                return;
+        fflush(wc->f);
+        if (wavcap_write_hdr(wc))
+                WERR("WAV capture: can't finalise header\n");
+        fclose(wc->f);
+        free(wc->iobuf);
+        free(wc);
+}
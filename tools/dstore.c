@@ -0,0 +1,51 @@
+/* dstore: manage a umac deduplicating disc image pool
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dstore.h"
+
+static void help(char *me)
+{
+	printf("Syntax: %s <command> <args>\n"
+	       "\timport <pool> <image> <map>\tAdd image to pool, creating map\n"
+	       "\texport <pool> <map> <image>\tWrite out flat image\n"
+	       "\tstats <pool>\n"
+	       , me);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 5 && !strcmp(argv[1], "import"))
+		return dstore_import(argv[2], argv[3], argv[4]) ? 1 : 0;
+	if (argc == 5 && !strcmp(argv[1], "export"))
+		return dstore_export(argv[2], argv[3], argv[4]) ? 1 : 0;
+	if (argc == 3 && !strcmp(argv[1], "stats"))
+		return dstore_stats(argv[2]) ? 1 : 0;
+
+	help(argv[0]);
+	return 1;
+}
@@ -0,0 +1,236 @@
+/* lthub: LocalTalk hub for umac instances
+ *
+ * Every LLAP frame a umac instance (run with -L) sends is passed on
+ * to all the others, like a shared LocalTalk cable.  Clients say
+ * hello with an empty datagram, and are forgotten when their socket
+ * goes away.  Frames are received in batches and fanned out from the
+ * same buffer, with recvmmsg()/sendmmsg() where available.  A client
+ * that isn't keeping up loses frames rather than stalling the rest.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS	32
+#define FRAME_MAX	1024	/* More than any LLAP frame */
+#define BATCH		16
+
+static struct sockaddr_un clients[MAX_CLIENTS];
+static socklen_t client_len[MAX_CLIENTS];
+static int num_clients = 0;
+static const char *hub_path;
+
+static int find_client(struct sockaddr_un *sa, socklen_t len)
+{
+	for (int i = 0; i < num_clients; i++)
+		if (client_len[i] == len && !memcmp(&clients[i], sa, len))
+			return i;
+	return -1;
+}
+
+static void add_client(struct sockaddr_un *sa, socklen_t len)
+{
+	if (find_client(sa, len) >= 0)
+		return;
+	if (num_clients == MAX_CLIENTS) {
+		fprintf(stderr, "Too many clients, ignoring %s\n", sa->sun_path);
+		return;
+	}
+	clients[num_clients] = *sa;
+	client_len[num_clients] = len;
+	num_clients++;
+	printf("Client %s joined (%d)\n", sa->sun_path, num_clients);
+}
+
+static void remove_client(int i)
+{
+	printf("Client %s left (%d)\n", clients[i].sun_path, num_clients - 1);
+	num_clients--;
+	clients[i] = clients[num_clients];
+	client_len[i] = client_len[num_clients];
+}
+
+/* Send a frame to all clients except the one it came from.  Returns
+ * with errno set for the client at *failed, or *failed = -1 if all
+ * went (or would block, i.e. dropped).
+ */
+static void fan_out(int fd, int from, struct iovec *iov, int *failed)
+{
+	*failed = -1;
+#ifdef __linux__
+	struct mmsghdr msgs[MAX_CLIENTS];
+	int idx[MAX_CLIENTS];
+	int n = 0;
+
+	for (int i = 0; i < num_clients; i++) {
+		if (i == from)
+			continue;
+		memset(&msgs[n], 0, sizeof(msgs[n]));
+		msgs[n].msg_hdr.msg_name = &clients[i];
+		msgs[n].msg_hdr.msg_namelen = client_len[i];
+		msgs[n].msg_hdr.msg_iov = iov;
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		idx[n++] = i;
+	}
+	for (int done = 0; done < n; ) {
+		int r = sendmmsg(fd, &msgs[done], n - done, MSG_DONTWAIT);
+		if (r < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+				*failed = idx[done];
+				return;
+			}
+			r = 1;	/* Client's full, drop it for them */
+		}
+		done += r;
+	}
+#else
+	for (int i = 0; i < num_clients; i++) {
+		if (i == from)
+			continue;
+		if (sendto(fd, iov->iov_base, iov->iov_len, MSG_DONTWAIT,
+			   (struct sockaddr *)&clients[i], client_len[i]) < 0 &&
+		    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+			*failed = i;
+			return;
+		}
+	}
+#endif
+}
+
+static void frame(int fd, struct sockaddr_un *sa, socklen_t salen, uint8_t *buf, unsigned int len)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	int from, failed;
+
+	add_client(sa, salen);
+	if (len == 0)		/* Hello */
+		return;
+	from = find_client(sa, salen);
+	for (;;) {
+		fan_out(fd, from, &iov, &failed);
+		if (failed < 0)
+			break;
+		if (errno != ECONNREFUSED && errno != ENOENT) {
+			perror("sendmsg");
+			break;
+		}
+		/* Gone; forget it and carry on with the rest */
+		remove_client(failed);
+		if (from == num_clients)
+			from = failed;
+		/* (Clients already sent to will get a duplicate; harmless,
+		 * and only happens when someone leaves.) */
+	}
+}
+
+static void cleanup(void)
+{
+	unlink(hub_path);
+}
+
+static void sig_exit(int sig)
+{
+	(void)sig;
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t bufs[BATCH][FRAME_MAX];
+	static struct sockaddr_un from[BATCH];
+	struct sockaddr_un sa;
+	int fd;
+
+	if (argc != 2) {
+		printf("Syntax: %s <socket path>\n", argv[0]);
+		return 1;
+	}
+	hub_path = argv[1];
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, hub_path, sizeof(sa.sun_path) - 1);
+	unlink(hub_path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		perror("bind");
+		return 1;
+	}
+	atexit(cleanup);
+	signal(SIGINT, sig_exit);
+	signal(SIGTERM, sig_exit);
+	printf("LocalTalk hub on %s\n", hub_path);
+
+	for (;;) {
+#ifdef __linux__
+		struct mmsghdr msgs[BATCH];
+		struct iovec iov[BATCH];
+
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < BATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = FRAME_MAX;
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		/* Block for the first, then take whatever else is waiting */
+		int n = recvmmsg(fd, msgs, BATCH, MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recvmmsg");
+			return 1;
+		}
+		for (int i = 0; i < n; i++)
+			frame(fd, &from[i], msgs[i].msg_hdr.msg_namelen, bufs[i], msgs[i].msg_len);
+#else
+		socklen_t len = sizeof(from[0]);
+		ssize_t r = recvfrom(fd, bufs[0], FRAME_MAX, 0,
+				     (struct sockaddr *)&from[0], &len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recvfrom");
+			return 1;
+		}
+		frame(fd, &from[0], len, bufs[0], r);
+#endif
+	}
+	return 0;
+}
@@ -0,0 +1,323 @@
+/* membench: micro-benchmarks for umac's memory and device paths
+ *
+ * Calls the CPU's memory accessors (cpu_read_*, cpu_write_*,
+ * cpu_read_instr), the VIA and SCC register handlers and the disc PV
+ * hook directly, over fixed pseudo-random address mixes: low RAM, the
+ * RAM mirror at 0x600000, ROM, with the overlay on and off, and the
+ * MMIO windows.  Each benchmark is run a number of times and reported
+ * as mean ns/op with a 95% confidence interval, so a change to the
+ * address decode (machw.h) can be checked without booting a Mac.
+ *
+ * Build with 'make membench'; it links the emulator core, without the
+ * SDL frontend.
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "umac.h"
+#include "machw.h"
+#include "cpu_cb.h"
+#include "m68k.h"
+#include "via.h"
+#include "scc.h"
+#include "disc.h"
+#include "b2_macos_util.h"
+
+#define NUM_ADDRS	1024		/* Power of 2 */
+#define DEF_ITERS	2000000
+#define DEF_RUNS	20
+#define MAX_RUNS	100
+
+#define VIA_BASE	0xefe1fe
+#define VIA_REG(r)	(VIA_BASE + ((r) << 9))
+#define IWM_BASE	0xdfe1ff
+#define SCC_RD_BASE	0x9ffff8
+
+/* Where the disc benchmark's parameter block etc. live in RAM: */
+#define PB_ADDR		0x8000
+#define DCE_ADDR	0x8100
+#define DRVSTS_ADDR	0x8200
+#define BUF_ADDR	0x10000
+#define DISC_SIZE	(400 * 1024)
+
+static uint8_t ram[RAM_SIZE];
+static uint8_t rom[ROM_SIZE];
+static uint8_t disc_image[DISC_SIZE];
+
+static uint32_t a_ram_lo[NUM_ADDRS], a_ram_hi[NUM_ADDRS], a_rom[NUM_ADDRS];
+static uint32_t a_rom_lo[NUM_ADDRS], a_mix[NUM_ADDRS], a_mix_ovl[NUM_ADDRS];
+static uint32_t a_fetch[NUM_ADDRS], a_fetch_ovl[NUM_ADDRS];
+static uint32_t a_via[NUM_ADDRS], a_via_wr[NUM_ADDRS], a_iwm[NUM_ADDRS], a_scc[NUM_ADDRS];
+
+static volatile unsigned int sink;
+
+/* Provided by the frontend, normally: */
+#if ENABLE_AUDIO
+void umac_audio_frame(void) {}
+void umac_audio_cfg(int volume, int sndres) { (void)volume; (void)sndres; }
+#endif
+
+static uint32_t rnd(void)
+{
+	static uint32_t x = 0x12345678;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/* Even addresses (so word/long accesses are legal), below the low
+ * memory globals:
+ */
+static uint32_t rnd_ram(void)
+{
+	return (0x1000 + rnd() % (RAM_SIZE - 0x1004)) & ~1;
+}
+
+static uint32_t rnd_rom(void)
+{
+	return rnd() % (ROM_SIZE - 4) & ~1;
+}
+
+static void make_addrs(void)
+{
+	static const int via_regs[] = { 0, 13, 14, 15, 4, 8 };	/* RB, IFR, IER, RA, T1, T2 */
+	static const int via_wr_regs[] = { 2, 6, 7 };		/* DDRB, T1 latches */
+
+	for (int i = 0; i < NUM_ADDRS; i++) {
+		uint32_t r = rnd_ram(), o = rnd_rom();
+		unsigned int pick = rnd() % 100;
+
+		a_ram_lo[i] = r;
+		a_ram_hi[i] = RAM_HIGH_ADDR + r;
+		a_rom[i] = ROM_ADDR + o;
+		a_rom_lo[i] = o;
+		/* Roughly a boot's data accesses: mostly RAM, then ROM and I/O */
+		if (pick < 70)
+			a_mix[i] = r;
+		else if (pick < 95)
+			a_mix[i] = ROM_ADDR + o;
+		else
+			a_mix[i] = VIA_REG(via_regs[rnd() % 6]);
+		/* Early boot, with the overlay: ROM at 0 and RAM high */
+		a_mix_ovl[i] = (pick < 50) ? o : (pick < 95) ? RAM_HIGH_ADDR + r : ROM_ADDR + o;
+		/* Fetches are mostly from ROM, once booted */
+		a_fetch[i] = (pick < 60) ? ROM_ADDR + o : r;
+		a_fetch_ovl[i] = (pick < 90) ? o : ROM_ADDR + o;
+		a_via[i] = VIA_REG(via_regs[rnd() % 6]);
+		a_via_wr[i] = VIA_REG(via_wr_regs[rnd() % 3]);
+		a_iwm[i] = IWM_BASE + ((rnd() % 16) << 9);
+		a_scc[i] = SCC_RD_BASE + (rnd() % 4) * 2;
+	}
+}
+
+/* The overlay is switched by VIA port A bit 4, as the ROM does: */
+static void set_overlay(int on)
+{
+	cpu_write_byte(VIA_REG(3), 0x7f);		/* DDRA */
+	cpu_write_byte(VIA_REG(15), on ? 0x10 : 0x00);
+}
+
+static void setup_overlay_off(void)
+{
+	set_overlay(0);
+}
+
+static void setup_overlay_on(void)
+{
+	set_overlay(1);
+}
+
+static void setup_disc(void)
+{
+	set_overlay(0);
+	m68k_set_reg(M68K_REG_A0, PB_ADDR);
+	m68k_set_reg(M68K_REG_A1, DCE_ADDR);
+	m68k_set_reg(M68K_REG_A2, DRVSTS_ADDR);
+	disc_pv_hook(0);					/* Open */
+	RAM_WR16(PB_ADDR + ioTrap, aRdCmd);
+	RAM_WR16(PB_ADDR + ioVRefNum, 1);
+	RAM_WR32(PB_ADDR + ioBuffer, BUF_ADDR);
+	RAM_WR32(PB_ADDR + ioReqCount, 512);
+}
+
+#define LOOP(addrs, body)						\
+	for (unsigned int i = 0; i < n; i++) {				\
+		unsigned int a = addrs[i & (NUM_ADDRS - 1)];		\
+		body;							\
+	}
+
+static void b_rd8_ram(unsigned int n)		{ LOOP(a_ram_lo, sink = cpu_read_byte(a)); }
+static void b_rd16_ram(unsigned int n)		{ LOOP(a_ram_lo, sink = cpu_read_word(a)); }
+static void b_rd32_ram(unsigned int n)		{ LOOP(a_ram_lo, sink = cpu_read_long(a)); }
+static void b_rd8_ram_hi(unsigned int n)	{ LOOP(a_ram_hi, sink = cpu_read_byte(a)); }
+static void b_rd16_ram_hi(unsigned int n)	{ LOOP(a_ram_hi, sink = cpu_read_word(a)); }
+static void b_rd8_rom(unsigned int n)		{ LOOP(a_rom, sink = cpu_read_byte(a)); }
+static void b_rd16_rom(unsigned int n)		{ LOOP(a_rom, sink = cpu_read_word(a)); }
+static void b_rd32_rom(unsigned int n)		{ LOOP(a_rom, sink = cpu_read_long(a)); }
+static void b_rd8_mix(unsigned int n)		{ LOOP(a_mix, sink = cpu_read_byte(a)); }
+static void b_rd8_rom_ovl(unsigned int n)	{ LOOP(a_rom_lo, sink = cpu_read_byte(a)); }
+static void b_rd16_mix_ovl(unsigned int n)	{ LOOP(a_mix_ovl, sink = cpu_read_word(a)); }
+static void b_wr8_ram(unsigned int n)		{ LOOP(a_ram_lo, cpu_write_byte(a, i)); }
+static void b_wr16_ram(unsigned int n)		{ LOOP(a_ram_lo, cpu_write_word(a, i)); }
+static void b_wr32_ram(unsigned int n)		{ LOOP(a_ram_lo, cpu_write_long(a, i)); }
+static void b_wr16_ram_hi(unsigned int n)	{ LOOP(a_ram_hi, cpu_write_word(a, i)); }
+static void b_fetch(unsigned int n)		{ LOOP(a_fetch, sink = cpu_read_instr(a)); }
+static void b_fetch_ovl(unsigned int n)		{ LOOP(a_fetch_ovl, sink = cpu_read_instr(a)); }
+static void b_rd8_via(unsigned int n)		{ LOOP(a_via, sink = cpu_read_byte(a)); }
+static void b_wr8_via(unsigned int n)		{ LOOP(a_via_wr, cpu_write_byte(a, 0)); }
+static void b_rd8_iwm(unsigned int n)		{ LOOP(a_iwm, sink = cpu_read_byte(a)); }
+static void b_rd8_scc(unsigned int n)		{ LOOP(a_scc, sink = cpu_read_byte(a)); }
+static void b_via_read(unsigned int n)		{ LOOP(a_via, sink = via_read(a)); }
+static void b_via_write(unsigned int n)		{ LOOP(a_via_wr, via_write(a, 0)); }
+static void b_scc_read(unsigned int n)		{ LOOP(a_scc, sink = scc_read(a)); }
+
+static void b_disc_read(unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		RAM_WR32(DCE_ADDR + dCtlPosition, ((i * 7) % (DISC_SIZE / 512)) * 512);
+		m68k_set_reg(M68K_REG_A0, PB_ADDR);
+		m68k_set_reg(M68K_REG_A1, DCE_ADDR);
+		sink = disc_pv_hook(1);				/* Prime */
+	}
+}
+
+static const struct bench {
+	const char *name;
+	void (*setup)(void);
+	void (*fn)(unsigned int n);
+	unsigned int scale;		/* Fewer iterations, for slow ops */
+} benches[] = {
+	{ "read_byte ram",		setup_overlay_off,	b_rd8_ram,	1 },
+	{ "read_word ram",		setup_overlay_off,	b_rd16_ram,	1 },
+	{ "read_long ram",		setup_overlay_off,	b_rd32_ram,	1 },
+	{ "read_byte ram_hi",		setup_overlay_off,	b_rd8_ram_hi,	1 },
+	{ "read_word ram_hi",		setup_overlay_off,	b_rd16_ram_hi,	1 },
+	{ "read_byte rom",		setup_overlay_off,	b_rd8_rom,	1 },
+	{ "read_word rom",		setup_overlay_off,	b_rd16_rom,	1 },
+	{ "read_long rom",		setup_overlay_off,	b_rd32_rom,	1 },
+	{ "read_byte mix",		setup_overlay_off,	b_rd8_mix,	1 },
+	{ "read_byte rom overlay",	setup_overlay_on,	b_rd8_rom_ovl,	1 },
+	{ "read_word mix overlay",	setup_overlay_on,	b_rd16_mix_ovl,	1 },
+	{ "write_byte ram",		setup_overlay_off,	b_wr8_ram,	1 },
+	{ "write_word ram",		setup_overlay_off,	b_wr16_ram,	1 },
+	{ "write_long ram",		setup_overlay_off,	b_wr32_ram,	1 },
+	{ "write_word ram_hi",		setup_overlay_off,	b_wr16_ram_hi,	1 },
+	{ "read_instr",			setup_overlay_off,	b_fetch,	1 },
+	{ "read_instr overlay",		setup_overlay_on,	b_fetch_ovl,	1 },
+	{ "read_byte via",		setup_overlay_off,	b_rd8_via,	1 },
+	{ "write_byte via",		setup_overlay_off,	b_wr8_via,	1 },
+	{ "read_byte iwm",		setup_overlay_off,	b_rd8_iwm,	1 },
+	{ "read_byte scc",		setup_overlay_off,	b_rd8_scc,	1 },
+	{ "via_read",			setup_overlay_off,	b_via_read,	1 },
+	{ "via_write",			setup_overlay_off,	b_via_write,	1 },
+	{ "scc_read",			setup_overlay_off,	b_scc_read,	1 },
+	{ "disc_pv_hook read 512",	setup_disc,		b_disc_read,	100 },
+};
+
+/* Two-sided 95% points of Student's t, by degrees of freedom: */
+static double t95(int df)
+{
+	static const double t[] = {
+		0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+		2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+		2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+		2.042,
+	};
+	return (df < (int)(sizeof(t) / sizeof(t[0]))) ? t[df] : 1.96;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const struct bench *b, unsigned int iters, int runs)
+{
+	double ns[MAX_RUNS], mean = 0, var = 0, min = 1e30;
+	unsigned int n = iters / b->scale;
+
+	b->setup();
+	b->fn(n / 10 + 1);					/* Warm up */
+	for (int r = 0; r < runs; r++) {
+		double t = now_ns();
+		b->fn(n);
+		ns[r] = (now_ns() - t) / n;
+		mean += ns[r];
+		if (ns[r] < min)
+			min = ns[r];
+	}
+	mean /= runs;
+	for (int r = 0; r < runs; r++)
+		var += (ns[r] - mean) * (ns[r] - mean);
+	var /= (runs > 1) ? runs - 1 : 1;
+	printf("%-24s %10.3f  +/- %7.3f  (min %.3f)\n", b->name, mean,
+	       t95(runs - 1) * sqrt(var / runs), min);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int iters = DEF_ITERS;
+	int runs = DEF_RUNS;
+	const char *filter = NULL;
+	disc_descr_t discs[DISC_NUM_DRIVES];
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			iters = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else if (argv[i][0] != '-' && !filter) {
+			filter = argv[i];
+		} else {
+			printf("Syntax: %s [-n <iterations>] [-r <runs>] [<name filter>]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (runs < 2 || runs > MAX_RUNS || iters < 100) {
+		printf("Need 2-%d runs, and at least 100 iterations\n", MAX_RUNS);
+		return 1;
+	}
+
+	memset(discs, 0, sizeof(discs));
+	discs[0].base = disc_image;
+	discs[0].size = DISC_SIZE;
+	discs[0].read_only = 1;
+	umac_init(ram, rom, discs);
+	make_addrs();
+
+	printf("%d runs of %u ops (RAM %dK, metrics %d, memheat %d); ns/op, 95%% CI:\n",
+	       runs, iters, RAM_SIZE / 1024, ENABLE_METRICS, ENABLE_MEMHEAT);
+	for (unsigned int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		if (!filter || strstr(benches[i].name, filter))
+			run(&benches[i], iters, runs);
+	return 0;
+}
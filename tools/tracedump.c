@@ -0,0 +1,95 @@
+/* tracedump: disassemble a umac binary trace (see include/trace.h)
+ *
+ * Copyright 2024 Matt Evans
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "m68k.h"
+#include "trace.h"
+
+static const char *reg_names[TRACE_NUM_REGS] = {
+	"D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+	"A0", "A1", "A2", "A3", "A4", "A5", "A6", "A7", "SR"
+};
+
+/* The disassembler reads the instruction being printed: */
+static struct trace_rec *cur;
+
+unsigned int cpu_read_word_dasm(unsigned int address)
+{
+	unsigned int i = (address - cur->pc) / 2;
+	return (i < TRACE_INSN_WORDS) ? cur->words[i] : 0;
+}
+
+unsigned int cpu_read_long_dasm(unsigned int address)
+{
+	return (cpu_read_word_dasm(address) << 16) | cpu_read_word_dasm(address + 2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_hdr h;
+	struct trace_rec r;
+	char buf[100];
+	FILE *f;
+
+	if (argc != 2) {
+		printf("Syntax: %s <trace file>\n", argv[0]);
+		return 1;
+	}
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror("Trace");
+		return 1;
+	}
+	if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+	    h.rec_size != sizeof(r)) {
+		fprintf(stderr, "%s: not a trace, or from a different host\n", argv[1]);
+		return 1;
+	}
+
+	cur = &r;
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.type == TRACE_REC_REG) {
+			printf("%12s  %s=%08x\n", "", (r.reg < TRACE_NUM_REGS) ? reg_names[r.reg] : "??",
+			       r.pc);
+		} else if (r.type == TRACE_REC_WRITE) {
+			printf("%12s  [%06x].%c=%0*x\n", "",
+			       ((unsigned int)r.words[0] << 16) | r.words[1],
+			       (r.reg == 1) ? 'b' : (r.reg == 2) ? 'w' : 'l', r.reg * 2, r.pc);
+		} else if (r.type == TRACE_REC_INSN) {
+			unsigned int len = m68k_disassemble(buf, r.pc, M68K_CPU_TYPE_68000);
+			char hex[TRACE_INSN_WORDS * 5 + 1];
+			char *p = hex;
+
+			*p = '\0';
+			for (unsigned int i = 0; i < len / 2 && i < TRACE_INSN_WORDS; i++)
+				p += sprintf(p, "%04x ", r.words[i]);
+			printf("%12llu  %06x: %-25s %s\n", (unsigned long long)r.cycle, r.pc, hex, buf);
+		}
+	}
+	fclose(f);
+	return 0;
+}